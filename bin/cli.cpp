@@ -0,0 +1,698 @@
+#include "cli.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <unordered_map>
+
+#include "result_cache.hpp"
+
+namespace fs = std::filesystem;
+
+namespace {
+
+// include directory sets includers are kept for, unused ones are dropped when there are more
+constexpr size_t kMaxSessionIncluders = 16;
+// response files including each other are stopped at this depth
+constexpr size_t kMaxResponseFileDepth = 16;
+
+std::string read_all_from_file(const fs::path &path) {
+    std::ifstream fin(path);
+    fin.seekg(0, std::ios::end);
+    auto length = fin.tellg();
+    std::string content(length, '\0');
+    fin.seekg(0, std::ios::beg);
+    fin.read(content.data(), length);
+    while (!content.empty() && content.back() == '\0') { content.pop_back(); }
+    return content;
+}
+
+void write_all_to_file(
+    const std::filesystem::path &path, std::string_view content, std::ios::openmode mode = std::ios::out
+) {
+    std::ofstream fout(path, mode);
+    if (!fout) {
+        auto err_str = "failed to open file '" + path.string() + "' when writing";
+        throw std::runtime_error{err_str};
+    }
+    fout.write(content.data(), content.size());
+}
+
+// make rule of 'target', spaces and special characters in paths are escaped
+// dependencies except the first one are sorted and deduplicated, since a header may be included from many files
+std::string make_depfile(const fs::path &target, std::vector<std::string> dependencies) {
+    if (!dependencies.empty()) {
+        std::sort(dependencies.begin() + 1, dependencies.end());
+        dependencies.erase(std::unique(dependencies.begin() + 1, dependencies.end()), dependencies.end());
+    }
+    auto escape = [](std::string_view path) {
+        std::string escaped{};
+        for (auto ch : path) {
+            if (ch == ' ' || ch == '#') {
+                escaped += '\\';
+            } else if (ch == '$') {
+                escaped += '$';
+            }
+            escaped += ch;
+        }
+        return escaped;
+    };
+    auto depfile = escape(target.string()) + ":";
+    for (const auto &dependency : dependencies) {
+        depfile += " \\\n  " + escape(dependency);
+    }
+    depfile += "\n";
+    return depfile;
+}
+
+// splits text at white spaces, double quotes keep spaces in an argument and backslash escapes the next character
+std::vector<std::string> split_arguments(std::string_view text) {
+    std::vector<std::string> args{};
+    std::string arg{};
+    auto in_arg = false;
+    auto in_quotes = false;
+    for (size_t i = 0; i < text.size(); i++) {
+        auto ch = text[i];
+        if (ch == '\\' && i + 1 < text.size()) {
+            arg += text[++i];
+            in_arg = true;
+        } else if (ch == '"') {
+            in_quotes = !in_quotes;
+            in_arg = true;
+        } else if (!in_quotes && std::isspace(static_cast<unsigned char>(ch))) {
+            if (in_arg) { args.push_back(std::move(arg)); }
+            arg.clear();
+            in_arg = false;
+        } else {
+            arg += ch;
+            in_arg = true;
+        }
+    }
+    if (in_arg) { args.push_back(std::move(arg)); }
+    return args;
+}
+
+// '@<path>' is replaced by arguments in the file, which may contain '@<path>' too
+bool expand_response_files(
+    std::span<const std::string> args, std::vector<std::string> &expanded, std::ostream &err, size_t depth = 0
+) {
+    for (const auto &arg : args) {
+        if (!arg.starts_with('@')) {
+            expanded.push_back(arg);
+            continue;
+        }
+        const fs::path path{arg.substr(1)};
+        if (depth >= kMaxResponseFileDepth || !fs::exists(path)) {
+            err << "invalid response file '" << path.string() << "'" << std::endl;
+            return false;
+        }
+        if (!expand_response_files(split_arguments(read_all_from_file(path)), expanded, err, depth + 1)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// a shader to preprocess and where its result goes
+struct CliInput final {
+    fs::path source_file;
+    fs::path output_file;
+    // '-D' and '-U' of this shader only, applied after shared options and prelude
+    std::vector<std::string> options;
+};
+
+// each line is '<shader> [-o <output>] [-D...] [-U...]' split in the same way as response files,
+// empty lines and lines starting with '#' are skipped
+bool read_manifest(const fs::path &path, std::vector<CliInput> &inputs, std::ostream &err) {
+    std::istringstream ss{read_all_from_file(path)};
+    std::string line{};
+    for (size_t lineno = 1; std::getline(ss, line); lineno++) {
+        auto args = split_arguments(line);
+        if (args.empty() || args[0].starts_with('#')) { continue; }
+        auto report = [&](std::string_view message) {
+            err << path.string() << ":" << lineno << ": " << message << std::endl;
+            return false;
+        };
+        CliInput input{.source_file = args[0], .output_file = {}, .options = {}};
+        if (!fs::exists(input.source_file)) { return report("compiled file '" + args[0] + "' not found"); }
+        for (size_t i = 1; i < args.size(); i++) {
+            if (args[i] == "-o" && i + 1 < args.size()) {
+                input.output_file = args[++i];
+            } else if ((args[i] == "-D" || args[i] == "-U") && i + 1 < args.size()) {
+                input.options.push_back(args[i] + args[i + 1]);
+                ++i;
+            } else if (args[i].size() > 2 && (args[i].starts_with("-D") || args[i].starts_with("-U"))) {
+                input.options.push_back(args[i]);
+            } else {
+                return report("invalid option '" + args[i] + "'");
+            }
+        }
+        inputs.push_back(std::move(input));
+    }
+    return true;
+}
+
+// output mirrors path of the shader relative to working directory,
+// a shader out of working directory is put at the top of output directory
+fs::path output_path_in(const fs::path &output_dir, const fs::path &source_file) {
+    std::error_code ec;
+    auto relative_path = source_file.is_absolute()
+        ? source_file.lexically_relative(fs::current_path(ec))
+        : source_file.lexically_normal();
+    if (relative_path.empty() || *relative_path.begin() == "..") { relative_path = source_file.filename(); }
+    return output_dir / relative_path;
+}
+
+// runs of sessions sharing an includer may overlap, headers they view are kept until all of them end
+class IncluderRun final {
+public:
+    explicit IncluderRun(SharedIncluder &includer) : includer_(includer) { includer_.begin_run(); }
+    ~IncluderRun() { includer_.end_run(); }
+
+    IncluderRun(const IncluderRun &rhs) = delete;
+    IncluderRun &operator=(const IncluderRun &rhs) = delete;
+
+private:
+    SharedIncluder &includer_;
+};
+
+// everything that affects the result except headers, which are checked by the cache
+std::string describe_cache_inputs(
+    const std::string &source_path,
+    std::string_view source,
+    const std::vector<std::string_view> &options,
+    const std::vector<std::string> &input_options,
+    const std::vector<fs::path> &include_dirs,
+    const fs::path &prelude_file,
+    const std::string &snapshot_file
+) {
+    std::string inputs{"pep-cprep result 1\n"};
+    // relative paths of source and headers appear in output
+    std::error_code ec;
+    inputs += "cwd " + fs::current_path(ec).string() + "\n";
+    inputs += "source " + source_path + " " + std::to_string(pep::cprep::hash_content(source)) + "\n";
+    // '-D X' and '-DX' are the same, order matters since the first definition wins
+    for (size_t i = 0; i < options.size(); i++) {
+        inputs += options[i];
+        if (options[i].size() == 2 && i + 1 < options.size()) { inputs += options[++i]; }
+        inputs += '\n';
+    }
+    // they are applied after prelude, so they are not mixed with shared ones
+    for (const auto &option : input_options) {
+        inputs += "input " + option + "\n";
+    }
+    for (const auto &dir : include_dirs) {
+        inputs += "-I" + dir.string() + "\n";
+    }
+    if (!prelude_file.empty()) {
+        inputs += "prelude " + prelude_file.string() + " "
+            + std::to_string(pep::cprep::hash_content(read_all_from_file(prelude_file))) + "\n";
+    }
+    if (!snapshot_file.empty()) {
+        inputs += "snapshot " + std::to_string(pep::cprep::hash_content(read_all_from_file(snapshot_file))) + "\n";
+    }
+    return inputs;
+}
+
+}
+
+void SharedIncluder::begin_run() {
+    std::unique_lock lock{mutex_};
+    if (active_runs_ > 0) {
+        // changes seen by the watcher drop headers, which running ones may view,
+        // without watching, headers are checked again by lookups of the new run
+        if (includer_.has_pending_changes()) {
+            draining_ = true;
+        } else {
+            includer_.revalidate();
+        }
+    }
+    run_cv_.wait(lock, [this]() { return !draining_; });
+    ++active_runs_;
+}
+
+void SharedIncluder::end_run() {
+    std::lock_guard lock{mutex_};
+    if (--active_runs_ == 0) {
+        includer_.clear();
+        draining_ = false;
+        run_cv_.notify_all();
+    }
+}
+
+bool SharedIncluder::require_header(std::string_view header_name, std::string_view file_path, Result &result) {
+    return require_header(header_name, file_path, HeaderForm::eQuoted, result);
+}
+
+bool SharedIncluder::require_header(
+    std::string_view header_name, std::string_view file_path, HeaderForm form, Result &result
+) {
+    std::lock_guard lock{mutex_};
+    return includer_.require_header(header_name, file_path, form, result);
+}
+
+void SharedIncluder::prefetch_header(std::string_view header_name, std::string_view file_path, HeaderForm form) {
+    std::lock_guard lock{mutex_};
+    includer_.prefetch_header(header_name, file_path, form);
+}
+
+std::shared_ptr<SharedIncluder> SharedIncluders::includer(const std::vector<fs::path> &include_dirs) {
+    std::lock_guard lock{mutex_};
+    auto it = includers_.find(include_dirs);
+    if (it == includers_.end()) {
+        // includers in use by running sessions are kept
+        if (includers_.size() >= kMaxSessionIncluders) {
+            std::erase_if(includers_, [](const auto &entry) { return entry.second.use_count() == 1; });
+        }
+        it = includers_.emplace(include_dirs, std::make_shared<SharedIncluder>(include_dirs, clear_policy_)).first;
+    }
+    return it->second;
+}
+
+pep::cprep::PreprocessorPool &CliSession::pool(size_t num_threads) {
+    if (!pool_ || pool_threads_ != num_threads) {
+        pool_ = std::make_unique<pep::cprep::PreprocessorPool>(num_threads);
+        pool_threads_ = num_threads;
+    }
+    return *pool_;
+}
+
+int run_cli(std::span<const std::string> args, CliSession &session, std::ostream &out, std::ostream &err) {
+    std::vector<std::string> expanded_args{};
+    if (!expand_response_files(args, expanded_args, err)) { return -1; }
+    // options are parsed in the same way as 'main()' arguments
+    std::vector<const char *> arg_ptrs{"pep-cprep-bin"};
+    for (const auto &arg : expanded_args) { arg_ptrs.push_back(arg.c_str()); }
+    const auto argc = static_cast<int>(arg_ptrs.size());
+    const auto argv = arg_ptrs.data();
+
+    const char *help_str = R"(pep-cprep-bin [options]... [shader-path]...
+pep-cprep-bin --server <socket> [--lex-cache <dir>]
+pep-cprep-bin --client <socket> [options]... [shader-path]...
+
+[options]
+  -h                   print this help info
+
+  @<path>              read more arguments from a response file,
+                       arguments are separated by white spaces and can be quoted
+
+  -o <path>            set output file path of the only shader,
+                       an output path must be specified for each shader given
+
+  --out-dir <dir>      put outputs of shaders that have no output path in a directory,
+                       an output has the same path in it as its shader in working directory
+
+  --manifest <path>    add shaders listed in a file, one per line as
+                       '<shader> [-o <output>] [-D...] [-U...]',
+                       macros of a line only apply to its shader, after prelude
+
+  -j <threads>         preprocess shaders on threads sharing the header cache,
+                       default is 1, 0 means the number of hardware threads,
+                       messages are printed in the order of shaders
+
+  -I<path>
+  -I <path>            add include directory
+
+  -D<name[=value]>
+  -D <name[=value]>    add predefined macro
+
+  -U<name>
+  -U <name>            remove defined macro
+
+  --snapshot <path>    start from macros and header states in an environment snapshot
+
+  --prelude <path>     preprocess a prelude before the shader,
+                       macros and header states after it are kept
+
+  --emit-snapshot <path>
+                       write macros and header states to an environment snapshot,
+                       after '-D', '-U' and prelude are applied,
+                       shader can be omitted if a snapshot is emitted
+
+  --lex-cache <dir>    keep lexed forms of headers in a cache directory,
+                       so that later runs don't lex shared headers again
+
+  -MD                  write a dependency file of make rule alongside each output,
+                       its path is the output path with extension replaced by '.d'
+
+  -MF <path>           set dependency file path of the only shader, implies -MD
+
+  --cache <dir>        keep results in a cache directory, a result is reused
+                       if the shader and options are not changed and all header lookups
+                       it made find the same unchanged files
+
+  --cache-size <MiB>   set size limit of the result cache directory, default is 1024,
+                       least recently used results are removed when it's exceeded
+
+  --server <socket>    keep running and serve requests from clients on a unix socket,
+                       header contents and lexed forms stay warm across requests,
+                       clients must run in the same working directory as the server
+
+  --client <socket>    send the command line to a server and print its messages,
+                       it runs locally if there is no server on the socket
+)";
+
+    std::vector<CliInput> inputs{};
+    fs::path output_file{};
+    fs::path output_dir{};
+    size_t num_threads = 1;
+    fs::path prelude_file{};
+    std::string snapshot_file{};
+    fs::path emitted_snapshot_file{};
+    bool write_depfile = false;
+    fs::path depfile{};
+    fs::path cache_dir{};
+    uintmax_t cache_size = 1024;
+    std::vector<fs::path> include_dirs;
+    std::vector<std::string_view> passed_options;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-h") == 0) {
+            out << help_str << std::endl;
+            return 0;
+        } else if (strcmp(argv[i], "-o") == 0) {
+            ++i;
+            if (i == argc) {
+                err << "invalid -o option" << std::endl;
+                out << help_str << std::endl;
+                return -1;
+            }
+            if (!output_file.empty()) {
+                err << "multiple output files is not allowed" << std::endl;
+                out << help_str << std::endl;
+                return -1;
+            }
+            output_file = argv[i];
+        } else if (strcmp(argv[i], "--out-dir") == 0) {
+            ++i;
+            if (i == argc) {
+                err << "invalid --out-dir option" << std::endl;
+                out << help_str << std::endl;
+                return -1;
+            }
+            output_dir = argv[i];
+        } else if (strcmp(argv[i], "--manifest") == 0) {
+            ++i;
+            if (i == argc || !fs::exists(argv[i])) {
+                err << "invalid --manifest option" << std::endl;
+                out << help_str << std::endl;
+                return -1;
+            }
+            if (!read_manifest(argv[i], inputs, err)) { return -1; }
+        } else if (strcmp(argv[i], "-j") == 0) {
+            ++i;
+            char *end = nullptr;
+            if (i < argc) { num_threads = std::strtoull(argv[i], &end, 10); }
+            if (i == argc || end == argv[i] || *end != '\0') {
+                err << "invalid -j option" << std::endl;
+                out << help_str << std::endl;
+                return -1;
+            }
+        } else if (strcmp(argv[i], "--prelude") == 0) {
+            ++i;
+            if (i == argc || !fs::exists(argv[i])) {
+                err << "invalid --prelude option" << std::endl;
+                out << help_str << std::endl;
+                return -1;
+            }
+            prelude_file = argv[i];
+        } else if (strcmp(argv[i], "--snapshot") == 0) {
+            ++i;
+            if (i == argc) {
+                err << "invalid --snapshot option" << std::endl;
+                out << help_str << std::endl;
+                return -1;
+            }
+            snapshot_file = argv[i];
+        } else if (strcmp(argv[i], "--emit-snapshot") == 0) {
+            ++i;
+            if (i == argc) {
+                err << "invalid --emit-snapshot option" << std::endl;
+                out << help_str << std::endl;
+                return -1;
+            }
+            emitted_snapshot_file = argv[i];
+        } else if (strcmp(argv[i], "-MD") == 0) {
+            write_depfile = true;
+        } else if (strcmp(argv[i], "-MF") == 0) {
+            ++i;
+            if (i == argc) {
+                err << "invalid -MF option" << std::endl;
+                out << help_str << std::endl;
+                return -1;
+            }
+            write_depfile = true;
+            depfile = argv[i];
+        } else if (strcmp(argv[i], "--cache") == 0) {
+            ++i;
+            if (i == argc) {
+                err << "invalid --cache option" << std::endl;
+                out << help_str << std::endl;
+                return -1;
+            }
+            cache_dir = argv[i];
+        } else if (strcmp(argv[i], "--cache-size") == 0) {
+            ++i;
+            char *end = nullptr;
+            if (i < argc) { cache_size = std::strtoull(argv[i], &end, 10); }
+            if (i == argc || end == argv[i] || *end != '\0') {
+                err << "invalid --cache-size option" << std::endl;
+                out << help_str << std::endl;
+                return -1;
+            }
+        } else if (strcmp(argv[i], "--lex-cache") == 0) {
+            ++i;
+            if (i == argc) {
+                err << "invalid --lex-cache option" << std::endl;
+                out << help_str << std::endl;
+                return -1;
+            }
+            pep::cprep::set_lexed_cache_directory(argv[i]);
+        } else if (strncmp(argv[i], "-I", 2) == 0) {
+            if (argv[i][2] != '\0') {
+                include_dirs.push_back(fs::path{argv[i] + 2});
+            } else {
+                ++i;
+                if (i == argc) {
+                    err << "invalid -I option" << std::endl;
+                    out << help_str << std::endl;
+                    return -1;
+                }
+                include_dirs.push_back(fs::path{argv[i]});
+            }
+        } else if (strncmp(argv[i], "-D", 2) == 0) {
+            if (argv[i][2] != '\0') {
+                passed_options.push_back(argv[i]);
+            } else {
+                ++i;
+                if (i == argc) {
+                    err << "invalid -D option" << std::endl;
+                    out << help_str << std::endl;
+                    return -1;
+                }
+                passed_options.push_back("-D");
+                passed_options.push_back(argv[i]);
+            }
+        } else if (strncmp(argv[i], "-U", 2) == 0) {
+            if (argv[i][2] != '\0') {
+                passed_options.push_back(argv[i]);
+            } else {
+                ++i;
+                if (i == argc) {
+                    err << "invalid -U option" << std::endl;
+                    out << help_str << std::endl;
+                    return -1;
+                }
+                passed_options.push_back("-U");
+                passed_options.push_back(argv[i]);
+            }
+        } else {
+            CliInput input{.source_file = argv[i], .output_file = {}, .options = {}};
+            if (!fs::exists(input.source_file)) {
+                err << "compiled file '" << input.source_file << "' not found" << std::endl;
+                out << help_str << std::endl;
+                return -1;
+            }
+            inputs.push_back(std::move(input));
+        }
+    }
+    if (inputs.empty() && emitted_snapshot_file.empty()) {
+        err << "compiled file is not specified" << std::endl;
+        out << help_str << std::endl;
+        return -1;
+    }
+    if ((!output_file.empty() || !depfile.empty()) && inputs.size() > 1) {
+        err << "-o and -MF are not allowed with multiple compiled files" << std::endl;
+        out << help_str << std::endl;
+        return -1;
+    }
+    for (auto &input : inputs) {
+        if (input.output_file.empty()) {
+            input.output_file = output_dir.empty() ? output_file : output_path_in(output_dir, input.source_file);
+        }
+        if (input.output_file.empty()) {
+            err << "output file of '" << input.source_file.string() << "' is not specified" << std::endl;
+            out << help_str << std::endl;
+            return -1;
+        }
+    }
+
+    auto depfile_of = [&](const CliInput &input) {
+        if (!depfile.empty()) { return depfile; }
+        auto path = input.output_file;
+        path.replace_extension(".d");
+        return path;
+    };
+    // prelude and snapshot, shader and headers are added for each shader
+    std::vector<std::string> shared_dependencies{};
+    if (!prelude_file.empty()) { shared_dependencies.push_back(prelude_file.string()); }
+    if (!snapshot_file.empty()) { shared_dependencies.push_back(snapshot_file); }
+    auto write_result = [&](const CliInput &input, std::string_view output, std::span<const std::string> headers) {
+        if (!output_dir.empty()) {
+            std::error_code ec;
+            fs::create_directories(input.output_file.parent_path(), ec);
+        }
+        write_all_to_file(input.output_file, output);
+        if (write_depfile) {
+            std::vector<std::string> dependencies{input.source_file.string()};
+            dependencies.insert(dependencies.end(), shared_dependencies.begin(), shared_dependencies.end());
+            dependencies.insert(dependencies.end(), headers.begin(), headers.end());
+            write_all_to_file(depfile_of(input), make_depfile(input.output_file, dependencies));
+        }
+    };
+
+    // emitting snapshot needs prelude to run, so the cache is not used
+    auto use_cache = !cache_dir.empty() && emitted_snapshot_file.empty();
+    ResultCache cache{cache_dir, cache_size * 1024 * 1024};
+    std::vector<std::string> source_paths(inputs.size());
+    std::vector<std::string> sources(inputs.size());
+    std::vector<std::string> cache_inputs(inputs.size());
+    // messages are printed after all shaders are done, in the order of shaders
+    std::vector<std::string> messages(inputs.size());
+    // indices of shaders that are not found in the cache
+    std::vector<size_t> uncached_inputs{};
+    auto shared_includer = session.includer(include_dirs);
+    IncluderRun includer_run{*shared_includer};
+    for (size_t i = 0; i < inputs.size(); i++) {
+        source_paths[i] = inputs[i].source_file.string();
+        sources[i] = read_all_from_file(inputs[i].source_file);
+        if (use_cache) {
+            cache_inputs[i] = describe_cache_inputs(
+                source_paths[i], sources[i], passed_options, inputs[i].options, include_dirs, prelude_file, snapshot_file
+            );
+            ResultCache::Entry entry{};
+            if (cache.lookup(cache_inputs[i], *shared_includer, entry)) {
+                messages[i] = std::move(entry.warning);
+                std::vector<std::string> headers{};
+                for (const auto &include : entry.includes) {
+                    if (!include.header_path.empty()) { headers.push_back(include.header_path); }
+                }
+                write_result(inputs[i], entry.output, headers);
+                continue;
+            }
+        }
+        uncached_inputs.push_back(i);
+    }
+    auto print_messages = [&]() {
+        for (const auto &message : messages) { err << message; }
+    };
+    if (uncached_inputs.empty() && emitted_snapshot_file.empty()) {
+        print_messages();
+        return 0;
+    }
+
+    // headers of prelude and all shaders are recorded, so that cached results know their contents
+    RecordingIncluder includer{*shared_includer};
+    auto &preprocessor = session.preprocessor();
+
+    pep::cprep::MacroEnvironment environment{};
+    if (!snapshot_file.empty() && !pep::cprep::MacroEnvironment::load_snapshot(snapshot_file, environment)) {
+        err << "failed to load snapshot '" << snapshot_file << "'" << std::endl;
+        return -1;
+    }
+    // '-D' and '-U' are applied before prelude, as if they are defined at the start of it
+    environment = environment.derive(passed_options.data(), passed_options.size());
+    std::vector<pep::cprep::Preprocessor::IncludeDependency> prelude_includes{};
+    if (!prelude_file.empty()) {
+        auto prelude_path = prelude_file.string();
+        auto prelude = read_all_from_file(prelude_file);
+        pep::cprep::Preprocessor::Result prelude_result{};
+        environment = preprocessor.do_preprocess_prelude(prelude_path, prelude, includer, environment, &prelude_result);
+        if (!prelude_result.error.empty()) {
+            err << prelude_result.error << std::endl;
+            return -1;
+        }
+        prelude_includes = std::move(prelude_result.includes);
+    }
+    if (!emitted_snapshot_file.empty()) {
+        write_all_to_file(emitted_snapshot_file, environment.to_snapshot(), std::ios::out | std::ios::binary);
+    }
+    if (uncached_inputs.empty()) { return 0; }
+
+    std::vector<std::vector<std::string_view>> input_options(inputs.size());
+    std::vector<pep::cprep::PreprocessorPool::Job> jobs{};
+    for (auto i : uncached_inputs) {
+        input_options[i].assign(inputs[i].options.begin(), inputs[i].options.end());
+        jobs.push_back({
+            .input_path = source_paths[i],
+            .input_content = sources[i],
+            .options = input_options[i].data(),
+            .num_options = input_options[i].size(),
+            .environment = &environment,
+        });
+    }
+    auto results = session.pool(num_threads).do_preprocess(jobs, includer);
+
+    // a header has the same content in all shaders since the includer is cleared only after all of them
+    std::unordered_map<std::string, uint64_t> header_hashes{};
+    for (const auto &[path, content_hash] : includer.headers()) {
+        header_hashes.insert({fs::path{path}.lexically_normal().string(), content_hash});
+    }
+    auto exit_code = 0;
+    for (size_t k = 0; k < jobs.size(); k++) {
+        const auto i = uncached_inputs[k];
+        const auto &result = results[k];
+        if (!result.error.empty()) {
+            messages[i] = result.error + "\n";
+            exit_code = -1;
+            continue;
+        }
+        messages[i] = result.warning;
+
+        std::vector<std::string> headers{};
+        ResultCache::Entry entry{.output = result.parsed_result, .warning = result.warning, .includes = {}};
+        // a result is not cached if any header it found is not recorded
+        auto recorded = true;
+        auto add_includes = [&](const std::vector<pep::cprep::Preprocessor::IncludeDependency> &includes) {
+            for (const auto &include : includes) {
+                uint64_t content_hash = 0;
+                if (!include.header_path.empty()) {
+                    headers.push_back(include.header_path);
+                    auto it = header_hashes.find(fs::path{include.header_path}.lexically_normal().string());
+                    if (it == header_hashes.end()) {
+                        recorded = false;
+                    } else {
+                        content_hash = it->second;
+                    }
+                }
+                entry.includes.push_back({
+                    .including_path = include.including_path,
+                    .header_name = include.header_name,
+                    .form = include.form,
+                    .header_path = include.header_path,
+                    .content_hash = content_hash,
+                });
+            }
+        };
+        add_includes(prelude_includes);
+        add_includes(result.includes);
+        write_result(inputs[i], result.parsed_result, headers);
+        // failed results are not cached
+        if (use_cache && recorded) { cache.store(cache_inputs[i], entry); }
+    }
+    print_messages();
+
+    return exit_code;
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <condition_variable>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <span>
+#include <string>
+#include <vector>
+
+#include <cprep/cprep.hpp>
+#include <cprep/fs_includer.hpp>
+#include <cprep/pool.hpp>
+
+// 'FsShaderIncluder' shared by sessions on different threads, calls are serialized by a lock,
+// runs overlapping in time are one run of the includer, so headers viewed by any of them are not dropped,
+// it's cleared when the last of them ends, a run starting after watched files are changed waits for that,
+// otherwise cached headers are validated again by lookups of the run that starts
+class SharedIncluder final : public pep::cprep::ShaderIncluder {
+public:
+    SharedIncluder(std::vector<std::filesystem::path> include_dirs, pep::cprep::FsShaderIncluder::ClearPolicy clear_policy)
+        : includer_(std::move(include_dirs), clear_policy) {}
+
+    void begin_run();
+    void end_run();
+
+    bool require_header(std::string_view header_name, std::string_view file_path, Result &result) override;
+
+    bool require_header(
+        std::string_view header_name, std::string_view file_path, HeaderForm form, Result &result
+    ) override;
+
+    void prefetch_header(std::string_view header_name, std::string_view file_path, HeaderForm form) override;
+
+    // runs are ended by 'end_run()' rather than by each preprocessing
+    void clear() override {}
+
+private:
+    pep::cprep::FsShaderIncluder includer_;
+    std::mutex mutex_;
+    std::condition_variable run_cv_;
+    size_t active_runs_ = 0;
+    // new runs wait until running ones end, so that changes seen by the watcher are polled
+    bool draining_ = false;
+};
+
+// one includer for each set of include directories, it can be shared by sessions on different threads,
+// what happens to header contents between runs is decided by the clear policy
+class SharedIncluders final {
+public:
+    explicit SharedIncluders(pep::cprep::FsShaderIncluder::ClearPolicy clear_policy) : clear_policy_(clear_policy) {}
+
+    std::shared_ptr<SharedIncluder> includer(const std::vector<std::filesystem::path> &include_dirs);
+
+private:
+    pep::cprep::FsShaderIncluder::ClearPolicy clear_policy_;
+    std::mutex mutex_;
+    std::map<std::vector<std::filesystem::path>, std::shared_ptr<SharedIncluder>> includers_;
+};
+
+// states kept across runs of the command line, a server worker keeps one for all requests it serves
+class CliSession final {
+public:
+    explicit CliSession(
+        pep::cprep::FsShaderIncluder::ClearPolicy clear_policy = pep::cprep::FsShaderIncluder::ClearPolicy::eRevalidate
+    ) : includers_(std::make_shared<SharedIncluders>(clear_policy)) {}
+
+    // header caches are shared with other sessions using the same includers
+    explicit CliSession(std::shared_ptr<SharedIncluders> includers) : includers_(std::move(includers)) {}
+
+    pep::cprep::Preprocessor &preprocessor() { return preprocessor_; }
+
+    std::shared_ptr<SharedIncluder> includer(const std::vector<std::filesystem::path> &include_dirs) {
+        return includers_->includer(include_dirs);
+    }
+
+    // pool running shaders of a command line, it's created again if the number of threads changes
+    pep::cprep::PreprocessorPool &pool(size_t num_threads);
+
+private:
+    std::shared_ptr<SharedIncluders> includers_;
+    pep::cprep::Preprocessor preprocessor_;
+    std::unique_ptr<pep::cprep::PreprocessorPool> pool_;
+    size_t pool_threads_ = 0;
+};
+
+// runs the command line, 'args' doesn't contain program name, returns exit code
+int run_cli(std::span<const std::string> args, CliSession &session, std::ostream &out, std::ostream &err);
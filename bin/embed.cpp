@@ -0,0 +1,86 @@
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+#include <cprep/embedded_includer.hpp>
+
+#include "header_files.hpp"
+
+namespace fs = std::filesystem;
+
+int main(int argc, char **argv) {
+    const char *help_str = R"(pep-cprep-embed [options]... <include-dir>...
+
+generate a C++ source defining headers in include directories as 'const EmbeddedHeaderSet <symbol>'
+for 'EmbeddedShaderIncluder', a header's path in the set is its path relative to its include directory,
+the first include directory wins if a path appears in more than one
+
+[options]
+  -h                   print this help info
+
+  -o <path>            set output source path
+
+  --symbol <name>      set name of the header set, it can be qualified by namespaces,
+                       e.g. 'app::shader_headers'
+
+  --ext <extension>    only embed files with the extension, e.g. '.hlsli',
+                       it can be given more than once, all files are embedded if it's not given
+)";
+
+    fs::path output_file{};
+    std::string symbol{};
+    std::vector<fs::path> include_dirs{};
+    std::vector<std::string> extensions{};
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-h") == 0) {
+            std::cout << help_str << std::endl;
+            return 0;
+        } else if (strcmp(argv[i], "-o") == 0) {
+            ++i;
+            if (i == argc) {
+                std::cerr << "invalid -o option" << std::endl;
+                std::cout << help_str << std::endl;
+                return -1;
+            }
+            output_file = argv[i];
+        } else if (strcmp(argv[i], "--symbol") == 0) {
+            ++i;
+            if (i == argc) {
+                std::cerr << "invalid --symbol option" << std::endl;
+                std::cout << help_str << std::endl;
+                return -1;
+            }
+            symbol = argv[i];
+        } else if (strcmp(argv[i], "--ext") == 0) {
+            ++i;
+            if (i == argc) {
+                std::cerr << "invalid --ext option" << std::endl;
+                std::cout << help_str << std::endl;
+                return -1;
+            }
+            extensions.push_back(argv[i]);
+        } else {
+            include_dirs.push_back(argv[i]);
+            if (!fs::is_directory(include_dirs.back())) {
+                std::cerr << "include directory '" << include_dirs.back().string() << "' not found" << std::endl;
+                std::cout << help_str << std::endl;
+                return -1;
+            }
+        }
+    }
+    if (output_file.empty() || symbol.empty() || include_dirs.empty()) {
+        std::cerr << "output file, symbol or include directory is not specified" << std::endl;
+        std::cout << help_str << std::endl;
+        return -1;
+    }
+
+    auto headers = collect_header_files(include_dirs, extensions);
+    std::ofstream fout(output_file, std::ios::binary);
+    auto source = pep::cprep::EmbeddedShaderIncluder::generate_source(headers, symbol);
+    fout.write(source.data(), source.size());
+    if (!fout) {
+        std::cerr << "failed to write '" << output_file.string() << "'" << std::endl;
+        return -1;
+    }
+    return 0;
+}
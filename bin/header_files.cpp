@@ -0,0 +1,43 @@
+#include "header_files.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+std::string read_all_from_file(const fs::path &path) {
+    std::ifstream fin(path, std::ios::binary);
+    std::ostringstream ss;
+    ss << fin.rdbuf();
+    auto content = std::move(ss).str();
+    // same as what 'FsShaderIncluder' reads
+    while (!content.empty() && content.back() == '\0') { content.pop_back(); }
+    return content;
+}
+
+}
+
+std::vector<std::pair<std::string, std::string>> collect_header_files(
+    const std::vector<fs::path> &include_dirs, const std::vector<std::string> &extensions
+) {
+    std::vector<std::pair<std::string, std::string>> headers{};
+    for (const auto &dir : include_dirs) {
+        // sorted, so that the same headers make the same output
+        std::vector<fs::path> files{};
+        for (const auto &entry : fs::recursive_directory_iterator{dir}) {
+            if (!entry.is_regular_file()) { continue; }
+            auto extension = entry.path().extension().string();
+            if (extensions.empty() || std::find(extensions.begin(), extensions.end(), extension) != extensions.end()) {
+                files.push_back(entry.path());
+            }
+        }
+        std::sort(files.begin(), files.end());
+        for (const auto &file : files) {
+            headers.emplace_back(file.lexically_relative(dir).generic_string(), read_all_from_file(file));
+        }
+    }
+    return headers;
+}
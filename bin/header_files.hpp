@@ -0,0 +1,11 @@
+#pragma once
+
+#include <filesystem>
+#include <string>
+#include <vector>
+
+// (path relative to its include directory, content) of files in include directories, sorted in each directory,
+// only files with one of the extensions are taken if any extension is given
+std::vector<std::pair<std::string, std::string>> collect_header_files(
+    const std::vector<std::filesystem::path> &include_dirs, const std::vector<std::string> &extensions
+);
@@ -0,0 +1,74 @@
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+#include <cprep/pack_includer.hpp>
+
+#include "header_files.hpp"
+
+namespace fs = std::filesystem;
+
+int main(int argc, char **argv) {
+    const char *help_str = R"(pep-cprep-pack [options]... <include-dir>...
+
+pack headers in include directories into a single file for 'PackShaderIncluder',
+a header's path in the pack is its path relative to its include directory,
+the first include directory wins if a path appears in more than one
+
+[options]
+  -h                   print this help info
+
+  -o <path>            set output pack path
+
+  --ext <extension>    only pack files with the extension, e.g. '.hlsli',
+                       it can be given more than once, all files are packed if it's not given
+)";
+
+    fs::path output_file{};
+    std::vector<fs::path> include_dirs{};
+    std::vector<std::string> extensions{};
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-h") == 0) {
+            std::cout << help_str << std::endl;
+            return 0;
+        } else if (strcmp(argv[i], "-o") == 0) {
+            ++i;
+            if (i == argc) {
+                std::cerr << "invalid -o option" << std::endl;
+                std::cout << help_str << std::endl;
+                return -1;
+            }
+            output_file = argv[i];
+        } else if (strcmp(argv[i], "--ext") == 0) {
+            ++i;
+            if (i == argc) {
+                std::cerr << "invalid --ext option" << std::endl;
+                std::cout << help_str << std::endl;
+                return -1;
+            }
+            extensions.push_back(argv[i]);
+        } else {
+            include_dirs.push_back(argv[i]);
+            if (!fs::is_directory(include_dirs.back())) {
+                std::cerr << "include directory '" << include_dirs.back().string() << "' not found" << std::endl;
+                std::cout << help_str << std::endl;
+                return -1;
+            }
+        }
+    }
+    if (output_file.empty() || include_dirs.empty()) {
+        std::cerr << "output file or include directory is not specified" << std::endl;
+        std::cout << help_str << std::endl;
+        return -1;
+    }
+
+    auto headers = collect_header_files(include_dirs, extensions);
+    std::ofstream fout(output_file, std::ios::binary);
+    auto pack = pep::cprep::PackShaderIncluder::write(headers);
+    fout.write(pack.data(), pack.size());
+    if (!fout) {
+        std::cerr << "failed to write '" << output_file.string() << "'" << std::endl;
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,304 @@
+#include "result_cache.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <cstdio>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <unordered_map>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+constexpr std::string_view kManifestMagic = "cprep-manifest 2";
+constexpr std::string_view kResultMagic = "cprep-result 1";
+// a manifest keeps the latest sets of header lookups of the same inputs
+constexpr size_t kMaxManifestEntries = 16;
+// approximate size of the directory, so that a store doesn't scan it,
+// it's set by a scan and increased by every store
+constexpr std::string_view kSizeFileName = "size";
+
+std::string hex_of(uint64_t value) {
+    char hex[17];
+    std::snprintf(hex, sizeof(hex), "%016llx", static_cast<unsigned long long>(value));
+    return hex;
+}
+
+std::string normalized_path(const std::string &path) {
+    return fs::path{path}.lexically_normal().string();
+}
+
+// two hashes of different seeds make a 128-bit key
+std::string key_of(std::string_view text) {
+    std::string salted{text};
+    salted += '\x01';
+    return hex_of(pep::cprep::hash_content(text)) + hex_of(pep::cprep::hash_content(salted));
+}
+
+bool read_file(const fs::path &path, std::string &content) {
+    std::ifstream fin(path, std::ios::binary);
+    if (!fin) { return false; }
+    std::ostringstream ss;
+    ss << fin.rdbuf();
+    content = std::move(ss).str();
+    return true;
+}
+
+// other processes may read the file at the same time, so it's written to a temporary file and renamed
+bool write_file_atomically(const fs::path &path, std::string_view content) {
+    static const auto process_tag = std::random_device{}();
+    // server workers write at the same time
+    static std::atomic<size_t> counter = 0;
+    std::error_code ec;
+    fs::create_directories(path.parent_path(), ec);
+    auto temp_path = path;
+    temp_path += ".tmp" + std::to_string(process_tag) + "-" + std::to_string(++counter);
+    {
+        std::ofstream fout(temp_path, std::ios::binary);
+        fout.write(content.data(), content.size());
+        if (!fout) {
+            fout.close();
+            fs::remove(temp_path, ec);
+            return false;
+        }
+    }
+    fs::rename(temp_path, path, ec);
+    if (ec) {
+        fs::remove(temp_path, ec);
+        return false;
+    }
+    return true;
+}
+
+void touch(const fs::path &path) {
+    std::error_code ec;
+    fs::last_write_time(path, fs::file_time_type::clock::now(), ec);
+}
+
+struct ManifestEntry final {
+    std::string result_key;
+    std::vector<ResultCache::Include> includes;
+};
+
+std::vector<ManifestEntry> parse_manifest(const std::string &content) {
+    std::vector<ManifestEntry> entries{};
+    std::istringstream ss{content};
+    std::string line{};
+    if (!std::getline(ss, line) || line != kManifestMagic) { return {}; }
+    while (std::getline(ss, line)) {
+        ManifestEntry entry{};
+        size_t num_includes = 0;
+        std::istringstream entry_ss{line};
+        if (!(entry_ss >> entry.result_key >> num_includes)) { return {}; }
+        for (size_t i = 0; i < num_includes; i++) {
+            // '<content hash> <q|a> <including path>\t<header name>\t<header path>'
+            if (!std::getline(ss, line) || line.size() < 19 || line[16] != ' ' || line[18] != ' ') { return {}; }
+            auto name_start = line.find('\t', 19);
+            auto path_start = name_start == std::string::npos ? name_start : line.find('\t', name_start + 1);
+            if (path_start == std::string::npos || (line[17] != 'q' && line[17] != 'a')) { return {}; }
+            ResultCache::Include include{
+                .including_path = line.substr(19, name_start - 19),
+                .header_name = line.substr(name_start + 1, path_start - name_start - 1),
+                .form = line[17] == 'q'
+                    ? pep::cprep::ShaderIncluder::HeaderForm::eQuoted : pep::cprep::ShaderIncluder::HeaderForm::eAngled,
+                .header_path = line.substr(path_start + 1),
+                .content_hash = std::strtoull(line.substr(0, 16).c_str(), nullptr, 16),
+            };
+            entry.includes.push_back(std::move(include));
+        }
+        entries.push_back(std::move(entry));
+    }
+    return entries;
+}
+
+std::string print_manifest(const std::vector<ManifestEntry> &entries) {
+    std::string content{kManifestMagic};
+    content += '\n';
+    for (const auto &entry : entries) {
+        content += entry.result_key + " " + std::to_string(entry.includes.size()) + "\n";
+        for (const auto &include : entry.includes) {
+            content += hex_of(include.content_hash);
+            content += include.form == pep::cprep::ShaderIncluder::HeaderForm::eQuoted ? " q " : " a ";
+            content += include.including_path + "\t" + include.header_name + "\t" + include.header_path + "\n";
+        }
+    }
+    return content;
+}
+
+// '<magic>\n<output size> <warning size>\n<output><warning>'
+bool parse_result(const std::string &content, ResultCache::Entry &entry) {
+    auto header_end = content.find('\n', kResultMagic.size() + 1);
+    if (!content.starts_with(kResultMagic) || header_end == std::string::npos) { return false; }
+    size_t output_size = 0;
+    size_t warning_size = 0;
+    std::istringstream ss{content.substr(kResultMagic.size() + 1, header_end - kResultMagic.size() - 1)};
+    if (!(ss >> output_size >> warning_size) || content.size() - header_end - 1 != output_size + warning_size) {
+        return false;
+    }
+    entry.output = content.substr(header_end + 1, output_size);
+    entry.warning = content.substr(header_end + 1 + output_size);
+    return true;
+}
+
+}
+
+ResultCache::ResultCache(fs::path dir, uintmax_t max_size) : dir_(std::move(dir)), max_size_(max_size) {}
+
+bool ResultCache::lookup(std::string_view inputs, pep::cprep::ShaderIncluder &includer, Entry &entry) {
+    const auto manifest_path = path_of(key_of(inputs), ".manifest");
+    std::string content{};
+    if (!read_file(manifest_path, content)) { return false; }
+    // a lookup is resolved at most once even if it appears in many entries
+    struct Resolved final {
+        std::string header_path;
+        uint64_t content_hash = 0;
+    };
+    std::unordered_map<std::string, Resolved> resolved_includes{};
+    auto resolve = [&](const Include &include) -> const Resolved & {
+        auto key = std::string{include.form == pep::cprep::ShaderIncluder::HeaderForm::eQuoted ? "\"" : "<"}
+            + include.including_path + '\0' + include.header_name;
+        auto it = resolved_includes.find(key);
+        if (it == resolved_includes.end()) {
+            Resolved resolved{};
+            pep::cprep::ShaderIncluder::Result result{};
+            if (includer.require_header(include.header_name, include.including_path, include.form, result)) {
+                resolved.header_path = normalized_path(result.header_path);
+                resolved.content_hash = result.content_hash != 0
+                    ? result.content_hash : pep::cprep::hash_content(result.header_content);
+            }
+            it = resolved_includes.insert({std::move(key), std::move(resolved)}).first;
+        }
+        return it->second;
+    };
+    auto entries = parse_manifest(content);
+    for (auto it = entries.rbegin(); it != entries.rend(); ++it) {
+        // a lookup that found nothing before must still find nothing, and a found one must find the same file
+        auto matched = std::all_of(it->includes.begin(), it->includes.end(), [&](const Include &include) {
+            const auto &resolved = resolve(include);
+            if (include.header_path.empty()) { return resolved.header_path.empty(); }
+            return resolved.header_path == normalized_path(include.header_path)
+                && resolved.content_hash == include.content_hash;
+        });
+        if (!matched) { continue; }
+        const auto result_path = path_of(it->result_key, ".result");
+        if (!read_file(result_path, content) || !parse_result(content, entry)) { return false; }
+        entry.includes = std::move(it->includes);
+        touch(manifest_path);
+        touch(result_path);
+        return true;
+    }
+    return false;
+}
+
+void ResultCache::store(std::string_view inputs, const Entry &entry) {
+    const auto &includes = entry.includes;
+    // paths and names with new line or tab can't be written to manifest
+    auto printable = [](const std::string &s) { return s.find_first_of("\n\t") == std::string::npos; };
+    for (const auto &include : includes) {
+        if (!printable(include.including_path) || !printable(include.header_name) || !printable(include.header_path)) {
+            return;
+        }
+    }
+
+    std::string result_inputs{inputs};
+    for (const auto &include : includes) {
+        result_inputs += '\0';
+        result_inputs += include.form == pep::cprep::ShaderIncluder::HeaderForm::eQuoted ? '"' : '<';
+        result_inputs += include.including_path + '\0' + include.header_name + '\0' + include.header_path
+            + '\0' + hex_of(include.content_hash);
+    }
+    auto result_key = key_of(result_inputs);
+    auto result_content = std::string{kResultMagic} + "\n"
+        + std::to_string(entry.output.size()) + " " + std::to_string(entry.warning.size()) + "\n"
+        + entry.output + entry.warning;
+    if (!write_file_atomically(path_of(result_key, ".result"), result_content)) { return; }
+    uintmax_t written_size = result_content.size();
+
+    const auto manifest_path = path_of(key_of(inputs), ".manifest");
+    std::string content{};
+    auto entries = read_file(manifest_path, content) ? parse_manifest(content) : std::vector<ManifestEntry>{};
+    std::erase_if(entries, [&result_key](const ManifestEntry &e) { return e.result_key == result_key; });
+    entries.push_back({std::move(result_key), includes});
+    if (entries.size() > kMaxManifestEntries) {
+        entries.erase(entries.begin(), entries.end() - kMaxManifestEntries);
+    }
+    const auto manifest_content = print_manifest(entries);
+    if (write_file_atomically(manifest_path, manifest_content)) { written_size += manifest_content.size(); }
+
+    add_size(written_size);
+}
+
+fs::path ResultCache::path_of(const std::string &key, std::string_view extension) const {
+    auto path = dir_ / key.substr(0, 2) / key;
+    path += extension;
+    return path;
+}
+
+// a rewritten manifest is counted again, so the size is overestimated until the next scan,
+// and it may be underestimated a little when other processes store at the same time
+void ResultCache::add_size(uintmax_t size) {
+    const auto size_path = dir_ / kSizeFileName;
+    std::string content{};
+    uintmax_t total_size = 0;
+    auto known = read_file(size_path, content)
+        && std::from_chars(content.data(), content.data() + content.size(), total_size).ec == std::errc{};
+    // the directory is scanned only when its size is unknown or it may exceed the limit
+    if (!known || total_size + size > max_size_) {
+        evict();
+        return;
+    }
+    write_file_atomically(size_path, std::to_string(total_size + size));
+}
+
+// remove least recently used files until the directory is well below the limit,
+// so that the next scan is done after a tenth of the limit is written
+void ResultCache::evict() {
+    struct CachedFile final {
+        fs::path path;
+        fs::file_time_type mtime;
+        uintmax_t size;
+    };
+    const auto size_path = dir_ / kSizeFileName;
+    std::vector<CachedFile> files{};
+    uintmax_t total_size = 0;
+    std::error_code ec;
+    for (fs::recursive_directory_iterator it{dir_, ec}, end; !ec && it != end; it.increment(ec)) {
+        if (!it->is_regular_file(ec) || it->path() == size_path) { continue; }
+        CachedFile file{.path = it->path(), .mtime = it->last_write_time(ec), .size = it->file_size(ec)};
+        if (ec) {
+            ec.clear();
+            continue;
+        }
+        total_size += file.size;
+        files.push_back(std::move(file));
+    }
+    if (total_size > max_size_) {
+        std::sort(files.begin(), files.end(), [](const CachedFile &a, const CachedFile &b) { return a.mtime < b.mtime; });
+        const auto target_size = max_size_ / 10 * 9;
+        for (const auto &file : files) {
+            if (total_size <= target_size) { break; }
+            if (fs::remove(file.path, ec)) { total_size -= file.size; }
+        }
+    }
+    write_file_atomically(size_path, std::to_string(total_size));
+}
+
+bool RecordingIncluder::require_header(std::string_view header_name, std::string_view file_path, Result &result) {
+    return require_header(header_name, file_path, HeaderForm::eQuoted, result);
+}
+
+bool RecordingIncluder::require_header(
+    std::string_view header_name, std::string_view file_path, HeaderForm form, Result &result
+) {
+    if (!includer_.require_header(header_name, file_path, form, result)) { return false; }
+    if (recorded_paths_.insert(result.header_path).second) {
+        headers_.emplace_back(
+            result.header_path,
+            result.content_hash != 0 ? result.content_hash : pep::cprep::hash_content(result.header_content)
+        );
+    }
+    return true;
+}
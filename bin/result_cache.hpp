@@ -0,0 +1,74 @@
+#pragma once
+
+#include <filesystem>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include <cprep/cprep.hpp>
+
+// content addressed cache of preprocessing results in a directory,
+// a result is found by the inputs of a run (source, options, ...) and all header lookups it made,
+// entries are written atomically and least recently used ones are evicted when the directory is too large
+class ResultCache final {
+public:
+    // a header lookup of '#include' or '__has_include', including those not found,
+    // it's resolved again by lookup so that a header added to an earlier include directory is noticed
+    struct Include final {
+        std::string including_path;
+        std::string header_name;
+        pep::cprep::ShaderIncluder::HeaderForm form = pep::cprep::ShaderIncluder::HeaderForm::eQuoted;
+        // empty if it's not found
+        std::string header_path;
+        uint64_t content_hash = 0;
+    };
+
+    struct Entry final {
+        std::string output;
+        std::string warning;
+        // all header lookups of the run
+        std::vector<Include> includes;
+    };
+
+    ResultCache(std::filesystem::path dir, uintmax_t max_size);
+
+    // 'inputs' describes everything that affects the result except headers,
+    // lookups of a stored entry are resolved by 'includer' and must give the same headers and contents
+    bool lookup(std::string_view inputs, pep::cprep::ShaderIncluder &includer, Entry &entry);
+
+    void store(std::string_view inputs, const Entry &entry);
+
+private:
+    std::filesystem::path path_of(const std::string &key, std::string_view extension) const;
+    void add_size(uintmax_t size);
+    void evict();
+
+    std::filesystem::path dir_;
+    uintmax_t max_size_;
+};
+
+// records headers returned by another includer, so that a cached result can be checked against their contents
+class RecordingIncluder final : public pep::cprep::ShaderIncluder {
+public:
+    explicit RecordingIncluder(pep::cprep::ShaderIncluder &includer) : includer_(includer) {}
+
+    bool require_header(std::string_view header_name, std::string_view file_path, Result &result) override;
+
+    bool require_header(
+        std::string_view header_name, std::string_view file_path, HeaderForm form, Result &result
+    ) override;
+
+    void prefetch_header(std::string_view header_name, std::string_view file_path, HeaderForm form) override {
+        includer_.prefetch_header(header_name, file_path, form);
+    }
+
+    void clear() override { includer_.clear(); }
+
+    // (header path, content hash) of headers opened
+    const std::vector<std::pair<std::string, uint64_t>> &headers() const { return headers_; }
+
+private:
+    pep::cprep::ShaderIncluder &includer_;
+    std::vector<std::pair<std::string, uint64_t>> headers_;
+    std::unordered_set<std::string> recorded_paths_;
+};
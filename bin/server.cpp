@@ -0,0 +1,342 @@
+#include "server.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include "cli.hpp"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define CPREP_HAS_UNIX_SOCKET 1
+#include <csignal>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#else
+#define CPREP_HAS_UNIX_SOCKET 0
+#endif
+
+#if CPREP_HAS_UNIX_SOCKET
+
+namespace {
+
+// a message is a 4-byte size followed by payload, numbers are in native byte order since both ends are local,
+// request: version, number of strings, then strings (4-byte size and bytes), which are cwd and arguments,
+// response: status, exit code, then stdout and stderr of the run
+constexpr uint32_t kProtocolVersion = 1;
+constexpr uint32_t kMaxMessageSize = 64 * 1024 * 1024;
+
+enum ResponseStatus : uint32_t {
+    eDone = 0,
+    // the client runs the command line itself
+    eRejected = 1,
+};
+
+bool read_exact(int fd, void *data, size_t size) {
+    auto p = static_cast<char *>(data);
+    while (size > 0) {
+        auto n = ::read(fd, p, size);
+        if (n < 0 && errno == EINTR) { continue; }
+        if (n <= 0) { return false; }
+        p += n;
+        size -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+bool write_exact(int fd, const void *data, size_t size) {
+    auto p = static_cast<const char *>(data);
+    while (size > 0) {
+        auto n = ::write(fd, p, size);
+        if (n < 0 && errno == EINTR) { continue; }
+        if (n <= 0) { return false; }
+        p += n;
+        size -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+bool send_message(int fd, std::string_view payload) {
+    const auto size = static_cast<uint32_t>(payload.size());
+    return payload.size() <= kMaxMessageSize && write_exact(fd, &size, sizeof(size))
+        && write_exact(fd, payload.data(), payload.size());
+}
+
+bool receive_message(int fd, std::string &payload) {
+    uint32_t size = 0;
+    if (!read_exact(fd, &size, sizeof(size)) || size > kMaxMessageSize) { return false; }
+    payload.resize(size);
+    return read_exact(fd, payload.data(), size);
+}
+
+class MessageWriter final {
+public:
+    void u32(uint32_t value) { data_.append(reinterpret_cast<const char *>(&value), sizeof(value)); }
+
+    void str(std::string_view s) {
+        u32(static_cast<uint32_t>(s.size()));
+        data_ += s;
+    }
+
+    const std::string &data() const { return data_; }
+
+private:
+    std::string data_;
+};
+
+class MessageReader final {
+public:
+    explicit MessageReader(std::string_view data) : data_(data) {}
+
+    bool u32(uint32_t &value) {
+        if (data_.size() < sizeof(value)) { return false; }
+        std::memcpy(&value, data_.data(), sizeof(value));
+        data_.remove_prefix(sizeof(value));
+        return true;
+    }
+
+    bool str(std::string &s) {
+        uint32_t size = 0;
+        if (!u32(size) || data_.size() < size) { return false; }
+        s = data_.substr(0, size);
+        data_.remove_prefix(size);
+        return true;
+    }
+
+private:
+    std::string_view data_;
+};
+
+// returns -1 if the path doesn't fit in a socket address
+int make_socket_address(const std::string &socket_path, sockaddr_un &address) {
+    address = {};
+    address.sun_family = AF_UNIX;
+    if (socket_path.size() >= sizeof(address.sun_path)) { return -1; }
+    std::memcpy(address.sun_path, socket_path.c_str(), socket_path.size() + 1);
+    return 0;
+}
+
+int connect_to(const std::string &socket_path) {
+    sockaddr_un address{};
+    if (make_socket_address(socket_path, address) != 0) { return -1; }
+    auto fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) { return -1; }
+    if (::connect(fd, reinterpret_cast<const sockaddr *>(&address), sizeof(address)) != 0) {
+        ::close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+std::string current_dir() {
+    std::error_code ec;
+    return std::filesystem::current_path(ec).string();
+}
+
+volatile std::sig_atomic_t stop_requested = 0;
+
+void request_stop(int) { stop_requested = 1; }
+
+// accepted connections waiting for workers
+class ConnectionQueue final {
+public:
+    void push(int fd) {
+        {
+            std::lock_guard lock{mutex_};
+            fds_.push_back(fd);
+        }
+        cv_.notify_one();
+    }
+
+    // returns false when the queue is closed and empty
+    bool pop(int &fd) {
+        std::unique_lock lock{mutex_};
+        cv_.wait(lock, [this]() { return closed_ || !fds_.empty(); });
+        if (fds_.empty()) { return false; }
+        fd = fds_.front();
+        fds_.pop_front();
+        return true;
+    }
+
+    void close() {
+        {
+            std::lock_guard lock{mutex_};
+            closed_ = true;
+        }
+        cv_.notify_all();
+    }
+
+private:
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<int> fds_;
+    bool closed_ = false;
+};
+
+// relative paths of a command line are resolved against working directory, so a request from another one is
+// rejected instead of changing directory of the whole server
+void serve_connection(int fd, CliSession &session, const std::string &server_dir) {
+    std::string payload{};
+    if (!receive_message(fd, payload)) { return; }
+    MessageReader reader{payload};
+    uint32_t version = 0;
+    uint32_t num_strings = 0;
+    std::string client_dir{};
+    MessageWriter response{};
+    if (
+        !reader.u32(version) || version != kProtocolVersion || !reader.u32(num_strings) || num_strings == 0
+        || num_strings > payload.size() / sizeof(uint32_t) || !reader.str(client_dir) || client_dir != server_dir
+    ) {
+        response.u32(eRejected);
+        send_message(fd, response.data());
+        return;
+    }
+    std::vector<std::string> args(num_strings - 1);
+    for (auto &arg : args) {
+        if (!reader.str(arg)) { return; }
+    }
+
+    std::ostringstream out{};
+    std::ostringstream err{};
+    int exit_code = 0;
+    try {
+        exit_code = run_cli(args, session, out, err);
+    } catch (const std::exception &e) {
+        err << e.what() << std::endl;
+        exit_code = -1;
+    }
+    response.u32(eDone);
+    response.u32(static_cast<uint32_t>(exit_code));
+    response.str(out.str());
+    response.str(err.str());
+    send_message(fd, response.data());
+}
+
+}
+
+int run_server(const std::string &socket_path, std::span<const std::string> args) {
+    for (size_t i = 0; i < args.size(); i++) {
+        if (args[i] == "--lex-cache" && i + 1 < args.size()) {
+            pep::cprep::set_lexed_cache_directory(args[++i]);
+        } else {
+            std::cerr << "invalid server option '" << args[i] << "'" << std::endl;
+            return -1;
+        }
+    }
+
+    sockaddr_un address{};
+    if (make_socket_address(socket_path, address) != 0) {
+        std::cerr << "socket path '" << socket_path << "' is too long" << std::endl;
+        return -1;
+    }
+    // a socket file left by a server that is gone is removed, but a running server is kept
+    if (auto fd = connect_to(socket_path); fd >= 0) {
+        ::close(fd);
+        std::cerr << "a server is already running on '" << socket_path << "'" << std::endl;
+        return -1;
+    }
+    ::unlink(socket_path.c_str());
+    auto listen_fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (
+        listen_fd < 0 || ::bind(listen_fd, reinterpret_cast<const sockaddr *>(&address), sizeof(address)) != 0
+        || ::listen(listen_fd, SOMAXCONN) != 0
+    ) {
+        std::cerr << "failed to listen on '" << socket_path << "': " << std::strerror(errno) << std::endl;
+        if (listen_fd >= 0) { ::close(listen_fd); }
+        return -1;
+    }
+
+    struct sigaction action{};
+    action.sa_handler = request_stop;
+    ::sigaction(SIGINT, &action, nullptr);
+    ::sigaction(SIGTERM, &action, nullptr);
+    // a client going away while its response is written is not fatal
+    std::signal(SIGPIPE, SIG_IGN);
+
+    const auto server_dir = current_dir();
+    ConnectionQueue connections{};
+    std::vector<std::thread> workers{};
+    const auto num_workers = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+    // workers share header caches, which stay until the watcher sees headers changed
+    auto includers = std::make_shared<SharedIncluders>(pep::cprep::FsShaderIncluder::ClearPolicy::eWatch);
+    for (size_t i = 0; i < num_workers; i++) {
+        workers.emplace_back([&connections, &server_dir, includers]() {
+            CliSession session{includers};
+            int fd = -1;
+            while (connections.pop(fd)) {
+                serve_connection(fd, session, server_dir);
+                ::close(fd);
+            }
+        });
+    }
+
+    // poll wakes up now and then, so that a signal arriving right before it is not missed for long
+    while (!stop_requested) {
+        pollfd poll_fd{listen_fd, POLLIN, 0};
+        if (::poll(&poll_fd, 1, 1000) <= 0) { continue; }
+        auto fd = ::accept(listen_fd, nullptr, nullptr);
+        if (fd >= 0) { connections.push(fd); }
+    }
+
+    connections.close();
+    for (auto &worker : workers) { worker.join(); }
+    ::close(listen_fd);
+    ::unlink(socket_path.c_str());
+    return 0;
+}
+
+int run_client(const std::string &socket_path, std::span<const std::string> args) {
+    auto fd = connect_to(socket_path);
+    if (fd >= 0) {
+        MessageWriter request{};
+        request.u32(kProtocolVersion);
+        request.u32(static_cast<uint32_t>(args.size() + 1));
+        request.str(current_dir());
+        for (const auto &arg : args) { request.str(arg); }
+        std::string payload{};
+        auto received = send_message(fd, request.data()) && receive_message(fd, payload);
+        ::close(fd);
+
+        MessageReader reader{payload};
+        uint32_t status = 0;
+        uint32_t exit_code = 0;
+        std::string out{};
+        std::string err{};
+        if (
+            received && reader.u32(status) && status == eDone
+            && reader.u32(exit_code) && reader.str(out) && reader.str(err)
+        ) {
+            std::cout << out;
+            std::cerr << err;
+            return static_cast<int>(exit_code);
+        }
+    }
+
+    // outputs are the same wherever it runs, so it's safe to run again even if the server has started it
+    CliSession session{};
+    return run_cli(args, session, std::cout, std::cerr);
+}
+
+#else
+
+int run_server(const std::string &socket_path, std::span<const std::string> args) {
+    std::cerr << "server mode is not supported on this platform" << std::endl;
+    return -1;
+}
+
+int run_client(const std::string &socket_path, std::span<const std::string> args) {
+    CliSession session{};
+    return run_cli(args, session, std::cout, std::cerr);
+}
+
+#endif
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <span>
+#include <string>
+
+// serves command lines sent by clients on a unix socket with a pool of workers until SIGINT or SIGTERM,
+// 'args' are options of the server itself, returns exit code
+int run_server(const std::string &socket_path, std::span<const std::string> args);
+
+// sends 'args' to the server on the socket and prints its messages, returns exit code of the request,
+// the command line runs in this process if there is no server or the server can't take it
+int run_client(const std::string &socket_path, std::span<const std::string> args);
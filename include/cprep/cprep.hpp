@@ -1,34 +1,142 @@
 #pragma once
 
+#include <memory>
 #include <string>
+#include <cstdint>
+#include <span>
+#include <vector>
 
 #include "config.hpp"
 
 PEP_CPREP_NAMESPACE_BEGIN
 
+// non-cryptographic 64-bit hash of source contents, never returns 0
+uint64_t hash_content(std::string_view content);
+
+// lexed forms of headers are kept in 'directory' keyed by content hash and mapped by later processes,
+// so that they don't lex shared headers again, it's created if it doesn't exist, empty path disables it
+void set_lexed_cache_directory(std::string_view directory);
+
+// lexed forms kept in memory are shared by all preprocessors in the process and bounded in bytes and entries,
+// this drops them, e.g. between tests, lexed forms still used by running preprocessors are not freed until they finish
+void clear_lexed_cache();
+
 class ShaderIncluder {
 public:
     struct Result final {
         // derived class should own header content
         std::string_view header_content;
         std::string header_path;
+        // optional, derived class can fill it with 'hash_content(header_content)' if it's cached
+        uint64_t content_hash = 0;
+    };
+
+    // '#include "header"' or '#include <header>'
+    enum class HeaderForm {
+        eQuoted,
+        eAngled,
     };
 
     virtual ~ShaderIncluder() = default;
 
     virtual bool require_header(std::string_view header_name, std::string_view file_path, Result &result) = 0;
 
+    // preprocessor calls this one, derived class can override it if header form matters
+    virtual bool require_header(
+        std::string_view header_name, std::string_view file_path, HeaderForm /*form*/, Result &result
+    ) {
+        return require_header(header_name, file_path, result);
+    }
+
+    // called with '#include' lines of a file as soon as the file is entered, before the preprocessor reaches them,
+    // derived class can start loading the headers in background, 'require_header()' is still called when an
+    // '#include' is reached, and headers in inactive branches may be prefetched but never required
+    virtual void prefetch_header(
+        std::string_view /*header_name*/, std::string_view /*file_path*/, HeaderForm /*form*/
+    ) {}
+
     // derived class can release owned header contents in 'clear()'
     virtual void clear() {}
 };
 
+// base class of includers that can be shared by preprocessors running on different threads,
+// looking up loaded headers takes no lock, and loaded headers are kept until 'purge()',
+// so views of header contents stay valid while any preprocessor is running
+class ConcurrentShaderIncluder : public ShaderIncluder {
+public:
+    ConcurrentShaderIncluder();
+    ~ConcurrentShaderIncluder() override;
+
+    ConcurrentShaderIncluder(const ConcurrentShaderIncluder &rhs) = delete;
+    ConcurrentShaderIncluder &operator=(const ConcurrentShaderIncluder &rhs) = delete;
+
+    // derived class resolves header here, it's called at most once for each
+    // (header name, directory of file path, form) until purged, with one of the files in the directory,
+    // it may be called from different threads at the same time
+    virtual bool resolve_header(
+        std::string_view header_name, std::string_view file_path, HeaderForm form, std::string &header_path
+    ) = 0;
+    // derived class loads a resolved header here, it's called at most once for each header path until purged,
+    // so a header included from different directories is loaded and kept once
+    virtual bool load_header(std::string_view header_path, std::string &header_content) = 0;
+
+    bool require_header(std::string_view header_name, std::string_view file_path, Result &result) final;
+
+    bool require_header(
+        std::string_view header_name, std::string_view file_path, HeaderForm form, Result &result
+    ) final;
+
+    // loaded headers are kept across runs
+    void clear() override {}
+
+    // drop all loaded headers, it must not be called while any preprocessor is using this includer
+    void purge();
+
+private:
+    struct Impl;
+    Impl *impl_ = nullptr;
+};
+
 class EmptyInclude final : public pep::cprep::ShaderIncluder {
 public:
-    bool require_header(std::string_view header_name, std::string_view file_path, Result &result) override {
+    bool require_header(
+        std::string_view /*header_name*/, std::string_view /*file_path*/, Result &/*result*/
+    ) override {
         return false;
     }
 };
 
+// immutable set of macros that can be shared by preprocessors on different threads,
+// it's built once from base options and variants are derived from it with a few macros changed,
+// deriving only copies the changed macros
+class MacroEnvironment final {
+public:
+    // no macro is defined
+    MacroEnvironment();
+    // '-D' and '-U' options as those passed to 'Preprocessor::do_preprocess()'
+    MacroEnvironment(const std::string_view *options, size_t num_options);
+
+    // options are applied on top of this environment, '-D' replaces the macro if it's already defined
+    MacroEnvironment derive(const std::string_view *options, size_t num_options) const;
+
+    bool is_defined(std::string_view name) const;
+
+    // macros and header states in a binary blob, it's loaded in place without parsing
+    std::string to_snapshot() const;
+    // returns false if 'data' is not a valid snapshot,
+    // 'data' must outlive 'environment' and environments derived from it
+    static bool from_snapshot(std::string_view data, MacroEnvironment &environment);
+    // file is memory mapped where it's supported, returns false if it can't be read or is not a valid snapshot
+    static bool load_snapshot(const std::string &path, MacroEnvironment &environment);
+
+private:
+    friend class Preprocessor;
+    struct Layer;
+
+    explicit MacroEnvironment(std::shared_ptr<const Layer> layer);
+
+    std::shared_ptr<const Layer> layer_;
+};
 
 class Preprocessor final {
 public:
@@ -41,10 +149,34 @@ public:
     Preprocessor(Preprocessor &&rhs);
     Preprocessor &operator=(Preprocessor &&rhs);
 
+    // state of a macro from options when it's first tested or expanded
+    struct MacroDependency final {
+        std::string name;
+        bool defined = false;
+        std::string value;
+    };
+
+    // a header looked up by '#include' or '__has_include'
+    struct IncludeDependency final {
+        std::string header_name;
+        ShaderIncluder::HeaderForm form = ShaderIncluder::HeaderForm::eQuoted;
+        std::string including_path;
+        // normalized path of the header, empty if it's not found
+        std::string header_path;
+    };
+
     struct Result final {
         std::string parsed_result;
         std::string error;
         std::string warning;
+        // macros from options that the result depends on, sorted by name,
+        // those tested by directives or expanded as builtins, and others read by the source
+        // if options, any option set of the batch or environment define or undefine them,
+        // options giving the same states to these macros and setting no other macros read give the same result
+        std::vector<MacroDependency> macro_dependencies;
+        // distinct header lookups sorted by including path and header name, including those not found,
+        // the result may change if any of them resolves to another file or the file is changed
+        std::vector<IncludeDependency> includes;
     };
 
     Result do_preprocess(
@@ -55,6 +187,61 @@ public:
         size_t num_options = 0
     );
 
+    // macros start from 'environment' and options are applied on top of it
+    Result do_preprocess(
+        std::string_view input_path,
+        std::string_view input_content,
+        ShaderIncluder &includer,
+        const MacroEnvironment &environment,
+        const std::string_view *options = nullptr,
+        size_t num_options = 0
+    );
+
+    // evaluates conditionals and resolves includes without expanding macros in active code,
+    // 'parsed_result' of the result is empty and 'macro_dependencies' only has macros used by directives,
+    // 'includes' is the same as 'do_preprocess()'
+    Result do_scan(
+        std::string_view input_path,
+        std::string_view input_content,
+        ShaderIncluder &includer,
+        const std::string_view *options = nullptr,
+        size_t num_options = 0
+    );
+
+    Result do_scan(
+        std::string_view input_path,
+        std::string_view input_content,
+        ShaderIncluder &includer,
+        const MacroEnvironment &environment,
+        const std::string_view *options = nullptr,
+        size_t num_options = 0
+    );
+
+    // preprocesses a prelude under 'environment' and returns 'environment' with macros the prelude defines or undefines,
+    // output of the prelude is dropped, errors and warnings of it go to 'result' if it's not nullptr
+    MacroEnvironment do_preprocess_prelude(
+        std::string_view input_path,
+        std::string_view input_content,
+        ShaderIncluder &includer,
+        const MacroEnvironment &environment = {},
+        Result *result = nullptr
+    );
+
+    struct OptionSet final {
+        const std::string_view *options = nullptr;
+        size_t num_options = 0;
+    };
+
+    // preprocess the same source under each option set, returns one result per option set,
+    // include resolution, header contents and lexing are shared by the whole batch,
+    // option sets matching macro dependencies of an earlier one reuse its result
+    std::vector<Result> do_preprocess_batch(
+        std::string_view input_path,
+        std::string_view input_content,
+        ShaderIncluder &includer,
+        std::span<const OptionSet> option_sets
+    );
+
 private:
     struct Impl;
     Impl *impl_ = nullptr;
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "cprep.hpp"
+
+PEP_CPREP_NAMESPACE_BEGIN
+
+// a header compiled into the program
+struct EmbeddedHeader final {
+    std::string_view path;
+    std::string_view content;
+    uint64_t content_hash = 0;
+};
+
+// headers and their perfect hash table, generated by 'pep-cprep-embed' or 'cprep_embed_headers()' in CMake,
+// a path is hashed once, its bucket gives a displacement and the displacement gives its slot in 'headers'
+struct EmbeddedHeaderSet final {
+    // in the order of slots
+    const EmbeddedHeader *headers = nullptr;
+    size_t num_headers = 0;
+    const uint32_t *displacements = nullptr;
+    size_t num_buckets = 0;
+};
+
+// includer that reads headers compiled into the program, looking up a header does no I/O and no allocation
+// except for the header path copied to result, and it's safe to call from different threads
+// headers work like an include directory, '#include "x"' looks beside the including header first,
+// header paths are those of the set, e.g. 'common/math.hpp'
+class EmbeddedShaderIncluder final : public ShaderIncluder {
+public:
+    explicit EmbeddedShaderIncluder(const EmbeddedHeaderSet &headers) : headers_(headers) {}
+
+    // C++ source defining 'symbol', which can be qualified by namespaces, as a 'const EmbeddedHeaderSet',
+    // headers are (path relative to the set, content), paths are normalized with '/' as separator,
+    // the first one wins if a path appears more than once
+    static std::string generate_source(
+        const std::vector<std::pair<std::string, std::string>> &headers, std::string_view symbol
+    );
+
+    using ShaderIncluder::require_header;
+
+    bool require_header(std::string_view header_name, std::string_view file_path, Result &result) override;
+
+    bool require_header(
+        std::string_view header_name, std::string_view file_path, HeaderForm form, Result &result
+    ) override;
+
+private:
+    EmbeddedHeaderSet headers_;
+};
+
+PEP_CPREP_NAMESPACE_END
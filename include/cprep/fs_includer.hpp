@@ -0,0 +1,81 @@
+#pragma once
+
+#include <filesystem>
+#include <functional>
+#include <vector>
+
+#include "cprep.hpp"
+
+PEP_CPREP_NAMESPACE_BEGIN
+
+// includer that reads headers from file system, header contents are cached across preprocessing runs
+class FsShaderIncluder final : public ShaderIncluder {
+public:
+    // what to do when preprocessor calls 'clear()' at the end of a run
+    enum class ClearPolicy {
+        // drop all cached headers and include resolutions
+        eDrop,
+        // keep cached headers, they are validated by mtime and size when they are used by next run,
+        // and by content if they were changed right before they were loaded
+        // include resolutions are dropped since headers may be added or removed,
+        // directory listings are kept and validated by mtime of their directories
+        eRevalidate,
+        // keep everything until 'purge()' is called
+        eKeep,
+        // keep everything and watch directories of cached headers and resolutions,
+        // only headers and resolutions affected by changed files are dropped,
+        // it's the same as 'eRevalidate' where watching files is not supported (only Linux is supported now)
+        eWatch,
+    };
+
+    static constexpr size_t kDefaultMaxCachedBytes = 64 * 1024 * 1024;
+
+    FsShaderIncluder(
+        std::vector<std::filesystem::path> include_dirs,
+        ClearPolicy clear_policy = ClearPolicy::eRevalidate,
+        size_t max_cached_bytes = kDefaultMaxCachedBytes
+    );
+    ~FsShaderIncluder() override;
+
+    FsShaderIncluder(const FsShaderIncluder &rhs) = delete;
+    FsShaderIncluder &operator=(const FsShaderIncluder &rhs) = delete;
+
+    using ShaderIncluder::require_header;
+
+    bool require_header(std::string_view header_name, std::string_view file_path, Result &result) override;
+
+    bool require_header(
+        std::string_view header_name, std::string_view file_path, HeaderForm form, Result &result
+    ) override;
+
+    // headers that are not cached are loaded on background threads, so that loads overlap with preprocessing
+    void prefetch_header(std::string_view header_name, std::string_view file_path, HeaderForm form) override;
+
+    void clear() override;
+
+    // drop all cached headers and include resolutions regardless of clear policy
+    void purge();
+
+    // called with path of a changed file that dropped cached headers or resolutions, only used by 'eWatch',
+    // empty path means everything is dropped, e.g. when too many files are changed at once
+    using ChangeListener = std::function<void(const std::string &path)>;
+    void add_change_listener(ChangeListener listener);
+
+    // with 'eWatch', drop what is affected by files changed so far and notify listeners,
+    // it's done before the first header of each run anyway, it must not be called during a run
+    void poll_changes();
+
+    // with 'eRevalidate' and 'eDrop', headers and directories are checked again by following lookups
+    // as if a new run starts, it can be called during a run since headers viewed by the run are kept until 'clear()'
+    void revalidate();
+
+    // whether the watcher has seen changes not polled yet, it can be called during a run,
+    // it's always false with policies other than 'eWatch' since their changes are found by checking each file
+    bool has_pending_changes();
+
+private:
+    struct Impl;
+    Impl *impl_ = nullptr;
+};
+
+PEP_CPREP_NAMESPACE_END
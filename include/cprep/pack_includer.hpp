@@ -0,0 +1,47 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "cprep.hpp"
+
+PEP_CPREP_NAMESPACE_BEGIN
+
+// includer that reads headers from a pack, a single file holding many headers with an index of their paths,
+// the file is memory mapped and header contents are views into it, so nothing is copied
+// a pack works like an include directory, '#include "x"' looks beside the including header in the pack first,
+// header paths are those in the pack, e.g. 'common/math.hpp'
+class PackShaderIncluder final : public ShaderIncluder {
+public:
+    PackShaderIncluder();
+    ~PackShaderIncluder() override;
+
+    PackShaderIncluder(const PackShaderIncluder &rhs) = delete;
+    PackShaderIncluder &operator=(const PackShaderIncluder &rhs) = delete;
+
+    // returns false if the file can't be read or is not a valid pack, headers of the previous pack are dropped anyway
+    bool load(const std::string &path);
+    // 'data' must outlive the includer, e.g. a pack embedded in the program
+    bool load_from_data(std::string_view data);
+
+    // (path in the pack, content) of each header, paths are normalized with '/' as separator,
+    // the first one wins if a path appears more than once,
+    // packs use the byte order of the machine that writes them
+    static std::string write(const std::vector<std::pair<std::string, std::string>> &headers);
+
+    size_t num_headers() const;
+
+    using ShaderIncluder::require_header;
+
+    bool require_header(std::string_view header_name, std::string_view file_path, Result &result) override;
+
+    bool require_header(
+        std::string_view header_name, std::string_view file_path, HeaderForm form, Result &result
+    ) override;
+
+private:
+    struct Impl;
+    Impl *impl_ = nullptr;
+};
+
+PEP_CPREP_NAMESPACE_END
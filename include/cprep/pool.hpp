@@ -0,0 +1,45 @@
+#pragma once
+
+#include <span>
+#include <vector>
+
+#include "cprep.hpp"
+
+PEP_CPREP_NAMESPACE_BEGIN
+
+// runs preprocessing jobs on worker threads, each worker has its own preprocessor,
+// jobs are distributed to workers in contiguous ranges and idle workers steal jobs from others
+class PreprocessorPool final {
+public:
+    // 0 means 'std::thread::hardware_concurrency()'
+    explicit PreprocessorPool(size_t num_threads = 0);
+    ~PreprocessorPool();
+
+    PreprocessorPool(const PreprocessorPool &rhs) = delete;
+    PreprocessorPool &operator=(const PreprocessorPool &rhs) = delete;
+
+    PreprocessorPool(PreprocessorPool &&rhs);
+    PreprocessorPool &operator=(PreprocessorPool &&rhs);
+
+    struct Job final {
+        std::string_view input_path;
+        std::string_view input_content;
+        const std::string_view *options = nullptr;
+        size_t num_options = 0;
+        // if it's not nullptr, options are applied on top of it
+        const MacroEnvironment *environment = nullptr;
+    };
+
+    // results are in the same order as jobs regardless of scheduling
+    // includer is shared by all workers and it's cleared once after all jobs are done,
+    // calls to it are serialized unless it's derived from 'ConcurrentShaderIncluder'
+    std::vector<Preprocessor::Result> do_preprocess(std::span<const Job> jobs, ShaderIncluder &includer);
+
+    size_t num_threads() const;
+
+private:
+    struct Impl;
+    Impl *impl_ = nullptr;
+};
+
+PEP_CPREP_NAMESPACE_END
@@ -0,0 +1,185 @@
+#include <cprep/cprep.hpp>
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "utils.hpp"
+
+PEP_CPREP_NAMESPACE_BEGIN
+
+namespace {
+
+constexpr size_t kNumShards = 64;
+constexpr size_t kInitialBuckets = 16;
+
+// a resolved header path and its content, shared by all resolutions to the path,
+// content is loaded once by the first thread asking for it, others asking for the same one meanwhile wait for it,
+// loads of different headers don't wait for each other
+struct Content final {
+    // header path
+    std::string key;
+    size_t hash = 0;
+    std::once_flag loaded;
+    bool found = false;
+    std::string header_content;
+    uint64_t content_hash = 0;
+};
+
+// (header form, including directory, header name) and the header it resolves to, resolved once like contents
+struct Resolution final {
+    std::string key;
+    size_t hash = 0;
+    std::once_flag resolved;
+    // nullptr if header is not found
+    Content *content = nullptr;
+};
+
+// links are never changed after they are published, so readers walk a chain without lock
+template <typename Entry>
+struct Link final {
+    Entry *entry = nullptr;
+    const Link *next = nullptr;
+};
+
+template <typename Entry>
+struct Table final {
+    explicit Table(size_t num_buckets) : buckets(num_buckets) {}
+
+    std::vector<std::atomic<const Link<Entry> *>> buckets;
+    std::vector<std::unique_ptr<const Link<Entry>>> links;
+};
+
+// readers only load the current table, writers add a link to its bucket under the lock,
+// the table is rebuilt with twice the buckets when it's full, old tables are retired but not freed until purged,
+// since readers may still be using them, they take no more memory than the current one in total
+template <typename Entry>
+struct Shard final {
+    std::atomic<const Table<Entry> *> table{nullptr};
+    std::mutex write_mutex;
+    std::vector<std::unique_ptr<Table<Entry>>> tables;
+    std::vector<std::unique_ptr<Entry>> entries;
+};
+
+template <typename Entry>
+class ConcurrentTable final {
+public:
+    Entry &find_or_insert(std::string_view key, size_t hash) {
+        auto &shard = shards_[hash % kNumShards];
+        if (auto entry = find_in(shard.table.load(std::memory_order_acquire), key, hash)) { return *entry; }
+
+        std::lock_guard lock{shard.write_mutex};
+        // another thread may have added it while waiting for the lock
+        auto table = shard.tables.empty() ? nullptr : shard.tables.back().get();
+        if (auto entry = find_in(table, key, hash)) { return *entry; }
+        auto entry = std::make_unique<Entry>();
+        entry->key = key;
+        entry->hash = hash;
+        shard.entries.push_back(std::move(entry));
+        if (!table || shard.entries.size() > table->buckets.size()) {
+            auto new_table = std::make_unique<Table<Entry>>(table ? table->buckets.size() * 2 : kInitialBuckets);
+            for (const auto &e : shard.entries) { add_link(*new_table, *e); }
+            shard.table.store(new_table.get(), std::memory_order_release);
+            shard.tables.push_back(std::move(new_table));
+        } else {
+            add_link(*table, *shard.entries.back());
+        }
+        return *shard.entries.back();
+    }
+
+    void purge() {
+        for (auto &shard : shards_) {
+            std::lock_guard lock{shard.write_mutex};
+            shard.table.store(nullptr, std::memory_order_release);
+            shard.tables.clear();
+            shard.entries.clear();
+        }
+    }
+
+private:
+    static Entry *find_in(const Table<Entry> *table, std::string_view key, size_t hash) {
+        if (!table) { return nullptr; }
+        auto link = table->buckets[hash / kNumShards % table->buckets.size()].load(std::memory_order_acquire);
+        for (; link; link = link->next) {
+            if (link->entry->hash == hash && link->entry->key == key) { return link->entry; }
+        }
+        return nullptr;
+    }
+
+    // write mutex of the shard must be held
+    static void add_link(Table<Entry> &table, Entry &entry) {
+        auto &bucket = table.buckets[entry.hash / kNumShards % table.buckets.size()];
+        auto link = std::make_unique<Link<Entry>>(Link<Entry>{&entry, bucket.load(std::memory_order_relaxed)});
+        bucket.store(link.get(), std::memory_order_release);
+        table.links.push_back(std::move(link));
+    }
+
+    Shard<Entry> shards_[kNumShards];
+};
+
+}
+
+struct ConcurrentShaderIncluder::Impl final {
+    ConcurrentTable<Resolution> resolutions;
+    ConcurrentTable<Content> contents;
+};
+
+ConcurrentShaderIncluder::ConcurrentShaderIncluder() {
+    impl_ = new Impl{};
+}
+
+ConcurrentShaderIncluder::~ConcurrentShaderIncluder() {
+    if (impl_) { delete impl_; }
+}
+
+bool ConcurrentShaderIncluder::require_header(std::string_view header_name, std::string_view file_path, Result &result) {
+    return require_header(header_name, file_path, HeaderForm::eQuoted, result);
+}
+
+bool ConcurrentShaderIncluder::require_header(
+    std::string_view header_name, std::string_view file_path, HeaderForm form, Result &result
+) {
+    // files in the same directory resolve a header name in the same way
+    const auto dir_end = file_path.find_last_of("/\\");
+    thread_local std::string key{};
+    key.clear();
+    key += form == HeaderForm::eQuoted ? '"' : '<';
+    key += file_path.substr(0, dir_end == std::string_view::npos ? 0 : dir_end);
+    key += '\0';
+    key += header_name;
+
+    // entries are found or added under the lock of their shards, headers are resolved and loaded out of it
+    auto &resolution = impl_->resolutions.find_or_insert(key, StringHash{}(key));
+    std::call_once(resolution.resolved, [&]() {
+        std::string header_path{};
+        if (resolve_header(header_name, file_path, form, header_path)) {
+            resolution.content = &impl_->contents.find_or_insert(header_path, StringHash{}(header_path));
+        }
+    });
+    const auto content = resolution.content;
+    if (!content) {
+        return false;
+    }
+    std::call_once(content->loaded, [&]() {
+        content->found = load_header(content->key, content->header_content);
+        if (content->found) {
+            content->content_hash = hash_content(content->header_content);
+        }
+    });
+
+    if (!content->found) {
+        return false;
+    }
+    result.header_path = content->key;
+    result.header_content = content->header_content;
+    result.content_hash = content->content_hash;
+    return true;
+}
+
+void ConcurrentShaderIncluder::purge() {
+    impl_->resolutions.purge();
+    impl_->contents.purge();
+}
+
+PEP_CPREP_NAMESPACE_END
@@ -5,10 +5,17 @@
 #include <stack>
 #include <queue>
 #include <vector>
+#include <deque>
 #include <algorithm>
+#include <bit>
 
 #include "tokenize.hpp"
+#include "token_cache.hpp"
 #include "evaluate.hpp"
+#include "path_table.hpp"
+#include "header_replay.hpp"
+#include "macro.hpp"
+#include "macro_environment.hpp"
 #include "utils.hpp"
 
 PEP_CPREP_NAMESPACE_BEGIN
@@ -16,21 +23,86 @@ PEP_CPREP_NAMESPACE_BEGIN
 namespace {
 
 constexpr size_t kMaxErrorSize = 4096;
+// paths interned by a preprocessor before it forgets them and the states keyed by them
+constexpr size_t kMaxInternedPaths = 64 * 1024;
 
-struct Define final {
-    std::string_view replace;
-    std::vector<std::string_view> params;
-    bool function_like = false;
-    bool has_va_params = false;
-    std::string_view file;
-    size_t lineno = 0;
+// detect whether the whole file is wrapped in '#ifndef X ... #endif'
+struct IncludeGuard final {
+    enum class State {
+        // nothing is parsed yet
+        eStart,
+        // inside the '#ifndef X', 'if_depth' is the size of if stack after pushing it
+        eInGuard,
+        // after the '#endif' of the guard, only whitespaces are expected until the end of file
+        eAfterGuard,
+        eNotGuarded,
+    };
+    State state = State::eStart;
+    std::string_view macro;
+    size_t if_depth = 0;
 };
 
+// in lane mode, bit i of a mask stands for the i-th option set preprocessed together
+using LaneMask = uint64_t;
+constexpr size_t kMaxLanes = 64;
+
+template <typename F>
+void for_each_lane(LaneMask lanes, F &&func) {
+    while (lanes != 0) {
+        func(static_cast<size_t>(std::countr_zero(lanes)));
+        lanes &= lanes - 1;
+    }
+}
+
 struct FileState final {
-    std::string_view path;
+    FileId file;
+    // file name shown in '#line' and '__FILE__', can be changed by '#line' directive
+    FileId presumed_file;
     std::string_view content;
-    std::string_view included_by_path;
+    FileId included_by;
     size_t included_by_lineno;
+    std::shared_ptr<const LexedSource> lexed;
+    IncludeGuard guard{};
+    // lanes that entered the file and size of 'lane_ifs' when it's entered
+    LaneMask lanes = 1;
+    size_t lane_if_depth = 1;
+    // header is skipped by some active lanes, a lane conditional is pushed for lanes entering it
+    bool pushes_lane_if = false;
+};
+
+struct LoadedHeader final {
+    std::string_view content;
+    uint64_t content_hash = 0;
+    std::shared_ptr<const LexedSource> lexed;
+};
+
+// first access of a macro in a run, macros read before being written by source are dependencies of the result
+struct FirstMacroAccess final {
+    // lanes where the macro is read or written first, a run not in lane mode only has lane 0
+    LaneMask read_lanes = 0;
+    LaneMask written_lanes = 0;
+    bool defined = false;
+    // value from options, valid during the run
+    std::string_view value;
+};
+
+using MacroDependency = Preprocessor::MacroDependency;
+using IncludeDependency = Preprocessor::IncludeDependency;
+
+struct RunDependencies final {
+    size_t result_index;
+    std::unordered_map<std::string_view, const MacroDependency *> dependencies{};
+    std::vector<const MacroDependency *> defined{};
+
+    // 'result' must not be moved while this is used
+    static RunDependencies from(size_t result_index, const Preprocessor::Result &result) {
+        RunDependencies run{.result_index = result_index};
+        for (const auto &dependency : result.macro_dependencies) {
+            run.dependencies.insert({dependency.name, &dependency});
+            if (dependency.defined) { run.defined.push_back(&dependency); }
+        }
+        return run;
+    }
 };
 
 enum class IfState {
@@ -47,6 +119,64 @@ IfState if_state_else(IfState state) {
         : IfState::eFalseWithTrueBefore;
 }
 
+// conditional state of lanes, 'if_stack' keeps the state of the union of lanes
+struct LaneIf final {
+    // lanes where the conditional directive is reached
+    LaneMask parent;
+    // lanes where some branch is taken
+    LaneMask taken;
+    // lanes where current branch is taken
+    LaneMask active;
+
+    IfState to_if_state() const {
+        return active != 0 ? IfState::eTrue
+            : (parent & ~taken) != 0 ? IfState::eFalseWithoutTrueBefore
+            : IfState::eFalseWithTrueBefore;
+    }
+};
+
+// a piece of output of lanes, 'begin' and 'size' are range of the shared output,
+// or 'size' is the number of new lines if 'newlines_only' is set
+struct LaneSegment final {
+    LaneMask lanes;
+    size_t begin;
+    size_t size;
+    bool newlines_only;
+};
+
+// output of an identifier in lanes that agree on macros it uses
+struct LaneExpansion final {
+    LaneMask lanes;
+    std::string output;
+    const char *p_end;
+    size_t end_lineno;
+};
+
+// lanes can't go on together, 'macro' is set if they can be split by the state of it,
+// 'lanes' is set if lanes going one way are known
+struct LaneDivergence final {
+    std::string macro;
+    LaneMask lanes = 0;
+};
+
+// error or warning of the lanes in 'lanes'
+struct LaneMessage final {
+    LaneMask lanes;
+    bool is_error;
+    // false for the error that stops preprocessing, which is added even if there are too many errors
+    bool capped;
+    std::string text;
+};
+
+bool same_define(const Define *a, const Define *b) {
+    if (a == b) { return true; }
+    if (!a || !b) { return false; }
+    return a->replace == b->replace
+        && a->function_like == b->function_like
+        && a->has_va_params == b->has_va_params
+        && a->params == b->params;
+}
+
 constexpr size_t kMaxMacroExpandDepth = 512;
 
 struct Preprocessorror final {
@@ -76,44 +206,6 @@ std::string stringify(std::string_view input) {
     return output;
 }
 
-std::string normalize_path(std::string_view path) {
-    const auto is_absolute = !path.empty() && path[0] == '/';
-    std::vector<std::string_view> parts;
-    size_t last_p = 0;
-    for (auto p = path.find_first_of("/\\"); p != std::string::npos; p = path.find_first_of("/\\", p + 1)) {
-        parts.push_back(path.substr(last_p, p - last_p));
-        last_p = p + 1;
-    }
-    parts.push_back(path.substr(last_p));
-
-    std::vector<size_t> selected_parts;
-    selected_parts.reserve(parts.size());
-    for (size_t i = 0; i < parts.size(); i++) {
-        const auto &s = parts[i];
-        if (s == "..") {
-            if (!selected_parts.empty() && parts[selected_parts.back()] != "..") {
-                selected_parts.pop_back();
-            } else {
-                selected_parts.push_back(i);
-            }
-        } else if (!s.empty() && s != ".") {
-            selected_parts.push_back(i);
-        }
-    }
-
-    std::string normalized_path;
-    if (is_absolute && (selected_parts.empty() || parts[selected_parts[0]] != "..")) {
-        normalized_path += '/';
-    }
-    for (auto i : selected_parts) {
-        normalized_path += std::string{parts[i]} + '/';
-    }
-    if (!normalized_path.empty()) {
-        normalized_path.pop_back();
-    }
-    return normalized_path;
-}
-
 }
 
 struct Preprocessor::Impl final {
@@ -124,114 +216,499 @@ struct Preprocessor::Impl final {
         const std::string_view *options,
         size_t num_options
     ) {
-        init_states(input_path, input_content);
         this->includer = &includer;
         parse_options(options, num_options);
+        auto result = run(input_path, input_content);
+        clear_batch_states();
+        return result;
+    }
+
+    Result do_preprocess(
+        std::string_view input_path,
+        std::string_view input_content,
+        ShaderIncluder &includer,
+        const MacroEnvironment &environment,
+        const std::string_view *options,
+        size_t num_options
+    ) {
+        this->includer = &includer;
+        this->environment = environment.layer_;
+        parse_options(options, num_options);
+        auto result = run(input_path, input_content);
+        clear_batch_states();
+        return result;
+    }
+
+    Result do_scan(
+        std::string_view input_path,
+        std::string_view input_content,
+        ShaderIncluder &includer,
+        const MacroEnvironment &environment,
+        const std::string_view *options,
+        size_t num_options
+    ) {
+        this->includer = &includer;
+        this->environment = environment.layer_;
+        scan_only = true;
+        parse_options(options, num_options);
+        auto result = run(input_path, input_content);
+        scan_only = false;
+        clear_batch_states();
+        return result;
+    }
+
+    MacroEnvironment do_preprocess_prelude(
+        std::string_view input_path,
+        std::string_view input_content,
+        ShaderIncluder &includer,
+        const MacroEnvironment &environment,
+        Result *result
+    ) {
+        this->includer = &includer;
+        this->environment = environment.layer_;
+        MacroEnvironment environment_after{};
+        auto prelude_result = run(input_path, input_content, &environment_after);
+        clear_batch_states();
+        if (result) {
+            prelude_result.parsed_result.clear();
+            *result = std::move(prelude_result);
+        }
+        return environment_after;
+    }
+
+    std::vector<Result> do_preprocess_batch(
+        std::string_view input_path,
+        std::string_view input_content,
+        ShaderIncluder &includer,
+        std::span<const OptionSet> option_sets
+    ) {
+        this->includer = &includer;
+        // sources are used by every run of the batch, lexing them at first sight pays off
+        lex_eagerly = option_sets.size() > 1;
+        // a macro some option set defines is a dependency of all runs, so that runs can be compared
+        for (const auto &option_set : option_sets) {
+            collect_option_macro_names(option_set.options, option_set.num_options);
+        }
+        std::vector<Result> results(option_sets.size());
+        std::vector<RunDependencies> runs;
+        std::vector<size_t> lanes;
+        for (size_t i = 0; i < option_sets.size(); i++) {
+            parse_options(option_sets[i].options, option_sets[i].num_options);
+            // option sets that only differ in macros the source doesn't depend on share the same result
+            auto same_run = find_same_run(runs);
+            defines.clear();
+            if (same_run) {
+                results[i] = results[same_run->result_index];
+                continue;
+            }
+            lanes.push_back(i);
+            if (lanes.size() == kMaxLanes) {
+                run_lane_group(input_path, input_content, option_sets, lanes, results, runs);
+                lanes.clear();
+            }
+        }
+        if (!lanes.empty()) {
+            run_lane_group(input_path, input_content, option_sets, lanes, results, runs);
+        }
+        lex_eagerly = false;
+        clear_batch_states();
+        return results;
+    }
+
+    // 'runs' reference 'results', so 'results' is sized before and each element is written once
+    void run_lane_group(
+        std::string_view input_path,
+        std::string_view input_content,
+        std::span<const OptionSet> option_sets,
+        std::span<const size_t> lanes,
+        std::vector<Result> &results,
+        std::vector<RunDependencies> &runs
+    ) {
+        std::vector<LaneMask> forks{};
+        if (lanes.size() > 1) {
+            if (run_in_lanes(input_path, input_content, option_sets, lanes, results, forks)) {
+                for (auto index : lanes) {
+                    runs.push_back(RunDependencies::from(index, results[index]));
+                }
+                return;
+            }
+            // lanes diverged, each fork goes on as a smaller group
+            if (!forks.empty()) {
+                for (auto fork : forks) {
+                    std::vector<size_t> fork_lanes{};
+                    for_each_lane(fork, [&](size_t lane) { fork_lanes.push_back(lanes[lane]); });
+                    run_lane_group(input_path, input_content, option_sets, fork_lanes, results, runs);
+                }
+                return;
+            }
+        }
+        // lanes diverged in an unknown way, run option sets one by one
+        for (auto index : lanes) {
+            parse_options(option_sets[index].options, option_sets[index].num_options);
+            if (auto same_run = find_same_run(runs)) {
+                defines.clear();
+                results[index] = results[same_run->result_index];
+                continue;
+            }
+            results[index] = run(input_path, input_content);
+            runs.push_back(RunDependencies::from(index, results[index]));
+        }
+    }
+
+    const RunDependencies *find_same_run(const std::vector<RunDependencies> &runs) const {
+        for (const auto &run : runs) {
+            if (matches_dependencies(run)) { return &run; }
+        }
+        return nullptr;
+    }
+
+    // preprocesses option sets together, each of them is a lane.
+    // conditions are evaluated for all lanes reaching them and output is shared by lanes where it's active,
+    // returns false if lanes diverge in a way that is not tracked, e.g. '#line' in only some lanes,
+    // 'forks' is set to groups of lanes that went different ways if they are known
+    bool run_in_lanes(
+        std::string_view input_path,
+        std::string_view input_content,
+        std::span<const OptionSet> option_sets,
+        std::span<const size_t> lanes,
+        std::vector<Result> &results,
+        std::vector<LaneMask> &forks
+    ) {
+        for (auto index : lanes) {
+            parse_options(option_sets[index].options, option_sets[index].num_options);
+            lane_options.push_back(std::move(defines));
+            defines.clear();
+        }
+        lane_mode = true;
+        all_lanes = lanes.size() == kMaxLanes ? ~LaneMask{0} : (LaneMask{1} << lanes.size()) - 1;
+        curr_lanes = all_lanes;
+        init_lane_macros();
+        init_states(input_path, input_content);
+        files.top().lanes = all_lanes;
+        lane_ifs.push_back({all_lanes, all_lanes, all_lanes});
+        lane_segment_lineno = inputs.top().get_lineno();
+
+        Result shared{};
+        shared.parsed_result.reserve(input_content.size());
+        try {
+            parse_source(shared);
+        } catch (const LaneDivergence &e) {
+            if (e.lanes != 0) {
+                forks = split_lanes(e.lanes);
+            } else if (!e.macro.empty()) {
+                forks = group_lanes_by_macro(e.macro, all_lanes);
+            }
+            clear_states();
+            return false;
+        } catch (const Preprocessorror &e) {
+            // a fatal error is shared only if all lanes are at it
+            if (curr_lanes != all_lanes || (!files.empty() && files.top().lanes != all_lanes)) {
+                forks = split_lanes(curr_lanes);
+                clear_states();
+                return false;
+            }
+            if (!files.empty()) { flush_lane_segment(shared); }
+            lane_messages.push_back({all_lanes, true, false, "error: " + e.msg + '\n'});
+        }
+
+        for (size_t lane = 0; lane < lanes.size(); lane++) {
+            auto &result = results[lanes[lane]];
+            result.parsed_result.reserve(shared.parsed_result.size());
+            for (const auto &segment : lane_segments) {
+                if ((segment.lanes >> lane & 1) == 0) { continue; }
+                if (segment.newlines_only) {
+                    result.parsed_result.append(segment.size, '\n');
+                } else {
+                    result.parsed_result.append(shared.parsed_result, segment.begin, segment.size);
+                }
+            }
+            for (const auto &message : lane_messages) {
+                if ((message.lanes >> lane & 1) == 0) { continue; }
+                auto &text = message.is_error ? result.error : result.warning;
+                if (message.capped && text.size() >= kMaxErrorSize) { continue; }
+                text += message.text;
+            }
+            collect_lane_macro_dependencies(result, lane);
+            collect_includes(result, lane);
+        }
+        clear_states();
+        return true;
+    }
+
+    // 'lanes' and the other lanes, or nothing if one of them is empty
+    std::vector<LaneMask> split_lanes(LaneMask lanes) const {
+        if ((lanes & all_lanes) == 0 || (all_lanes & ~lanes) == 0) { return {}; }
+        return {lanes & all_lanes, all_lanes & ~lanes};
+    }
+
+    // macros all lanes agree on go to 'defines', others go to 'lane_defines'
+    void init_lane_macros() {
+        for (const auto &options : lane_options) {
+            for (const auto &[name, def] : options) {
+                if (defines.contains(name) || lane_defines.contains(name)) { continue; }
+                std::vector<const Define *> states(lane_options.size(), nullptr);
+                bool uniform = true;
+                for (size_t lane = 0; lane < lane_options.size(); lane++) {
+                    auto it = lane_options[lane].find(name);
+                    states[lane] = it == lane_options[lane].end() ? nullptr : &it->second;
+                    uniform &= same_define(&def, states[lane]);
+                }
+                if (uniform) {
+                    defines.insert({name, def});
+                } else {
+                    lane_defines.emplace(name, std::move(states));
+                }
+            }
+        }
+    }
+
+    // options must be parsed before
+    Result run(
+        std::string_view input_path, std::string_view input_content, MacroEnvironment *environment_after = nullptr
+    ) {
+        init_states(input_path, input_content);
 
         Result result{};
-        result.parsed_result.reserve(input_content.size());
+        if (!scan_only) { result.parsed_result.reserve(input_content.size()); }
         try {
             parse_source(result);
         } catch (const Preprocessorror &e) {
             result.error += "error: " + e.msg + '\n';
         }
+        // directives still write a few lines to output during a scan
+        if (scan_only) { result.parsed_result.clear(); }
+        collect_macro_dependencies(result);
+        collect_includes(result);
+        if (environment_after) {
+            *environment_after = MacroEnvironment{derive_environment()};
+        }
         clear_states();
         return result;
     }
 
+    // macros changed by a run go to a new layer on top of the environment it starts with
+    std::shared_ptr<const MacroEnvironment::Layer> derive_environment() const {
+        auto layer = MacroEnvironment::Layer::derive(environment);
+        for (auto name : undefined_environment_macros) {
+            if (!defines.contains(name)) { layer->set(name, MacroSnapshot{}); }
+        }
+        for (const auto &[name, def] : defines) {
+            layer->set(name, MacroSnapshot::from(&def));
+        }
+        for (auto file : touched_files) {
+            if (pragma_once_files[file] || !include_guards[file].empty()) {
+                layer->files.push_back({
+                    std::string{paths.path_of(file)}, pragma_once_files[file], std::string{include_guards[file]}
+                });
+            }
+        }
+        return layer;
+    }
+
+    void collect_macro_dependencies(Result &result) {
+        for (const auto &[name, access] : first_macro_accesses) {
+            if (access.read_lanes != 0) {
+                result.macro_dependencies.push_back({name, access.defined, std::string{access.value}});
+            }
+        }
+        sort_macro_dependencies(result);
+    }
+
+    // macros read before written in a lane have values from options of the lane
+    void collect_lane_macro_dependencies(Result &result, size_t lane) {
+        const auto &options = lane_options[lane];
+        for (const auto &[name, access] : first_macro_accesses) {
+            if ((access.read_lanes >> lane & 1) == 0) { continue; }
+            auto it = options.find(name);
+            if (it == options.end()) {
+                result.macro_dependencies.push_back({name, false, {}});
+            } else {
+                result.macro_dependencies.push_back({name, true, std::string{it->second.replace}});
+            }
+        }
+        sort_macro_dependencies(result);
+    }
+
+    static void sort_macro_dependencies(Result &result) {
+        std::sort(
+            result.macro_dependencies.begin(), result.macro_dependencies.end(),
+            [](const MacroDependency &a, const MacroDependency &b) { return a.name < b.name; }
+        );
+    }
+
+    // whether macros defined by options match the dependencies of a run
+    bool matches_dependencies(const RunDependencies &run) const {
+        for (const auto &[name, dependency] : run.dependencies) {
+            const auto *def = lookup_macro(name);
+            if (dependency->defined ? !def || def->replace != dependency->value : def != nullptr) { return false; }
+        }
+        return true;
+    }
+
     void init_states(std::string_view input_path, std::string_view input_content) {
-        auto it = parsed_files.insert(normalize_path(input_path)).first;
-        files.push({*it, input_content});
-        inputs.emplace(input_content);
+        // header states of lower layers are applied first,
+        // guards reference strings of environment, which is kept until the end of run
+        std::vector<const MacroEnvironment::Layer *> layers{};
+        for (auto layer = environment.get(); layer; layer = layer->parent.get()) { layers.push_back(layer); }
+        for (auto it = layers.rbegin(); it != layers.rend(); ++it) {
+            for (const auto &env_file : (*it)->files) {
+                auto file = intern_file(env_file.path);
+                touch_file(file);
+                pragma_once_files[file] = env_file.pragma_once;
+                include_guards[file] = env_file.guard;
+            }
+        }
+        auto file = intern_file(input_path);
+        // a scan only needs directives
+        auto lexed = scan_only ? get_minimized_source(input_content) : get_lexed_source(input_content, 0, lex_eagerly);
+        inputs.emplace(input_content, lexed.get());
+        files.push({file, file, input_content, kInvalidFileId, 0, std::move(lexed)});
         if_stack.push(IfState::eTrue);
+        prefetch_includes(files.top());
     }
 
     void clear_states() {
         defines.clear();
-        parsed_files.clear();
-        pragma_once_files.clear();
+        // only files touched by the run are reset, a long lived preprocessor may know many more
+        for (auto file : touched_files) {
+            pragma_once_files[file] = false;
+            include_guards[file] = {};
+            lane_pragma_once_files[file] = 0;
+            lane_guarded_files[file] = 0;
+            touched_file_flags[file] = false;
+        }
+        touched_files.clear();
+        recordings.clear();
+        replays_in_use.clear();
+        first_macro_accesses.clear();
+        run_includes.clear();
+        run_include_indices.clear();
+        environment.reset();
+        undefined_environment_macros.clear();
+        environment_defines.clear();
+        lane_mode = false;
+        all_lanes = 1;
+        curr_lanes = 1;
+        lane_ifs.clear();
+        lane_defines.clear();
+        lane_define_storage.clear();
+        lane_options.clear();
+        lane_segments.clear();
+        lane_messages.clear();
+        lane_segment_begin = 0;
+        lane_segment_lineno = 0;
         while (!files.empty()) { files.pop(); }
         while (!inputs.empty()) { inputs.pop(); }
         while (!cached_token.empty()) { cached_token.pop(); }
         while (!if_stack.empty()) { if_stack.pop(); }
+    }
+
+    // resolved and loaded headers are shared by all runs of a batch until includer is cleared
+    void clear_batch_states() {
+        option_macro_names.clear();
+        include_resolutions.clear();
+        loaded_headers.clear();
         includer->clear();
+        if (paths.size() > kMaxInternedPaths) { clear_paths(); }
     }
 
-    void parse_options(const std::string_view *options, size_t num_options) {
-        std::unordered_set<std::string_view> undefines;
-
-        auto fetch_and_trim_option = [options](size_t i) {
-            auto opt = options[i];
-            auto opt_b = opt.begin();
-            auto opt_e = opt.end();
-            while (opt_b < opt_e && std::isblank(*opt_b)) { ++opt_b; }
-            while (opt_b < opt_e && std::isblank(*(opt_e - 1))) { --opt_e; }
-            return std::make_pair(opt_b, opt_e);
-        };
+    // file ids are reused after this, so everything keyed by them goes too
+    void clear_paths() {
+        paths.clear();
+        pragma_once_files.clear();
+        include_guards.clear();
+        lane_pragma_once_files.clear();
+        lane_guarded_files.clear();
+        touched_file_flags.clear();
+        entered_files.clear();
+        header_replays.clear();
+        scan_header_replays.clear();
+    }
 
-        for (size_t i = 0; i < num_options; i++) {
-            auto [opt_b, opt_e] = fetch_and_trim_option(i);
-            if (opt_b + 1 >= opt_e || *opt_b != '-') { continue; }
-            ++opt_b;
-            if (*opt_b == 'D') {
-                ++opt_b;
-                if (opt_b == opt_e) {
-                    ++i;
-                    if (i == num_options) { continue; }
-                    std::tie(opt_b, opt_e) = fetch_and_trim_option(i);
-                }
-                auto eq = std::find(opt_b, opt_e, '=');
-                auto name = make_string_view(opt_b, eq);
-                Define def{};
-                if (eq == opt_e) {
-                    def.replace = "";
-                } else {
-                    def.replace = make_string_view(eq + 1, opt_e);
-                }
-                defines.insert({name, def});
-            } else if (*opt_b == 'U') {
-                ++opt_b;
-                if (opt_b == opt_e) {
-                    ++i;
-                    if (i == num_options) { continue; }
-                    std::tie(opt_b, opt_e) = fetch_and_trim_option(i);
-                }
-                undefines.insert(make_string_view(opt_b, opt_e));
-            }
+    void parse_options(const std::string_view *options, size_t num_options) {
+        auto macro_options = parse_macro_options(options, num_options);
+        for (const auto &[name, replace] : macro_options.defines) {
+            defines.insert({name, Define{.replace = replace}});
         }
-
-        for (auto def : undefines) {
-            if (auto it = defines.find(def); it != defines.end()) {
-                defines.erase(it);
-            }
+        for (auto name : macro_options.undefines) {
+            defines.erase(name);
+            hide_environment_macro(name);
         }
+        collect_option_macro_names(options, num_options);
+    }
+
+    // 'options' must outlive the batch
+    void collect_option_macro_names(const std::string_view *options, size_t num_options) {
+        auto macro_options = parse_macro_options(options, num_options);
+        for (const auto &[name, replace] : macro_options.defines) { option_macro_names.insert(name); }
+        for (auto name : macro_options.undefines) { option_macro_names.insert(name); }
     }
 
     void parse_source(Result &result) {
         while (true) {
+            if (if_stack.top() != IfState::eTrue) {
+                skip_inactive_lines(result);
+            }
             auto token = get_token(
                 inputs.top(), result.parsed_result,
-                if_stack.top() == IfState::eTrue ? SpaceKeepType::eAll : SpaceKeepType::eNewLine
+                if_stack.top() != IfState::eTrue ? SpaceKeepType::eNewLine
+                    : scan_only ? SpaceKeepType::eNothing : SpaceKeepType::eAll
             );
             if (token.type == TokenType::eEof) {
+                if (lane_mode) { flush_lane_segment(result); }
                 inputs.pop();
                 auto top_file = files.top();
                 files.pop();
+                if (top_file.guard.state == IncludeGuard::State::eAfterGuard) {
+                    set_include_guard(top_file.file, top_file.guard.macro, top_file.lanes);
+                }
+                if (!recordings.empty() && recordings.back().files_depth == files.size() + 1) {
+                    finish_recording(result);
+                }
                 if (files.empty()) {
                     break;
                 } else {
+                    // lines of the include directive after the header is pushed are not counted for other lanes,
+                    // and conditional directives left open by the header don't exist in other lanes
+                    if (
+                        lane_mode && (files.top().lanes & ~top_file.lanes) != 0
+                        && (
+                            inputs.top().get_lineno() != top_file.included_by_lineno
+                            || lane_ifs.size() != top_file.lane_if_depth
+                        )
+                    ) {
+                        throw LaneDivergence{{}, top_file.lanes};
+                    }
+                    if (top_file.pushes_lane_if) {
+                        lane_ifs.pop_back();
+                        if_stack.pop();
+                        curr_lanes = lane_ifs.back().active;
+                    }
                     result.parsed_result += concat(
                         "\n#line ", top_file.included_by_lineno + 1,
-                        " \"", top_file.included_by_path, "\""
+                        " \"", paths.path_of(top_file.included_by), "\""
                     );
+                    if (lane_mode) {
+                        // the line back to including file belongs to lanes that entered the header
+                        lane_segments.push_back({
+                            top_file.lanes, lane_segment_begin, result.parsed_result.size() - lane_segment_begin, false
+                        });
+                        lane_segment_begin = result.parsed_result.size();
+                        lane_segment_lineno = inputs.top().get_lineno();
+                    }
                 }
             } else if (token.type == TokenType::eUnknown) {
+                // the token is kept even in inactive branch,
+                // if only some lanes skip it, e.g. an unterminated literal in a branch, option sets run one by one,
+                // so that errors and what follows are exactly those of single runs
+                if (lane_mode && curr_lanes != files.top().lanes) { throw LaneDivergence{}; }
                 result.parsed_result += token.value;
                 add_error(result, concat(
-                    "at file '", files.top().path, "' line ", inputs.top().get_lineno(),
+                    "at file '", curr_path(), "' line ", inputs.top().get_lineno(),
                     ", failed to parse a valid token from '", token.value.substr(0, 15), "'"
                 ));
                 inputs.top().set_line_start(false);
+                files.top().guard.state = IncludeGuard::State::eNotGuarded;
                 continue;
             }
 
@@ -240,18 +717,17 @@ struct Preprocessor::Impl final {
 
             if (line_start && token.type == TokenType::eSharp) {
                 parse_directive(result);
-            } else if (if_stack.top() == IfState::eTrue) {
+                continue;
+            }
+            if (files.top().guard.state != IncludeGuard::State::eInGuard) {
+                files.top().guard.state = IncludeGuard::State::eNotGuarded;
+            }
+            if (if_stack.top() == IfState::eTrue && !scan_only) {
                 if (token.type == TokenType::eIdentifier) {
-                    if (auto it = defines.find(token.value); it != defines.end()) {
-                        result.parsed_result += replace_macro(token.value, it->second);
-                    } else if (token.value == "__FILE__") {
-                        result.parsed_result += '"';
-                        result.parsed_result += files.top().path;
-                        result.parsed_result += '"';
-                    } else if (token.value == "__LINE__") {
-                        result.parsed_result += std::to_string(inputs.top().get_lineno());
+                    if (lane_mode) {
+                        expand_identifier_in_lanes(result, token.value);
                     } else {
-                        result.parsed_result += token.value;
+                        append_identifier(result.parsed_result, token.value);
                     }
                 } else {
                     result.parsed_result += token.value;
@@ -264,20 +740,42 @@ struct Preprocessor::Impl final {
         }
     }
 
+    void append_identifier(std::string &output, std::string_view name) {
+        // a builtin is expanded only if it's not defined
+        if (auto def = find_macro(name, name == "__FILE__" || name == "__LINE__")) {
+            output += replace_macro(name, *def);
+        } else if (name == "__FILE__") {
+            output += '"';
+            output += curr_path();
+            output += '"';
+        } else if (name == "__LINE__") {
+            output += std::to_string(inputs.top().get_lineno());
+        } else {
+            output += name;
+        }
+    }
+
     void parse_directive(Result &result) {
         auto &input = inputs.top();
         auto token = get_token(input, result.parsed_result, SpaceKeepType::eNewLine, false, false);
         if (token.type != TokenType::eIdentifier) {
             if (token.type != TokenType::eEof) {
                 throw Preprocessorror{concat(
-                    "at file '", files.top().path, "' line ", input.get_lineno(),
+                    "at file '", curr_path(), "' line ", input.get_lineno(),
                     ", expected an identifier after '#'"
                 )};
             }
             return;
         }
+        update_include_guard_before(token.value);
+        update_recordings_before(token.value);
 
         bool unknown_directive = true;
+        // header is replayed or starts to be recorded after the whole directive line is consumed
+        std::shared_ptr<const HeaderReplay> header_replay{};
+        size_t header_included_lineno = 0;
+        uint64_t header_content_hash = 0;
+        bool start_header_recording = false;
         try {
 
             // not conditional directives
@@ -299,12 +797,12 @@ struct Preprocessor::Impl final {
                     }
                     if (token.value == "error") {
                         add_error(result, concat(
-                            "at file '", files.top().path, "' line ", input.get_lineno(),
+                            "at file '", curr_path(), "' line ", input.get_lineno(),
                             ", ", message, "\n"
                         ));
                     } else {
                         add_warning(result, concat(
-                            "at file '", files.top().path, "' line ", input.get_lineno(),
+                            "at file '", curr_path(), "' line ", input.get_lineno(),
                             ", ", message, "\n"
                         ));
                     }
@@ -313,15 +811,15 @@ struct Preprocessor::Impl final {
                     token = get_token(input, result.parsed_result, SpaceKeepType::eNewLine, false, false);
                     if (token.type != TokenType::eIdentifier) {
                         throw Preprocessorror{concat(
-                            "at file '", files.top().path, "' line ", input.get_lineno(),
+                            "at file '", curr_path(), "' line ", input.get_lineno(),
                             ", expected an identifier after 'pragma'\n"
                         )};
                     }
                     if (token.value == "once") {
-                        pragma_once_files.insert(files.top().path);
+                        set_pragma_once(files.top().file);
                     } else {
                         add_warning(result, concat(
-                            "at file '", files.top().path, "' line ", input.get_lineno(),
+                            "at file '", curr_path(), "' line ", input.get_lineno(),
                             ", unknown pragma '", token.value, "'\n"
                         ));
                         result.parsed_result += "#pragma ";
@@ -329,10 +827,12 @@ struct Preprocessor::Impl final {
                     }
                 } else if (token.value == "line") {
                     unknown_directive = false;
+                    // line number is shared by all lanes in the file
+                    if (lane_mode && curr_lanes != files.top().lanes) { throw LaneDivergence{{}, curr_lanes}; }
                     token = get_token(input, result.parsed_result, SpaceKeepType::eNewLine, false, false);
                     if (token.type != TokenType::eNumber) {
                         throw Preprocessorror{concat(
-                            "at file '", files.top().path, "' line ", input.get_lineno(),
+                            "at file '", curr_path(), "' line ", input.get_lineno(),
                             ", #line directive requires a positive integer argument\n"
                         )};
                     }
@@ -341,13 +841,13 @@ struct Preprocessor::Impl final {
                         line = str_to_number(token.value);
                     } catch (const EvaluateError &e) {
                         throw Preprocessorror{concat(
-                            "at file '", files.top().path, "' line ", input.get_lineno(),
+                            "at file '", curr_path(), "' line ", input.get_lineno(),
                             ", #line directive requires a positive integer argument\n"
                         )};
                     }
                     if (line <= 0) {
                         throw Preprocessorror{concat(
-                            "at file '", files.top().path, "' line ", input.get_lineno(),
+                            "at file '", curr_path(), "' line ", input.get_lineno(),
                             ", #line directive requires a positive integer argument\n"
                         )};
                     }
@@ -355,11 +855,11 @@ struct Preprocessor::Impl final {
                     if (token.type != TokenType::eEof) {
                         if (token.type != TokenType::eString) {
                             throw Preprocessorror{concat(
-                                "at file '", files.top().path, "' line ", input.get_lineno(),
+                                "at file '", curr_path(), "' line ", input.get_lineno(),
                                 ", Invalid filename for #line directive\n"
                             )};
                         }
-                        files.top().path = token.value.substr(1, token.value.size() - 2);
+                        files.top().presumed_file = paths.intern(token.value.substr(1, token.value.size() - 2));
                     }
                     input.set_lineno(line - 1);
                 } else if (token.value == "include") {
@@ -367,17 +867,37 @@ struct Preprocessor::Impl final {
                     token = get_token(input, result.parsed_result, SpaceKeepType::eNewLine, false, false);
                     bool del_is_quot = true;
                     auto header_name = parse_header_name(result.parsed_result, input, token, del_is_quot);
+                    auto form = del_is_quot ? ShaderIncluder::HeaderForm::eQuoted : ShaderIncluder::HeaderForm::eAngled;
                     ShaderIncluder::Result include_result{};
-                    if (includer->require_header(header_name, files.top().path, include_result)) {
-                        include_result.header_path = normalize_path(include_result.header_path);
-                        if (!pragma_once_files.contains(include_result.header_path)) {
-                            auto it = parsed_files.insert(std::move(include_result.header_path)).first;
-                            files.push({
-                                *it, include_result.header_content,
-                                files.top().path, input.get_lineno(),
-                            });
-                            result.parsed_result += concat("#line 1 \"", *it, "\"\n");
-                            inputs.emplace(include_result.header_content);
+                    auto header_file = require_header(header_name, form, include_result);
+                    if (header_file != kInvalidFileId) {
+                        const auto lane_if_depth = lane_ifs.size();
+                        if (lane_mode) { flush_lane_segment(result); }
+                        if (!should_skip_header(header_file)) {
+                            const auto &header = load_header(header_file, header_name, form, include_result);
+                            note_header_entered(header.content_hash);
+                            header_content_hash = header.content_hash;
+                            result.parsed_result += concat("#line 1 \"", paths.path_of(header_file), "\"\n");
+                            // recorded states are not tracked per lane
+                            header_replay = lane_mode ? nullptr : find_header_replay(header_file, header.content_hash);
+                            if (header_replay) {
+                                header_included_lineno = input.get_lineno();
+                            } else {
+                                inputs.emplace(header.content, header.lexed.get());
+                                files.push({
+                                    header_file, header_file, header.content,
+                                    files.top().presumed_file, input.get_lineno(),
+                                    header.lexed,
+                                });
+                                files.top().lanes = curr_lanes;
+                                files.top().lane_if_depth = lane_ifs.size();
+                                files.top().pushes_lane_if = lane_ifs.size() != lane_if_depth;
+                                prefetch_includes(files.top());
+                                lane_segment_lineno = inputs.top().get_lineno();
+                                // record header that is entered before, one-off headers don't pay for recording
+                                start_header_recording = !lane_mode && entered_files[header_file];
+                                entered_files[header_file] = true;
+                            }
                         }
                     } else {
                         result.parsed_result += "#include ";
@@ -385,7 +905,7 @@ struct Preprocessor::Impl final {
                         result.parsed_result += header_name;
                         result.parsed_result += del_is_quot ? '"' : '>';
                         add_warning(result, concat(
-                            "at file '", files.top().path, "' line ", input.get_lineno(),
+                            "at file '", curr_path(), "' line ", input.get_lineno(),
                             ", failed to include header '", header_name, "'\n"
                         ));
                     }
@@ -394,12 +914,12 @@ struct Preprocessor::Impl final {
                     token = get_token(input, result.parsed_result, SpaceKeepType::eNewLine, false, false);
                     if (token.type != TokenType::eIdentifier) {
                         throw Preprocessorror{concat(
-                            "at file '", files.top().path, "' line ", input.get_lineno(),
+                            "at file '", curr_path(), "' line ", input.get_lineno(),
                             ", expected an identifier after 'define'\n"
                         )};
                     }
                     Define macro{
-                        .file = files.top().path,
+                        .file = curr_path(),
                         .lineno = input.get_lineno(),
                     };
                     auto macro_name = token.value;
@@ -413,7 +933,7 @@ struct Preprocessor::Impl final {
                             if (token.type == TokenType::eRightBracketRound) { break; }
                             if (token.type != TokenType::eIdentifier && token.type != TokenType::eTripleDots) {
                                 throw Preprocessorror{concat(
-                                    "at file '", files.top().path, "' line ", input.get_lineno(),
+                                    "at file '", curr_path(), "' line ", input.get_lineno(),
                                     ", expected an identifier or '...' when defining macro paramter\n"
                                 )};
                             }
@@ -422,13 +942,13 @@ struct Preprocessor::Impl final {
                             if (token.type == TokenType::eRightBracketRound) { break; }
                             if (token.type != TokenType::eComma) {
                                 throw Preprocessorror{concat(
-                                    "at file '", files.top().path, "' line ", input.get_lineno(),
+                                    "at file '", curr_path(), "' line ", input.get_lineno(),
                                     ", expected ',' or ')' after a macro paramter\n"
                                 )};
                             }
                             if (macro.has_va_params) {
                                 throw Preprocessorror{concat(
-                                    "at file '", files.top().path, "' line ", input.get_lineno(),
+                                    "at file '", curr_path(), "' line ", input.get_lineno(),
                                     ", '...' must be the last macro paramter\n"
                                 )};
                             }
@@ -440,19 +960,17 @@ struct Preprocessor::Impl final {
                         if (token.type == TokenType::eEof) { break; }
                     }
                     macro.replace = trim_string_view(input.get_substr_to_curr(start));
-                    defines.insert({macro_name, std::move(macro)});
+                    define_macro(macro_name, std::move(macro));
                 } else if (token.value == "undef") {
                     unknown_directive = false;
                     token = get_token(input, result.parsed_result, SpaceKeepType::eNewLine, false, false);
                     if (token.type != TokenType::eIdentifier) {
                         throw Preprocessorror{concat(
-                            "at file '", files.top().path, "' line ", input.get_lineno(),
+                            "at file '", curr_path(), "' line ", input.get_lineno(),
                             ", expected an identifier after 'undef'\n"
                         )};
                     }
-                    if (auto it = defines.find(token.value); it != defines.end()) {
-                        defines.erase(it);
-                    }
+                    undef_macro(token.value);
                 }
             }
 
@@ -461,18 +979,25 @@ struct Preprocessor::Impl final {
             // - elif, elifdef, elifndef
             // - else
             // - endif
-            if (token.value == "ifdef" || token.value == "ifndef") {
+            if (lane_mode && is_conditional_directive(token.value)) {
+                // stays false if the directive fails
+                unknown_directive = false;
+                unknown_directive = parse_lane_conditional(result, input, token.value);
+            } else if (token.value == "ifdef" || token.value == "ifndef") {
                 unknown_directive = false;
                 if (if_stack.top() == IfState::eTrue) {
                     auto is_ifdef = token.value == "ifdef";
                     token = get_token(input, result.parsed_result, SpaceKeepType::eNewLine, false, false);
                     if (token.type != TokenType::eIdentifier) {
                         throw Preprocessorror{concat(
-                            "at file '", files.top().path, "' line ", input.get_lineno(),
+                            "at file '", curr_path(), "' line ", input.get_lineno(),
                             ", expected an identifier after '", token.value, "'\n"
                         )};
                     }
-                    if_stack.push(if_state_from_bool(is_ifdef == defines.contains(token.value)));
+                    if_stack.push(if_state_from_bool(is_ifdef == is_macro_defined(token.value)));
+                    if (!is_ifdef && files.top().guard.state == IncludeGuard::State::eStart) {
+                        files.top().guard = {IncludeGuard::State::eInGuard, token.value, if_stack.size()};
+                    }
                 } else {
                     if_stack.push(IfState::eFalseWithTrueBefore);
                 }
@@ -487,7 +1012,7 @@ struct Preprocessor::Impl final {
                 unknown_directive = false;
                 if (if_stack.size() == 1) {
                     throw Preprocessorror{concat(
-                        "at file '", files.top().path, "' line ", input.get_lineno(),
+                        "at file '", curr_path(), "' line ", input.get_lineno(),
                         ", '#else' without '#if'"
                     )};
                 }
@@ -496,7 +1021,7 @@ struct Preprocessor::Impl final {
                 if (if_stack.size() == 1) {
                 unknown_directive = false;
                     throw Preprocessorror{concat(
-                        "at file '", files.top().path, "' line ", input.get_lineno(),
+                        "at file '", curr_path(), "' line ", input.get_lineno(),
                         ", '", token.value, "' without '#if'"
                     )};
                 }
@@ -504,11 +1029,11 @@ struct Preprocessor::Impl final {
                     token = get_token(input, result.parsed_result, SpaceKeepType::eNewLine, false, false);
                     if (token.type != TokenType::eIdentifier) {
                         throw Preprocessorror{concat(
-                            "at file '", files.top().path, "' line ", input.get_lineno(),
+                            "at file '", curr_path(), "' line ", input.get_lineno(),
                             ", expected an identifier after '", token.value, "'\n"
                         )};
                     }
-                    if_stack.top() = if_state_from_bool((token.value == "elifdef") == defines.contains(token.value));
+                    if_stack.top() = if_state_from_bool((token.value == "elifdef") == is_macro_defined(token.value));
                 } else {
                     if_stack.top() = IfState::eFalseWithTrueBefore;
                 }
@@ -516,7 +1041,7 @@ struct Preprocessor::Impl final {
                 unknown_directive = false;
                 if (if_stack.size() == 1) {
                     throw Preprocessorror{concat(
-                        "at file '", files.top().path, "' line ", input.get_lineno(),
+                        "at file '", curr_path(), "' line ", input.get_lineno(),
                         ", '#elif' without '#if'"
                     )};
                 }
@@ -529,7 +1054,7 @@ struct Preprocessor::Impl final {
                 unknown_directive = false;
                 if (if_stack.size() == 1) {
                     throw Preprocessorror{concat(
-                        "at file '", files.top().path, "' line ", input.get_lineno(),
+                        "at file '", curr_path(), "' line ", input.get_lineno(),
                         ", '#endif' without '#if'"
                     )};
                 }
@@ -538,12 +1063,14 @@ struct Preprocessor::Impl final {
                 result.parsed_result += '#';
                 result.parsed_result += token.value;
                 add_warning(result, concat(
-                    "at file '", files.top().path, "' line ", input.get_lineno(),
+                    "at file '", curr_path(), "' line ", input.get_lineno(),
                     ", unknown directive '", token.value, "'"
                 ));
             }
         } catch (const Preprocessorror &e) {
             add_error(result, e.msg);
+            // lanes of an error in conditional directive may not be the active ones
+            if (lane_mode) { curr_lanes = lane_ifs.back().active; }
         }
 
         // forward to line end
@@ -559,7 +1086,796 @@ struct Preprocessor::Impl final {
                 result.parsed_result += token.value;
             }
         }
+
+        if (header_replay) {
+            apply_header_replay(result, std::move(header_replay), header_included_lineno);
+        } else if (start_header_recording) {
+            recordings.push_back({
+                .file = files.top().file,
+                .content_hash = header_content_hash,
+                .files_depth = files.size(),
+                .if_depth = if_stack.size(),
+                .output_start = result.parsed_result.size(),
+            });
+        }
+    }
+
+    static bool is_conditional_directive(std::string_view directive) {
+        return directive == "if" || directive == "ifdef" || directive == "ifndef" || directive == "else"
+            || directive == "elif" || directive == "elifdef" || directive == "elifndef" || directive == "endif";
+    }
+
+    // conditional directive in lane mode, condition is evaluated for lanes that reach it,
+    // returns true if the rest of line is kept, same as the path not in lane mode
+    bool parse_lane_conditional(Result &result, InputState &input, std::string_view directive) {
+        // output before the directive belongs to lanes active before it
+        flush_lane_segment(result);
+        if (directive == "ifdef" || directive == "ifndef") {
+            const auto parent = lane_ifs.back().active;
+            LaneMask active = 0;
+            std::string_view macro_name{};
+            if (parent != 0) {
+                auto token = get_token(input, result.parsed_result, SpaceKeepType::eNewLine, false, false);
+                if (token.type != TokenType::eIdentifier) {
+                    fail_lane_conditional(parent, concat(
+                        "at file '", curr_path(), "' line ", input.get_lineno(),
+                        ", expected an identifier after '", token.value, "'\n"
+                    ));
+                }
+                macro_name = token.value;
+                const auto defined = lanes_defining(macro_name, parent);
+                active = directive == "ifdef" ? defined : parent & ~defined;
+            }
+            push_lane_if({parent, active, active});
+            if (parent != 0 && directive == "ifndef" && files.top().guard.state == IncludeGuard::State::eStart) {
+                files.top().guard = {IncludeGuard::State::eInGuard, macro_name, if_stack.size()};
+            }
+        } else if (directive == "if") {
+            const auto parent = lane_ifs.back().active;
+            const auto active = parent != 0 ? evaluate_in_lanes(parent) : 0;
+            push_lane_if({parent, active, active});
+        } else {
+            if (lane_ifs.size() == 1) {
+                fail_lane_conditional(files.top().lanes, concat(
+                    "at file '", curr_path(), "' line ", input.get_lineno(),
+                    ", '", directive.starts_with("elif") && directive != "elif" ? std::string_view{} : "#", directive, "' without '#if'"
+                ));
+            }
+            // lanes that didn't enter the header would be changed by its conditional directives
+            if (lane_ifs.size() <= files.top().lane_if_depth && files.top().lanes != all_lanes) {
+                throw LaneDivergence{{}, files.top().lanes};
+            }
+            auto lane_if = lane_ifs.back();
+            const auto candidates = lane_if.parent & ~lane_if.taken;
+            if (directive == "endif") {
+                lane_ifs.pop_back();
+                if_stack.pop();
+                curr_lanes = lane_ifs.back().active;
+                return false;
+            } else if (directive == "else") {
+                lane_if.active = candidates;
+            } else if (directive == "elif") {
+                lane_if.active = candidates != 0 ? evaluate_in_lanes(candidates) : 0;
+            } else {
+                lane_if.active = 0;
+                if (candidates != 0) {
+                    auto token = get_token(input, result.parsed_result, SpaceKeepType::eNewLine, false, false);
+                    if (token.type != TokenType::eIdentifier) {
+                        fail_lane_conditional(candidates, concat(
+                            "at file '", curr_path(), "' line ", input.get_lineno(),
+                            ", expected an identifier after '", token.value, "'\n"
+                        ));
+                    }
+                    const auto defined = lanes_defining(token.value, candidates);
+                    // same as the path not in lane mode, which compares macro name with "elifdef"
+                    lane_if.active = token.value == "elifdef" ? defined : candidates & ~defined;
+                }
+            }
+            lane_if.taken |= lane_if.active;
+            lane_ifs.back() = lane_if;
+            if_stack.top() = lane_if.to_if_state();
+            curr_lanes = lane_if.active;
+        }
+        return directive == "elifdef" || directive == "elifndef";
+    }
+
+    // a failed conditional directive is dropped in lanes reaching it,
+    // which is the same as other lanes only if all lanes in the file reach it
+    [[noreturn]] void fail_lane_conditional(LaneMask lanes, std::string msg) {
+        if (lanes != files.top().lanes) { throw LaneDivergence{{}, lanes}; }
+        curr_lanes = lanes;
+        throw Preprocessorror{std::move(msg)};
+    }
+
+    void push_lane_if(const LaneIf &lane_if) {
+        lane_ifs.push_back(lane_if);
+        if_stack.push(lane_if.to_if_state());
+        curr_lanes = lane_if.active;
+    }
+
+    // evaluates '#if' or '#elif' for lanes, lanes that don't agree on a macro used are evaluated separately
+    LaneMask evaluate_in_lanes(LaneMask lanes) {
+        const auto start = inputs.top();
+        const auto depth = inputs.size();
+        return evaluate_in_lanes(lanes, start, depth);
+    }
+    LaneMask evaluate_in_lanes(LaneMask lanes, const InputState &start, size_t depth) {
+        restore_input(start, depth);
+        curr_lanes = lanes;
+        try {
+            const auto value = evaluate();
+            // a function-like macro looking for '(' went over the line end, where lanes may see other directives
+            if (inputs.top().get_lineno() != start.get_lineno()) { throw LaneDivergence{}; }
+            return value ? lanes : 0;
+        } catch (const Preprocessorror &) {
+            // the directive is dropped in these lanes, which is the same as other lanes only if there are none
+            if (lanes != files.top().lanes) { throw LaneDivergence{{}, lanes}; }
+            throw;
+        } catch (const LaneDivergence &e) {
+            const auto groups = e.macro.empty() ? std::vector<LaneMask>{} : group_lanes_by_macro(e.macro, lanes);
+            if (groups.size() < 2) { throw; }
+            LaneMask result = 0;
+            for (auto group : groups) { result |= evaluate_in_lanes(group, start, depth); }
+            return result;
+        }
+    }
+
+    // lanes that don't agree on macros used by the identifier get their own output
+    void expand_identifier_in_lanes(Result &result, std::string_view name) {
+        const auto active = curr_lanes;
+        const auto start = inputs.top();
+        const auto depth = inputs.size();
+        try {
+            append_identifier(result.parsed_result, name);
+            check_lines_consumed(active, start);
+            return;
+        } catch (const LaneDivergence &e) {
+            if (e.macro.empty()) { throw; }
+        }
+
+        std::vector<LaneExpansion> expansions{};
+        expand_in_lanes(name, active, start, depth, expansions);
+        curr_lanes = active;
+        // function-like in some lanes but not in others
+        LaneMask same_end = 0;
+        for (const auto &expansion : expansions) {
+            if (expansion.p_end == expansions[0].p_end && expansion.end_lineno == expansions[0].end_lineno) {
+                same_end |= expansion.lanes;
+            }
+        }
+        if (same_end != active) { throw LaneDivergence{{}, same_end}; }
+        check_lines_consumed(active, start);
+        flush_lane_segment(result);
+        for (const auto &expansion : expansions) {
+            lane_segments.push_back({expansion.lanes, result.parsed_result.size(), expansion.output.size(), false});
+            result.parsed_result += expansion.output;
+        }
+        lane_segment_begin = result.parsed_result.size();
+    }
+    // arguments of a function-like macro may go over lines where lanes in inactive branch see directives
+    void check_lines_consumed(LaneMask active, const InputState &start) const {
+        if ((files.top().lanes & ~active) == 0 || inputs.top().get_lineno() == start.get_lineno()) { return; }
+        auto line_start = false;
+        for (auto p = start.get_p_curr(); p != inputs.top().get_p_curr(); ++p) {
+            if (*p == '\n') {
+                line_start = true;
+            } else if (*p == '#' && line_start) {
+                throw LaneDivergence{{}, active};
+            } else if (*p != ' ' && *p != '\t') {
+                line_start = false;
+            }
+        }
+    }
+    void expand_in_lanes(
+        std::string_view name, LaneMask lanes, const InputState &start, size_t depth,
+        std::vector<LaneExpansion> &expansions
+    ) {
+        restore_input(start, depth);
+        curr_lanes = lanes;
+        std::string output{};
+        try {
+            append_identifier(output, name);
+        } catch (const LaneDivergence &e) {
+            const auto groups = e.macro.empty() ? std::vector<LaneMask>{} : group_lanes_by_macro(e.macro, lanes);
+            if (groups.size() < 2) { throw; }
+            for (auto group : groups) { expand_in_lanes(name, group, start, depth, expansions); }
+            return;
+        }
+        expansions.push_back({lanes, std::move(output), inputs.top().get_p_curr(), inputs.top().get_lineno()});
+    }
+
+    // drops inputs pushed by an interrupted macro replacement
+    void restore_input(const InputState &start, size_t depth) {
+        while (inputs.size() > depth) { inputs.pop(); }
+        inputs.top() = start;
+    }
+
+    // output since last flush belongs to active lanes,
+    // other lanes in the file are in inactive branch and only get new lines of the source lines
+    void flush_lane_segment(const Result &result) {
+        const auto active = lane_ifs.back().active;
+        const auto inactive = files.top().lanes & ~active;
+        const auto end = result.parsed_result.size();
+        const auto lineno = inputs.top().get_lineno();
+        if (active != 0 && end > lane_segment_begin) {
+            lane_segments.push_back({active, lane_segment_begin, end - lane_segment_begin, false});
+        }
+        if (inactive != 0 && lineno > lane_segment_lineno) {
+            lane_segments.push_back({inactive, 0, lineno - lane_segment_lineno, true});
+        }
+        lane_segment_begin = end;
+        lane_segment_lineno = lineno;
+    }
+
+    // skip header that has '#pragma once' or whose include guard macro is still defined
+    bool should_skip_header(FileId file) {
+        if (lane_mode) { return should_skip_header_in_lanes(file); }
+        if (is_pragma_once(file)) { return true; }
+        auto guard = include_guard_of(file);
+        return !guard.empty() && is_macro_defined(guard);
+    }
+
+    bool should_skip_header_in_lanes(FileId file) {
+        auto skipped = lane_pragma_once_files[file] & curr_lanes;
+        if (const auto guarded = lane_guarded_files[file] & curr_lanes & ~skipped; guarded != 0) {
+            skipped |= lanes_defining(include_guards[file], guarded);
+        }
+        if (skipped == curr_lanes) { return true; }
+        if (skipped != 0) {
+            // only lanes not skipping it enter the header
+            push_lane_if({curr_lanes, curr_lanes & ~skipped, curr_lanes & ~skipped});
+        }
+        return false;
+    }
+
+    // returns id of normalized header path or 'kInvalidFileId' if header is not found,
+    // for header resolved before, includer is not called and 'include_result' is left empty
+    FileId require_header(
+        std::string_view header_name, ShaderIncluder::HeaderForm form, ShaderIncluder::Result &include_result
+    ) {
+        const auto including_file = files.top().presumed_file;
+        const auto header_file = resolve_header(including_file, header_name, form, include_result);
+        note_include_read({form, including_file, std::string{header_name}, header_file, 0});
+        return header_file;
+    }
+    // same as 'require_header()' but the lookup is not noted
+    FileId resolve_header(
+        FileId including_file, std::string_view header_name, ShaderIncluder::HeaderForm form,
+        ShaderIncluder::Result &include_result
+    ) {
+        resolution_key.clear();
+        resolution_key += form == ShaderIncluder::HeaderForm::eQuoted ? '"' : '<';
+        resolution_key.append(reinterpret_cast<const char *>(&including_file), sizeof(including_file));
+        resolution_key += header_name;
+        if (auto it = include_resolutions.find(resolution_key); it != include_resolutions.end()) {
+            return it->second;
+        }
+        auto header_file = kInvalidFileId;
+        if (includer->require_header(header_name, paths.path_of(including_file), form, include_result)) {
+            header_file = intern_file(include_result.header_path);
+        }
+        include_resolutions.insert({resolution_key, header_file});
+        return header_file;
+    }
+
+    // headers named by '#include' lines of a file just entered are handed to includer to be loaded ahead,
+    // names formed by macros and headers resolved before are skipped, directives are found in lexed form if any
+    void prefetch_includes(const FileState &file_state) {
+        const auto content = file_state.content;
+        const auto file_path = paths.path_of(file_state.presumed_file);
+        auto prefetch = [&](std::string_view header_name, ShaderIncluder::HeaderForm form) {
+            resolution_key.clear();
+            resolution_key += form == ShaderIncluder::HeaderForm::eQuoted ? '"' : '<';
+            resolution_key.append(
+                reinterpret_cast<const char *>(&file_state.presumed_file), sizeof(file_state.presumed_file)
+            );
+            resolution_key += header_name;
+            if (include_resolutions.contains(resolution_key)) { return; }
+            includer->prefetch_header(header_name, file_path, form);
+        };
+        // 'pos' is right after 'include'
+        auto prefetch_at = [&](size_t pos) {
+            while (pos < content.size() && (content[pos] == ' ' || content[pos] == '\t')) { ++pos; }
+            if (pos >= content.size() || (content[pos] != '"' && content[pos] != '<')) { return; }
+            const auto end = content.find_first_of(content[pos] == '"' ? "\"\n" : ">\n", pos + 1);
+            if (end == std::string_view::npos || content[end] == '\n') { return; }
+            prefetch(
+                content.substr(pos + 1, end - pos - 1),
+                content[pos] == '"' ? ShaderIncluder::HeaderForm::eQuoted : ShaderIncluder::HeaderForm::eAngled
+            );
+        };
+
+        if (const auto lexed = file_state.lexed.get()) {
+            for (auto directive : lexed->directives) {
+                const auto name = directive + 1;
+                if (
+                    name < lexed->num_tokens() && static_cast<TokenType>(lexed->types[name]) == TokenType::eIdentifier
+                    && (lexed->gap_flags[name] & LexedSource::eGapNewLine) == 0
+                    && content.substr(lexed->offsets[name], lexed->lengths[name]) == "include"
+                ) {
+                    prefetch_at(lexed->offsets[name] + lexed->lengths[name]);
+                }
+            }
+            return;
+        }
+        // a line-based look without lexing, names in comments or broken lines may be taken or missed,
+        // which only costs a useless load or a load that is not ahead
+        for (size_t pos = 0; pos < content.size();) {
+            while (pos < content.size() && (content[pos] == ' ' || content[pos] == '\t')) { ++pos; }
+            if (pos < content.size() && content[pos] == '#') {
+                ++pos;
+                while (pos < content.size() && (content[pos] == ' ' || content[pos] == '\t')) { ++pos; }
+                if (content.substr(pos).starts_with("include")) { prefetch_at(pos + 7); }
+            }
+            pos = content.find('\n', pos);
+            if (pos != std::string_view::npos) { ++pos; }
+        }
+    }
+
+    // header content is loaded from includer once until includer is cleared
+    const LoadedHeader &load_header(
+        FileId file, std::string_view header_name, ShaderIncluder::HeaderForm form,
+        ShaderIncluder::Result &include_result
+    ) {
+        auto &header = load_header_content(file, curr_path(), header_name, form, include_result);
+        if (!header.lexed) {
+            header.lexed = scan_only
+                ? get_minimized_source(header.content, header.content_hash, true)
+                : get_lexed_source(header.content, header.content_hash, lex_eagerly, true);
+        }
+        return header;
+    }
+    LoadedHeader &load_header_content(
+        FileId file, std::string_view including_path, std::string_view header_name, ShaderIncluder::HeaderForm form,
+        ShaderIncluder::Result &include_result
+    ) {
+        auto &header = loaded_headers[file];
+        if (header.content_hash == 0) {
+            if (include_result.header_path.empty()) {
+                // resolved before, so the includer hasn't been called yet
+                includer->require_header(header_name, including_path, form, include_result);
+            }
+            header.content = include_result.header_content;
+            header.content_hash = include_result.content_hash != 0
+                ? include_result.content_hash : hash_content(include_result.header_content);
+        }
+        return header;
+    }
+
+    // in inactive branch, jump to the next conditional directive of the same level using lexed form of the file,
+    // skipped lines only produce new lines
+    void skip_inactive_lines(Result &result) {
+        using DirectiveKind = LexedSource::DirectiveKind;
+        auto &input = inputs.top();
+        const auto lexed = input.get_lexed();
+        if (!lexed) { return; }
+        const auto offset = static_cast<size_t>(input.get_p_curr() - input.get_p_begin());
+        const auto index = input.get_lexed_index();
+        if (index >= lexed->num_tokens() || lexed->gap_start(index) != offset) { return; }
+
+        const auto num_directives = lexed->directives.size();
+        auto directive = static_cast<size_t>(
+            std::lower_bound(lexed->directives.begin(), lexed->directives.end(), index) - lexed->directives.begin()
+        );
+        while (directive < num_directives) {
+            const auto kind = lexed->directive_kinds[directive];
+            if (kind == DirectiveKind::eOther) {
+                ++directive;
+            } else if (kind == DirectiveKind::eIf && lexed->directive_ends[directive] != num_directives) {
+                directive = lexed->directive_ends[directive] + 1;
+            } else {
+                break;
+            }
+        }
+        const auto target = directive < num_directives ? lexed->directives[directive] : lexed->num_tokens() - 1;
+        if (target <= index) { return; }
+
+        const auto num_lines = lexed->lines_before(target) - lexed->lines_before(index);
+        result.parsed_result.append(num_lines, '\n');
+        input.set_lineno(input.get_lineno() + num_lines);
+        input.set_line_start(false);
+        input.set_p_curr(input.get_p_begin() + lexed->gap_start(target), target);
+    }
+
+    FileId intern_file(std::string_view path) {
+        auto file = paths.intern_normalized(path);
+        if (file >= pragma_once_files.size()) {
+            pragma_once_files.resize(paths.size(), false);
+            include_guards.resize(paths.size());
+            lane_pragma_once_files.resize(paths.size(), 0);
+            lane_guarded_files.resize(paths.size(), 0);
+            touched_file_flags.resize(paths.size(), false);
+        }
+        if (file >= entered_files.size()) {
+            entered_files.resize(paths.size(), false);
+        }
+        if (file >= loaded_headers.size()) {
+            loaded_headers.resize(paths.size());
+        }
+        return file;
+    }
+
+    std::string_view curr_path() const {
+        return paths.path_of(files.top().presumed_file);
+    }
+
+    // called after directive name is parsed, '#ifndef' is handled when its macro name is parsed
+    void update_include_guard_before(std::string_view directive) {
+        auto &guard = files.top().guard;
+        if (guard.state == IncludeGuard::State::eInGuard) {
+            if (if_stack.size() == guard.if_depth) {
+                if (directive == "endif") {
+                    guard.state = IncludeGuard::State::eAfterGuard;
+                } else if (directive.starts_with("el")) {
+                    guard.state = IncludeGuard::State::eNotGuarded;
+                }
+            }
+        } else if (guard.state != IncludeGuard::State::eStart || directive != "ifndef") {
+            guard.state = IncludeGuard::State::eNotGuarded;
+        }
+    }
+
+    // conditional directives going out of the header change state of including file, header can't be replayed
+    void update_recordings_before(std::string_view directive) {
+        if (directive != "else" && directive != "endif" && !directive.starts_with("elif")) { return; }
+        for (auto &recording : recordings) {
+            if (if_stack.size() <= recording.if_depth) { recording.valid = false; }
+        }
+    }
+
+    void invalidate_recordings() {
+        for (auto &recording : recordings) { recording.valid = false; }
+    }
+
+    // macros and file flags are accessed through these functions,
+    // so that headers being recorded know the states they depend on and the states they change,
+    // a run depends on a macro a directive tests or options or environment may set,
+    // other names read in code are the same in every run
+    const Define *find_macro(std::string_view name, bool tested = false) {
+        const Define *def = nullptr;
+        if (!lane_mode) {
+            def = lookup_macro(name);
+        } else if (auto it = lane_defines.find(name); it != lane_defines.end()) {
+            def = it->second[std::countr_zero(curr_lanes)];
+            for_each_lane(curr_lanes, [&](size_t lane) {
+                if (!same_define(def, it->second[lane])) { throw LaneDivergence{std::string{name}}; }
+            });
+        } else if (auto it = defines.find(name); it != defines.end()) {
+            def = &it->second;
+        }
+        if (tested || may_be_set_outside(name)) { note_macro_read(name, curr_lanes, def); }
+        for (auto &recording : recordings) {
+            if (auto it = recording.macros.find(name); it == recording.macros.end()) {
+                recording.macros.emplace(
+                    std::string{name},
+                    HeaderRecording::MacroAccess{.read = true, .tested = tested, .before = MacroSnapshot::from(def)}
+                );
+            } else if (it->second.read && !it->second.written) {
+                it->second.tested |= tested;
+            }
+        }
+        return def;
+    }
+    bool is_macro_defined(std::string_view name) {
+        return find_macro(name, true) != nullptr;
+    }
+    bool may_be_set_outside(std::string_view name) const {
+        return option_macro_names.contains(name) || (environment && environment->names(name));
+    }
+    // macros changed by options or source are in 'defines', others come from the environment
+    const Define *lookup_macro(std::string_view name) const {
+        if (auto it = defines.find(name); it != defines.end()) { return &it->second; }
+        if (!environment || undefined_environment_macros.contains(name)) { return nullptr; }
+        return environment->find(name, environment_defines);
+    }
+    void hide_environment_macro(std::string_view name) {
+        if (environment && environment->find(name, environment_defines)) { undefined_environment_macros.insert(name); }
+    }
+    void define_macro(std::string_view name, Define &&macro) {
+        if (lane_mode) {
+            define_lane_macro(name, std::move(macro));
+            return;
+        }
+        // existing macro is not redefined
+        if (find_macro(name)) { return; }
+        note_macro_written(name, curr_lanes);
+        defines.insert({name, std::move(macro)});
+    }
+    void undef_macro(std::string_view name) {
+        if (lane_mode) {
+            undef_lane_macro(name);
+            return;
+        }
+        note_macro_written(name, curr_lanes);
+        defines.erase(name);
+        hide_environment_macro(name);
     }
+    // 'name' and 'snapshot' must outlive current run
+    void set_macro(std::string_view name, const MacroSnapshot &snapshot) {
+        note_macro_written(name, curr_lanes);
+        defines.erase(name);
+        if (snapshot.defined) {
+            defines.insert({name, snapshot.to_define()});
+        } else {
+            hide_environment_macro(name);
+        }
+    }
+    void note_macro_read(std::string_view name, LaneMask lanes, const Define *def) {
+        auto it = first_macro_accesses.find(name);
+        if (it == first_macro_accesses.end()) {
+            it = first_macro_accesses.emplace(std::string{name}, FirstMacroAccess{
+                .defined = def != nullptr,
+                .value = def ? def->replace : std::string_view{},
+            }).first;
+        }
+        it->second.read_lanes |= lanes & ~it->second.written_lanes;
+    }
+    void note_macro_written(std::string_view name, LaneMask lanes) {
+        auto it = first_macro_accesses.find(name);
+        if (it == first_macro_accesses.end()) {
+            it = first_macro_accesses.emplace(std::string{name}, FirstMacroAccess{}).first;
+        }
+        it->second.written_lanes |= lanes & ~it->second.read_lanes;
+        for (auto &recording : recordings) {
+            auto it = recording.macros.find(name);
+            if (it == recording.macros.end()) {
+                it = recording.macros.emplace(std::string{name}, HeaderRecording::MacroAccess{}).first;
+            }
+            it->second.written = true;
+        }
+    }
+
+    // macros in lane mode, a macro defined or undefined in only some lanes moves to 'lane_defines'
+    LaneMask lanes_defining(std::string_view name, LaneMask lanes, bool tested = true) {
+        LaneMask defined = 0;
+        const Define *def = nullptr;
+        if (auto it = lane_defines.find(name); it != lane_defines.end()) {
+            for_each_lane(lanes, [&](size_t lane) {
+                if (it->second[lane]) { defined |= LaneMask{1} << lane; }
+            });
+        } else if (auto it = defines.find(name); it != defines.end()) {
+            defined = lanes;
+            def = &it->second;
+        }
+        if (tested || may_be_set_outside(name)) { note_macro_read(name, lanes, def); }
+        return defined;
+    }
+    // splits lanes into groups that agree on the state of the macro
+    std::vector<LaneMask> group_lanes_by_macro(std::string_view name, LaneMask lanes) const {
+        std::vector<LaneMask> groups{};
+        auto it = lane_defines.find(name);
+        if (it == lane_defines.end()) { return {lanes}; }
+        while (lanes != 0) {
+            const auto *def = it->second[std::countr_zero(lanes)];
+            LaneMask group = 0;
+            for_each_lane(lanes, [&](size_t lane) {
+                if (same_define(def, it->second[lane])) { group |= LaneMask{1} << lane; }
+            });
+            groups.push_back(group);
+            lanes &= ~group;
+        }
+        return groups;
+    }
+    void define_lane_macro(std::string_view name, Define &&macro) {
+        // existing macro is not redefined
+        const auto lanes = curr_lanes & ~lanes_defining(name, curr_lanes, false);
+        if (lanes == 0) { return; }
+        note_macro_written(name, lanes);
+        if (lanes == all_lanes) {
+            lane_defines.erase(name);
+            defines.insert({name, std::move(macro)});
+            return;
+        }
+        const auto *def = &lane_define_storage.emplace_back(std::move(macro));
+        auto &states = split_lane_macro(name);
+        for_each_lane(lanes, [&](size_t lane) { states[lane] = def; });
+    }
+    void undef_lane_macro(std::string_view name) {
+        note_macro_written(name, curr_lanes);
+        if (curr_lanes == all_lanes) {
+            lane_defines.erase(name);
+            defines.erase(name);
+            return;
+        }
+        if (!lane_defines.contains(name) && !defines.contains(name)) { return; }
+        auto &states = split_lane_macro(name);
+        for_each_lane(curr_lanes, [&](size_t lane) { states[lane] = nullptr; });
+    }
+    std::vector<const Define *> &split_lane_macro(std::string_view name) {
+        if (auto it = lane_defines.find(name); it != lane_defines.end()) { return it->second; }
+        const Define *def = nullptr;
+        if (auto it = defines.find(name); it != defines.end()) {
+            name = it->first;
+            def = &lane_define_storage.emplace_back(std::move(it->second));
+            defines.erase(it);
+        }
+        return lane_defines.emplace(name, std::vector<const Define *>(lane_options.size(), def)).first->second;
+    }
+
+    bool is_pragma_once(FileId file) {
+        note_file_read(file);
+        return pragma_once_files[file];
+    }
+    std::string_view include_guard_of(FileId file) {
+        note_file_read(file);
+        return include_guards[file];
+    }
+    void set_pragma_once(FileId file) {
+        note_file_written(file);
+        touch_file(file);
+        if (lane_mode) {
+            lane_pragma_once_files[file] |= curr_lanes;
+        } else {
+            pragma_once_files[file] = true;
+        }
+    }
+    // 'macro' must outlive current run, 'lanes' are the lanes that entered the file
+    void set_include_guard(FileId file, std::string_view macro, LaneMask lanes) {
+        note_file_written(file);
+        touch_file(file);
+        include_guards[file] = macro;
+        if (lane_mode) { lane_guarded_files[file] |= lanes; }
+    }
+    void note_file_read(FileId file) {
+        for (auto &recording : recordings) {
+            auto [it, inserted] = recording.files.try_emplace(file);
+            if (inserted) {
+                it->second.read = true;
+                it->second.pragma_once = pragma_once_files[file];
+                it->second.guard = include_guards[file];
+            }
+        }
+    }
+    void touch_file(FileId file) {
+        if (!touched_file_flags[file]) {
+            touched_file_flags[file] = true;
+            touched_files.push_back(file);
+        }
+    }
+    void note_file_written(FileId file) {
+        for (auto &recording : recordings) {
+            recording.files[file].written = true;
+        }
+    }
+
+    void note_include_read(HeaderReplay::IncludeRead &&read) {
+        note_run_include(read);
+        if (recordings.empty()) { return; }
+        for (size_t i = 0; i + 1 < recordings.size(); i++) {
+            recordings[i].include_reads.push_back(read);
+        }
+        recordings.back().include_reads.push_back(std::move(read));
+    }
+    // each distinct lookup is reported once in 'Result::includes'
+    void note_run_include(const HeaderReplay::IncludeRead &read) {
+        include_key.clear();
+        include_key += read.form == ShaderIncluder::HeaderForm::eQuoted ? '"' : '<';
+        include_key.append(reinterpret_cast<const char *>(&read.including_file), sizeof(read.including_file));
+        include_key += read.header_name;
+        auto [it, inserted] = run_include_indices.try_emplace(include_key, run_includes.size());
+        if (inserted) {
+            run_includes.push_back({read, curr_lanes});
+        } else {
+            run_includes[it->second].lanes |= curr_lanes;
+        }
+    }
+    void collect_includes(Result &result, size_t lane = 0) {
+        for (const auto &[read, lanes] : run_includes) {
+            if ((lanes >> lane & 1) == 0) { continue; }
+            result.includes.push_back({
+                read.header_name,
+                read.form,
+                std::string{paths.path_of(read.including_file)},
+                read.header_file == kInvalidFileId ? std::string{} : std::string{paths.path_of(read.header_file)},
+            });
+        }
+        // lanes may make lookups in different orders, so they are sorted
+        std::sort(
+            result.includes.begin(), result.includes.end(),
+            [](const IncludeDependency &a, const IncludeDependency &b) {
+                return std::tie(a.including_path, a.header_name, a.form) < std::tie(b.including_path, b.header_name, b.form);
+            }
+        );
+    }
+    // called after 'require_header()' when the header is going to be entered or replayed
+    void note_header_entered(uint64_t content_hash) {
+        for (auto &recording : recordings) {
+            recording.include_reads.back().content_hash = content_hash;
+        }
+    }
+
+    void finish_recording(Result &result) {
+        auto recording = std::move(recordings.back());
+        recordings.pop_back();
+        if (!recording.valid || if_stack.size() != recording.if_depth) {
+            return;
+        }
+
+        auto replay = std::make_shared<HeaderReplay>();
+        replay->content_hash = recording.content_hash;
+        for (auto &[name, access] : recording.macros) {
+            if (access.read) {
+                replay->macro_reads.push_back({name, std::move(access.before), access.tested});
+            }
+            if (access.written) {
+                replay->macro_writes.emplace_back(name, MacroSnapshot::from(lookup_macro(name)));
+            }
+        }
+        for (auto &[file, access] : recording.files) {
+            if (access.read) {
+                replay->file_reads.push_back({file, access.pragma_once, std::move(access.guard)});
+            }
+            if (access.written) {
+                replay->file_writes.push_back({file, pragma_once_files[file], std::string{include_guards[file]}});
+            }
+        }
+        replay->include_reads = std::move(recording.include_reads);
+        replay->output = result.parsed_result.substr(recording.output_start);
+        (scan_only ? scan_header_replays : header_replays).insert(recording.file, std::move(replay));
+    }
+
+    // returns a replay of the header whose recorded inputs match current states
+    std::shared_ptr<const HeaderReplay> find_header_replay(FileId file, uint64_t content_hash) {
+        auto replays = (scan_only ? scan_header_replays : header_replays).find(file);
+        if (!replays) { return nullptr; }
+        for (const auto &replay : *replays) {
+            if (replay->content_hash == content_hash && replay_inputs_match(*replay)) {
+                return replay;
+            }
+        }
+        return nullptr;
+    }
+
+    // inputs are compared without being noted, a replay that doesn't match is not read by the run
+    bool replay_inputs_match(const HeaderReplay &replay) {
+        for (const auto &read : replay.macro_reads) {
+            if (!read.before.same_as(lookup_macro(read.name))) { return false; }
+        }
+        for (const auto &flags : replay.file_reads) {
+            if (pragma_once_files[flags.file] != flags.pragma_once || include_guards[flags.file] != flags.guard) {
+                return false;
+            }
+        }
+        // nested headers are resolved and loaded as '#include' does, so they are not loaded again if entered
+        for (const auto &read : replay.include_reads) {
+            ShaderIncluder::Result include_result{};
+            const auto header_file = resolve_header(read.including_file, read.header_name, read.form, include_result);
+            if (header_file != read.header_file) { return false; }
+            if (read.content_hash != 0) {
+                const auto &header = load_header_content(
+                    header_file, paths.path_of(read.including_file), read.header_name, read.form, include_result
+                );
+                if (header.content_hash != read.content_hash) { return false; }
+            }
+        }
+        return true;
+    }
+
+    void apply_header_replay(Result &result, std::shared_ptr<const HeaderReplay> replay, size_t included_lineno) {
+        // inputs of the replay are read before it changes anything
+        for (const auto &read : replay->macro_reads) { find_macro(read.name, read.tested); }
+        for (const auto &flags : replay->file_reads) { note_file_read(flags.file); }
+        if (!scan_only) { result.parsed_result += replay->output; }
+        result.parsed_result += concat("\n#line ", included_lineno + 1, " \"", curr_path(), "\"");
+        for (const auto &[name, snapshot] : replay->macro_writes) {
+            set_macro(name, snapshot);
+        }
+        for (const auto &flags : replay->file_writes) {
+            note_file_written(flags.file);
+            touch_file(flags.file);
+            pragma_once_files[flags.file] = flags.pragma_once;
+            include_guards[flags.file] = flags.guard;
+        }
+        for (auto &recording : recordings) {
+            recording.include_reads.insert(
+                recording.include_reads.end(), replay->include_reads.begin(), replay->include_reads.end()
+            );
+        }
+        for (const auto &read : replay->include_reads) { note_run_include(read); }
+        // macros and include guards reference strings of the replay
+        replays_in_use.push_back(std::move(replay));
+    }
+
     std::string parse_header_name(std::string &spaces, InputState &input, Token token, bool &del_is_quot) {
         std::string_view header_name{};
         std::string macro_replaced{};
@@ -567,13 +1883,13 @@ struct Preprocessor::Impl final {
         InputState *header_input = &input;
         del_is_quot = true;
         if (token.type == TokenType::eIdentifier) {
-            if (auto it = defines.find(token.value); it != defines.end()) {
-                macro_replaced = replace_macro(token.value, it->second);
+            if (auto def = find_macro(token.value)) {
+                macro_replaced = replace_macro(token.value, *def);
                 macro_input = InputState{macro_replaced};
                 header_input = &macro_input;
             } else {
                 throw Preprocessorror{concat(
-                    "at file '", files.top().path, "' line ", input.get_lineno(),
+                    "at file '", curr_path(), "' line ", input.get_lineno(),
                     ", expected a header file name\n"
                 )};
             }
@@ -592,7 +1908,7 @@ struct Preprocessor::Impl final {
                     break;
                 } else if (is_eof(ch) || ch == '\n') {
                     throw Preprocessorror{concat(
-                        "at file '", files.top().path, "' line ", input.get_lineno(),
+                        "at file '", curr_path(), "' line ", input.get_lineno(),
                         ", expected a header file name\n"
                     )};
                 }
@@ -600,7 +1916,7 @@ struct Preprocessor::Impl final {
             }
         } else {
             throw Preprocessorror{concat(
-                "at file '", files.top().path, "' line ", input.get_lineno(),
+                "at file '", curr_path(), "' line ", input.get_lineno(),
                 ", expected a header file name\n"
             )};
         }
@@ -609,7 +1925,9 @@ struct Preprocessor::Impl final {
 
     bool evaluate() {
         std::string replaced{};
-        auto err_loc = concat("at file '", files.top().path, "' line ", inputs.top().get_lineno());
+        auto err_loc = concat("at file '", curr_path(), "' line ", inputs.top().get_lineno());
+        // a function-like macro looking for '(' may go over the line end, names there are not tested
+        const auto lineno = inputs.top().get_lineno();
 
         // replace macro and defined()
         while (true) {
@@ -622,13 +1940,11 @@ struct Preprocessor::Impl final {
                 )};
             }
             if (token.type == TokenType::eIdentifier) {
-                if (auto it = defines.find(token.value); it != defines.end()) {
-                    replaced += replace_macro(token.value, it->second);
-                } else if (token.value == "defined") {
+                if (token.value == "defined") {
                     token = get_token(inputs.top(), replaced, SpaceKeepType::eAll, false, false);
                     bool value;
                     if (token.type == TokenType::eIdentifier) {
-                        value = defines.contains(token.value);
+                        value = is_macro_defined(token.value);
                     } else {
                         if (token.type != TokenType::eLeftBracketRound) {
                             throw Preprocessorror{concat(
@@ -639,7 +1955,7 @@ struct Preprocessor::Impl final {
                         if (token.type != TokenType::eIdentifier) {
                             throw Preprocessorror{concat(err_loc, ", expected an identifier inside 'defined'")};
                         }
-                        value = defines.contains(token.value);
+                        value = is_macro_defined(token.value);
                         token = get_token(inputs.top(), replaced, SpaceKeepType::eAll, false, false);
                         if (token.type != TokenType::eRightBracketRound) {
                             throw Preprocessorror{concat(err_loc, ", expected a ')' after 'defined'")};
@@ -655,12 +1971,15 @@ struct Preprocessor::Impl final {
                     token = get_token(inputs.top(), replaced, SpaceKeepType::eAll, false, false);
                     auto header_name = parse_header_name(replaced, inputs.top(), token, del_is_quot);
                     ShaderIncluder::Result include_result{};
-                    auto has_include = includer->require_header(header_name, files.top().path, include_result);
+                    auto form = del_is_quot ? ShaderIncluder::HeaderForm::eQuoted : ShaderIncluder::HeaderForm::eAngled;
+                    auto has_include = require_header(header_name, form, include_result) != kInvalidFileId;
                     replaced += has_include ? "1" : "0";
                     token = get_token(inputs.top(), replaced, SpaceKeepType::eAll, false, false);
                     if (token.type != TokenType::eRightBracketRound) {
                         throw Preprocessorror{concat(err_loc, ", expected a ')' after '__has_include'")};
                     }
+                } else if (auto def = find_macro(token.value, inputs.top().get_lineno() == lineno)) {
+                    replaced += replace_macro(token.value, *def);
                 } else {
                     replaced += token.value;
                 }
@@ -710,7 +2029,7 @@ struct Preprocessor::Impl final {
         }
 
         if (depth == 1 && !is_param) {
-            curr_file = files.top().path;
+            curr_file = curr_path();
             curr_line = inputs.top().get_lineno();
         }
 
@@ -954,8 +2273,8 @@ struct Preprocessor::Impl final {
                 break;
             }
             if (token.type == TokenType::eIdentifier) {
-                if (auto it = defines.find(token.value); it != defines.end()) {
-                    result += replace_macro(token.value, it->second, false, depth + 1);
+                if (auto def = find_macro(token.value)) {
+                    result += replace_macro(token.value, *def, false, depth + 1);
                 } else {
                     result += token.value;
                 }
@@ -967,11 +2286,22 @@ struct Preprocessor::Impl final {
         return result + trailing_newlines;
     }
 
+    // in lane mode, errors and warnings are kept with lanes they belong to and are added to results at last
     void add_error(Result &result, std::string_view msg) {
+        if (lane_mode) {
+            lane_messages.push_back({curr_lanes, true, true, concat("error: ", msg, "\n")});
+            return;
+        }
+        invalidate_recordings();
         if (result.error.size() >= kMaxErrorSize) { return; }
         result.error += concat("error: ", msg, "\n");
     }
     void add_warning(Result &result, std::string_view msg) {
+        if (lane_mode) {
+            lane_messages.push_back({curr_lanes, false, true, concat("warning: ", msg, "\n")});
+            return;
+        }
+        invalidate_recordings();
         if (result.warning.size() >= kMaxErrorSize) { return; }
         result.warning += concat("warning: ", msg, "\n");
     }
@@ -998,8 +2328,69 @@ struct Preprocessor::Impl final {
     }
 
     std::unordered_map<std::string_view, Define> defines;
-    std::unordered_set<std::string> parsed_files;
-    std::unordered_set<std::string_view> pragma_once_files;
+    // macros not in 'defines' are looked up here unless they are undefined by options or source
+    std::shared_ptr<const MacroEnvironment::Layer> environment;
+    std::unordered_set<std::string_view> undefined_environment_macros;
+    // macros defined or undefined by options of current run or any option set of the batch
+    std::unordered_set<std::string_view> option_macro_names;
+    // macros of environment snapshot used in current run
+    mutable MacroEnvironment::Layer::DefineCache environment_defines;
+    // kept across runs, so that ids of the same path don't change, until there are too many of them
+    PathTable paths;
+    // indexed by file id
+    std::vector<bool> pragma_once_files;
+    // indexed by file id, macro of include guard or empty if file is not guarded
+    std::vector<std::string_view> include_guards;
+    // files whose states above or lane states below may be set in current run, and a flag for each file id
+    std::vector<FileId> touched_files;
+    std::vector<bool> touched_file_flags;
+    // (header form, including file, header name) -> header file, 'kInvalidFileId' if not found
+    std::unordered_map<std::string, FileId> include_resolutions;
+    std::string resolution_key;
+    // header lookups of current run, lanes are those that made the lookup
+    struct RunInclude final {
+        HeaderReplay::IncludeRead read;
+        LaneMask lanes;
+    };
+    std::vector<RunInclude> run_includes;
+    std::unordered_map<std::string, size_t> run_include_indices;
+    std::string include_key;
+    // indexed by file id, 'content_hash' is 0 if header is not loaded
+    std::vector<LoadedHeader> loaded_headers;
+    bool lex_eagerly = false;
+    // indexed by file id, kept across runs, whether the file has been entered by this preprocessor
+    std::vector<bool> entered_files;
+    // kept across runs
+    HeaderReplayCache header_replays;
+    // replays recorded by scans don't know macros used by active code, so they are only used by scans
+    HeaderReplayCache scan_header_replays;
+    // see 'do_scan()'
+    bool scan_only = false;
+    // headers being recorded, from outermost to innermost
+    std::vector<HeaderRecording> recordings;
+    std::vector<std::shared_ptr<const HeaderReplay>> replays_in_use;
+    std::unordered_map<std::string, FirstMacroAccess, StringHash, std::equal_to<>> first_macro_accesses;
+    // lane mode of a batch, see 'run_in_lanes()'
+    bool lane_mode = false;
+    LaneMask all_lanes = 1;
+    // lanes that current code is active for
+    LaneMask curr_lanes = 1;
+    // same size as 'if_stack' in lane mode
+    std::vector<LaneIf> lane_ifs;
+    // macros whose states differ among lanes, indexed by lane and nullptr if undefined in the lane,
+    // macros of the same state in all lanes are in 'defines'
+    std::unordered_map<std::string_view, std::vector<const Define *>> lane_defines;
+    std::deque<Define> lane_define_storage;
+    // macros defined by options of each lane
+    std::vector<std::unordered_map<std::string_view, Define>> lane_options;
+    // indexed by file id, lanes where the file has '#pragma once' or its include guard is recorded
+    std::vector<LaneMask> lane_pragma_once_files;
+    std::vector<LaneMask> lane_guarded_files;
+    // output of each lane is assembled from these segments of the shared output
+    std::vector<LaneSegment> lane_segments;
+    std::vector<LaneMessage> lane_messages;
+    size_t lane_segment_begin = 0;
+    size_t lane_segment_lineno = 0;
     std::stack<FileState> files;
     std::stack<InputState> inputs;
     std::queue<Token> cached_token{};
@@ -1039,4 +2430,55 @@ Preprocessor::Result Preprocessor::do_preprocess(
     return impl_->do_preprocess(input_path, input_content, includer, options, num_options);
 }
 
+Preprocessor::Result Preprocessor::do_preprocess(
+    std::string_view input_path,
+    std::string_view input_content,
+    ShaderIncluder &includer,
+    const MacroEnvironment &environment,
+    const std::string_view *options,
+    size_t num_options
+) {
+    return impl_->do_preprocess(input_path, input_content, includer, environment, options, num_options);
+}
+
+Preprocessor::Result Preprocessor::do_scan(
+    std::string_view input_path,
+    std::string_view input_content,
+    ShaderIncluder &includer,
+    const std::string_view *options,
+    size_t num_options
+) {
+    return impl_->do_scan(input_path, input_content, includer, {}, options, num_options);
+}
+
+Preprocessor::Result Preprocessor::do_scan(
+    std::string_view input_path,
+    std::string_view input_content,
+    ShaderIncluder &includer,
+    const MacroEnvironment &environment,
+    const std::string_view *options,
+    size_t num_options
+) {
+    return impl_->do_scan(input_path, input_content, includer, environment, options, num_options);
+}
+
+MacroEnvironment Preprocessor::do_preprocess_prelude(
+    std::string_view input_path,
+    std::string_view input_content,
+    ShaderIncluder &includer,
+    const MacroEnvironment &environment,
+    Result *result
+) {
+    return impl_->do_preprocess_prelude(input_path, input_content, includer, environment, result);
+}
+
+std::vector<Preprocessor::Result> Preprocessor::do_preprocess_batch(
+    std::string_view input_path,
+    std::string_view input_content,
+    ShaderIncluder &includer,
+    std::span<const OptionSet> option_sets
+) {
+    return impl_->do_preprocess_batch(input_path, input_content, includer, option_sets);
+}
+
 PEP_CPREP_NAMESPACE_END
@@ -0,0 +1,228 @@
+#include <cprep/embedded_includer.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <filesystem>
+#include <unordered_set>
+
+PEP_CPREP_NAMESPACE_BEGIN
+
+namespace {
+
+// deeper paths are not found, so lookups need no allocation
+constexpr size_t kMaxPathSegments = 64;
+
+// normalized path as segments, which are joined with '/'
+class PathSegments final {
+public:
+    // returns false if there are too many segments
+    bool append(std::string_view path) {
+        size_t start = 0;
+        if (!path.empty() && (path[0] == '/' || path[0] == '\\')) {
+            // absolute paths never match paths of the set, an empty first segment keeps them apart
+            if (num_segments_ == 0) { segments_[num_segments_++] = {}; }
+            start = 1;
+        }
+        while (start <= path.size()) {
+            auto end = std::min(path.find_first_of("/\\", start), path.size());
+            auto segment = path.substr(start, end - start);
+            start = end + 1;
+            if (segment.empty() || segment == ".") { continue; }
+            if (segment == ".." && num_segments_ > 0 && segments_[num_segments_ - 1] != "..") {
+                if (segments_[num_segments_ - 1].empty() && num_segments_ == 1) { continue; }
+                --num_segments_;
+                continue;
+            }
+            if (num_segments_ == kMaxPathSegments) { return false; }
+            segments_[num_segments_++] = segment;
+        }
+        return true;
+    }
+
+    void pop() { if (num_segments_ > 0) { --num_segments_; } }
+
+    // FNV-1a of the joined path, the same as 'hash_path()' of the joined path
+    uint64_t hash() const {
+        uint64_t hash = kFnvOffset;
+        for (size_t i = 0; i < num_segments_; i++) {
+            if (i > 0) { hash = (hash ^ '/') * kFnvPrime; }
+            for (auto ch : segments_[i]) { hash = (hash ^ static_cast<unsigned char>(ch)) * kFnvPrime; }
+        }
+        return hash;
+    }
+
+    bool equals(std::string_view path) const {
+        for (size_t i = 0; i < num_segments_; i++) {
+            if (i > 0) {
+                if (path.empty() || path[0] != '/') { return false; }
+                path.remove_prefix(1);
+            }
+            if (!path.starts_with(segments_[i])) { return false; }
+            path.remove_prefix(segments_[i].size());
+        }
+        return path.empty();
+    }
+
+    static uint64_t hash_path(std::string_view path) {
+        uint64_t hash = kFnvOffset;
+        for (auto ch : path) { hash = (hash ^ static_cast<unsigned char>(ch)) * kFnvPrime; }
+        return hash;
+    }
+
+private:
+    static constexpr uint64_t kFnvOffset = 0xcbf29ce484222325ull;
+    static constexpr uint64_t kFnvPrime = 0x100000001b3ull;
+
+    std::array<std::string_view, kMaxPathSegments> segments_;
+    size_t num_segments_ = 0;
+};
+
+// slot of a path in its bucket's displacement, it must not change or generated sources are broken
+size_t slot_of(uint64_t path_hash, uint32_t displacement, size_t num_headers) {
+    auto x = path_hash + (static_cast<uint64_t>(displacement) + 1) * 0x9e3779b97f4a7c15ull;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+    x ^= x >> 31;
+    return static_cast<size_t>(x % num_headers);
+}
+
+bool find_header(const EmbeddedHeaderSet &headers, const PathSegments &path, ShaderIncluder::Result &result) {
+    if (headers.num_headers == 0 || headers.num_buckets == 0) { return false; }
+    const auto hash = path.hash();
+    const auto displacement = headers.displacements[hash % headers.num_buckets];
+    const auto &header = headers.headers[slot_of(hash, displacement, headers.num_headers)];
+    if (!path.equals(header.path)) { return false; }
+    result.header_content = header.content;
+    result.header_path.assign(header.path);
+    result.content_hash = header.content_hash;
+    return true;
+}
+
+// string literal split at line ends, so that no line of generated source is too long
+std::string to_literal(std::string_view s) {
+    if (s.empty()) { return "\"\""; }
+    std::string literal{"\""};
+    for (size_t i = 0; i < s.size(); i++) {
+        auto ch = static_cast<unsigned char>(s[i]);
+        if (ch == '\n') {
+            literal += i + 1 < s.size() ? "\\n\"\n        \"" : "\\n";
+        } else if (ch == '\\' || ch == '"') {
+            literal += '\\';
+            literal += static_cast<char>(ch);
+        } else if (ch == '\t') {
+            literal += "\\t";
+        } else if (ch < 0x20 || ch >= 0x7f) {
+            // always 3 digits, so that a following digit is not taken into the escape
+            char escaped[8];
+            std::snprintf(escaped, sizeof(escaped), "\\%03o", ch);
+            literal += escaped;
+        } else {
+            literal += static_cast<char>(ch);
+        }
+    }
+    literal += '"';
+    return literal;
+}
+
+}
+
+std::string EmbeddedShaderIncluder::generate_source(
+    const std::vector<std::pair<std::string, std::string>> &headers, std::string_view symbol
+) {
+    std::vector<std::pair<std::string, const std::string *>> unique_headers{};
+    std::unordered_set<std::string> added_paths{};
+    for (const auto &[header_path, content] : headers) {
+        auto generic_path = header_path;
+        std::replace(generic_path.begin(), generic_path.end(), '\\', '/');
+        auto path = std::filesystem::path{generic_path}.lexically_normal().generic_string();
+        while (!path.empty() && path.back() == '/') { path.pop_back(); }
+        if (added_paths.insert(path).second) { unique_headers.emplace_back(std::move(path), &content); }
+    }
+
+    // hash and displace, buckets with more paths are placed first while there are more free slots
+    const auto num_headers = unique_headers.size();
+    const auto num_buckets = std::max<size_t>(num_headers, 1);
+    std::vector<std::vector<size_t>> buckets(num_buckets);
+    std::vector<uint64_t> hashes(num_headers);
+    for (size_t i = 0; i < num_headers; i++) {
+        hashes[i] = PathSegments::hash_path(unique_headers[i].first);
+        buckets[hashes[i] % num_buckets].push_back(i);
+    }
+    std::vector<size_t> bucket_order(num_buckets);
+    for (size_t i = 0; i < num_buckets; i++) { bucket_order[i] = i; }
+    std::stable_sort(bucket_order.begin(), bucket_order.end(), [&buckets](size_t a, size_t b) {
+        return buckets[a].size() > buckets[b].size();
+    });
+    std::vector<uint32_t> displacements(num_buckets, 0);
+    std::vector<size_t> slots(num_headers, num_headers);
+    std::vector<size_t> bucket_slots{};
+    for (auto bucket : bucket_order) {
+        if (buckets[bucket].empty()) { break; }
+        for (uint32_t displacement = 0;; displacement++) {
+            bucket_slots.clear();
+            for (auto header : buckets[bucket]) {
+                auto slot = slot_of(hashes[header], displacement, num_headers);
+                auto taken = slots[slot] != num_headers
+                    || std::find(bucket_slots.begin(), bucket_slots.end(), slot) != bucket_slots.end();
+                if (taken) { break; }
+                bucket_slots.push_back(slot);
+            }
+            if (bucket_slots.size() < buckets[bucket].size()) { continue; }
+            for (size_t i = 0; i < bucket_slots.size(); i++) { slots[bucket_slots[i]] = buckets[bucket][i]; }
+            displacements[bucket] = displacement;
+            break;
+        }
+    }
+
+    // 'a::b::name' is defined in namespace 'a::b'
+    auto name_start = symbol.rfind("::");
+    auto namespace_name = name_start == std::string_view::npos ? std::string_view{} : symbol.substr(0, name_start);
+    auto name = name_start == std::string_view::npos ? symbol : symbol.substr(name_start + 2);
+
+    std::string source{"// generated by pep-cprep-embed, don't edit\n\n#include <cprep/embedded_includer.hpp>\n\n"};
+    source += "namespace {\n\n";
+    source += "constexpr pep::cprep::EmbeddedHeader kHeaders[] = {\n";
+    for (size_t slot = 0; slot < num_headers; slot++) {
+        const auto &[path, content] = unique_headers[slots[slot]];
+        char hash[32];
+        std::snprintf(hash, sizeof(hash), "0x%016llxull", static_cast<unsigned long long>(hash_content(*content)));
+        source += "    {\n        std::string_view{" + to_literal(path) + ", " + std::to_string(path.size()) + "},\n";
+        source += "        std::string_view{" + to_literal(*content) + ", " + std::to_string(content->size()) + "},\n";
+        source += "        " + std::string{hash} + ",\n    },\n";
+    }
+    if (num_headers == 0) { source += "    {},\n"; }
+    source += "};\n\nconstexpr uint32_t kDisplacements[] = {\n";
+    for (auto displacement : displacements) { source += "    " + std::to_string(displacement) + ",\n"; }
+    source += "};\n\n}\n\n";
+    if (!namespace_name.empty()) { source += "namespace " + std::string{namespace_name} + " {\n\n"; }
+    source += "extern const pep::cprep::EmbeddedHeaderSet " + std::string{name} + ";\n";
+    source += "const pep::cprep::EmbeddedHeaderSet " + std::string{name} + "{\n";
+    source += "    kHeaders, " + std::to_string(num_headers) + ", kDisplacements, " + std::to_string(num_buckets) + ",\n";
+    source += "};\n";
+    if (!namespace_name.empty()) { source += "\n}\n"; }
+    return source;
+}
+
+bool EmbeddedShaderIncluder::require_header(
+    std::string_view header_name, std::string_view file_path, Result &result
+) {
+    return require_header(header_name, file_path, HeaderForm::eQuoted, result);
+}
+
+bool EmbeddedShaderIncluder::require_header(
+    std::string_view header_name, std::string_view file_path, HeaderForm form, Result &result
+) {
+    if (form == HeaderForm::eQuoted) {
+        // beside the including file, which is found in the set only if it's a header of the set
+        PathSegments path{};
+        if (path.append(file_path)) {
+            path.pop();
+            if (path.append(header_name) && find_header(headers_, path, result)) { return true; }
+        }
+    }
+    PathSegments path{};
+    return path.append(header_name) && find_header(headers_, path, result);
+}
+
+PEP_CPREP_NAMESPACE_END
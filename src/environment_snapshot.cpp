@@ -0,0 +1,239 @@
+#include "environment_snapshot.hpp"
+
+#include <bit>
+#include <cstring>
+
+PEP_CPREP_NAMESPACE_BEGIN
+
+namespace {
+
+constexpr char kSnapshotMagic[8] = {'C', 'P', 'R', 'E', 'P', 'E', 'N', 'V'};
+constexpr uint32_t kSnapshotVersion = 1;
+// snapshot is in native byte order, a snapshot from a machine of different byte order is rejected
+constexpr uint32_t kByteOrderMark = 0x01020304;
+
+// layout: header, hash table, macros, parameters, files, strings
+struct SnapshotHeader final {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t num_macros;
+    // power of 2, each slot is 0 or index of a macro plus 1
+    uint32_t table_size;
+    uint32_t num_params;
+    uint32_t num_files;
+    uint32_t table_offset;
+    uint32_t macros_offset;
+    uint32_t params_offset;
+    uint32_t files_offset;
+    uint32_t strings_offset;
+    uint32_t total_size;
+};
+
+// offset is relative to the start of strings
+struct StringRef final {
+    uint32_t offset;
+    uint32_t size;
+};
+
+struct MacroRecord final {
+    uint64_t name_hash;
+    StringRef name;
+    StringRef replace;
+    StringRef file;
+    uint32_t first_param;
+    uint32_t num_params;
+    uint32_t lineno;
+    uint8_t function_like;
+    uint8_t has_va_params;
+    uint8_t padding[2];
+};
+
+struct FileRecord final {
+    StringRef path;
+    StringRef guard;
+    uint32_t pragma_once;
+};
+
+// blob may not be aligned, records are copied out of it
+template <typename T>
+T read_at(std::string_view data, size_t offset) {
+    T value;
+    std::memcpy(&value, data.data() + offset, sizeof(T));
+    return value;
+}
+
+template <typename T>
+void write_at(std::string &data, size_t offset, const T &value) {
+    std::memcpy(data.data() + offset, &value, sizeof(T));
+}
+
+size_t align_up(size_t offset) { return (offset + 7) & ~size_t{7}; }
+
+}
+
+std::shared_ptr<const EnvironmentSnapshot> EnvironmentSnapshot::open(
+    std::string_view data, std::shared_ptr<const void> owner
+) {
+    if (data.size() < sizeof(SnapshotHeader)) { return nullptr; }
+    const auto header = read_at<SnapshotHeader>(data, 0);
+    if (
+        std::memcmp(header.magic, kSnapshotMagic, sizeof(kSnapshotMagic)) != 0
+        || header.version != kSnapshotVersion || header.byte_order != kByteOrderMark
+        || header.total_size != data.size() || !std::has_single_bit(header.table_size)
+    ) {
+        return nullptr;
+    }
+    auto fits = [&data](size_t offset, size_t count, size_t record_size) {
+        return offset <= data.size() && count <= (data.size() - offset) / record_size;
+    };
+    if (
+        !fits(header.table_offset, header.table_size, sizeof(uint32_t))
+        || !fits(header.macros_offset, header.num_macros, sizeof(MacroRecord))
+        || !fits(header.params_offset, header.num_params, sizeof(StringRef))
+        || !fits(header.files_offset, header.num_files, sizeof(FileRecord))
+        || header.strings_offset > data.size()
+    ) {
+        return nullptr;
+    }
+
+    auto snapshot = std::make_shared<EnvironmentSnapshot>();
+    snapshot->data_ = data;
+    snapshot->owner_ = std::move(owner);
+    snapshot->num_macros_ = header.num_macros;
+    snapshot->table_size_ = header.table_size;
+    snapshot->table_offset_ = header.table_offset;
+    snapshot->macros_offset_ = header.macros_offset;
+    snapshot->num_params_ = header.num_params;
+    snapshot->params_offset_ = header.params_offset;
+    snapshot->strings_offset_ = header.strings_offset;
+    // only a few headers are recorded, they are decoded at once
+    bool valid = true;
+    snapshot->files_.reserve(header.num_files);
+    for (size_t i = 0; i < header.num_files; i++) {
+        const auto record = read_at<FileRecord>(data, header.files_offset + i * sizeof(FileRecord));
+        snapshot->files_.push_back({
+            std::string{snapshot->string_at(record.path.offset, record.path.size, valid)},
+            record.pragma_once != 0,
+            std::string{snapshot->string_at(record.guard.offset, record.guard.size, valid)},
+        });
+    }
+    return valid ? snapshot : nullptr;
+}
+
+std::string EnvironmentSnapshot::write(
+    const std::vector<std::pair<std::string_view, const Define *>> &macros,
+    const std::vector<EnvironmentFile> &files
+) {
+    std::string strings{};
+    auto add_string = [&strings](std::string_view s) {
+        StringRef ref{static_cast<uint32_t>(strings.size()), static_cast<uint32_t>(s.size())};
+        strings += s;
+        return ref;
+    };
+
+    const auto table_size = std::bit_ceil(std::max<size_t>(macros.size() * 2, 1));
+    std::vector<uint32_t> table(table_size, 0);
+    std::vector<MacroRecord> macro_records{};
+    std::vector<StringRef> params{};
+    macro_records.reserve(macros.size());
+    for (const auto &[name, def] : macros) {
+        MacroRecord record{};
+        record.name_hash = hash_content(name);
+        record.name = add_string(name);
+        record.replace = add_string(def->replace);
+        record.file = add_string(def->file);
+        record.first_param = static_cast<uint32_t>(params.size());
+        record.num_params = static_cast<uint32_t>(def->params.size());
+        record.lineno = static_cast<uint32_t>(def->lineno);
+        record.function_like = def->function_like;
+        record.has_va_params = def->has_va_params;
+        for (auto param : def->params) { params.push_back(add_string(param)); }
+
+        auto slot = record.name_hash & (table_size - 1);
+        while (table[slot] != 0) { slot = (slot + 1) & (table_size - 1); }
+        table[slot] = static_cast<uint32_t>(macro_records.size() + 1);
+        macro_records.push_back(record);
+    }
+    std::vector<FileRecord> file_records{};
+    for (const auto &file : files) {
+        file_records.push_back({add_string(file.path), add_string(file.guard), file.pragma_once});
+    }
+
+    SnapshotHeader header{};
+    std::memcpy(header.magic, kSnapshotMagic, sizeof(kSnapshotMagic));
+    header.version = kSnapshotVersion;
+    header.byte_order = kByteOrderMark;
+    header.num_macros = static_cast<uint32_t>(macro_records.size());
+    header.table_size = static_cast<uint32_t>(table_size);
+    header.num_params = static_cast<uint32_t>(params.size());
+    header.num_files = static_cast<uint32_t>(file_records.size());
+    header.table_offset = static_cast<uint32_t>(align_up(sizeof(SnapshotHeader)));
+    header.macros_offset = static_cast<uint32_t>(align_up(header.table_offset + table_size * sizeof(uint32_t)));
+    header.params_offset = static_cast<uint32_t>(header.macros_offset + macro_records.size() * sizeof(MacroRecord));
+    header.files_offset = static_cast<uint32_t>(header.params_offset + params.size() * sizeof(StringRef));
+    header.strings_offset = static_cast<uint32_t>(header.files_offset + file_records.size() * sizeof(FileRecord));
+    header.total_size = static_cast<uint32_t>(header.strings_offset + strings.size());
+
+    std::string data(header.total_size, '\0');
+    write_at(data, 0, header);
+    for (size_t i = 0; i < table.size(); i++) {
+        write_at(data, header.table_offset + i * sizeof(uint32_t), table[i]);
+    }
+    for (size_t i = 0; i < macro_records.size(); i++) {
+        write_at(data, header.macros_offset + i * sizeof(MacroRecord), macro_records[i]);
+    }
+    for (size_t i = 0; i < params.size(); i++) {
+        write_at(data, header.params_offset + i * sizeof(StringRef), params[i]);
+    }
+    for (size_t i = 0; i < file_records.size(); i++) {
+        write_at(data, header.files_offset + i * sizeof(FileRecord), file_records[i]);
+    }
+    std::memcpy(data.data() + header.strings_offset, strings.data(), strings.size());
+    return data;
+}
+
+size_t EnvironmentSnapshot::find(std::string_view name) const {
+    const auto hash = hash_content(name);
+    auto slot = hash & (table_size_ - 1);
+    for (size_t i = 0; i < table_size_; i++) {
+        const auto entry = read_at<uint32_t>(data_, table_offset_ + slot * sizeof(uint32_t));
+        if (entry == 0 || entry > num_macros_) { break; }
+        const auto record = read_at<MacroRecord>(data_, macros_offset_ + (entry - 1) * sizeof(MacroRecord));
+        if (record.name_hash == hash) {
+            bool valid = true;
+            if (string_at(record.name.offset, record.name.size, valid) == name && valid) { return entry - 1; }
+        }
+        slot = (slot + 1) & (table_size_ - 1);
+    }
+    return num_macros_;
+}
+
+bool EnvironmentSnapshot::decode(size_t index, std::string_view &name, Define &define) const {
+    const auto record = read_at<MacroRecord>(data_, macros_offset_ + index * sizeof(MacroRecord));
+    if (record.first_param > num_params_ || record.num_params > num_params_ - record.first_param) { return false; }
+    bool valid = true;
+    name = string_at(record.name.offset, record.name.size, valid);
+    define.replace = string_at(record.replace.offset, record.replace.size, valid);
+    define.file = string_at(record.file.offset, record.file.size, valid);
+    define.lineno = record.lineno;
+    define.function_like = record.function_like != 0;
+    define.has_va_params = record.has_va_params != 0;
+    define.params.clear();
+    for (size_t i = 0; i < record.num_params; i++) {
+        const auto param = read_at<StringRef>(data_, params_offset_ + (record.first_param + i) * sizeof(StringRef));
+        define.params.push_back(string_at(param.offset, param.size, valid));
+    }
+    return valid;
+}
+
+std::string_view EnvironmentSnapshot::string_at(uint32_t offset, uint32_t size, bool &valid) const {
+    const auto strings_size = data_.size() - strings_offset_;
+    if (offset > strings_size || size > strings_size - offset) {
+        valid = false;
+        return {};
+    }
+    return data_.substr(strings_offset_ + offset, size);
+}
+
+PEP_CPREP_NAMESPACE_END
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include <cprep/cprep.hpp>
+
+#include "macro.hpp"
+
+PEP_CPREP_NAMESPACE_BEGIN
+
+// header state of an environment, a header with 'pragma_once' or whose 'guard' is defined is not entered again
+struct EnvironmentFile final {
+    std::string path;
+    bool pragma_once = false;
+    std::string guard;
+};
+
+// environment serialized to a flat blob that is used in place,
+// a macro is found by hashing into a table in the blob, other macros are not decoded
+class EnvironmentSnapshot final {
+public:
+    // returns nullptr if 'data' is not a valid snapshot, 'owner' keeps 'data' alive
+    static std::shared_ptr<const EnvironmentSnapshot> open(std::string_view data, std::shared_ptr<const void> owner);
+
+    static std::string write(
+        const std::vector<std::pair<std::string_view, const Define *>> &macros,
+        const std::vector<EnvironmentFile> &files
+    );
+
+    size_t num_macros() const { return num_macros_; }
+    // returns index of the macro, or 'num_macros()' if it's not in the snapshot
+    size_t find(std::string_view name) const;
+    // 'name' and 'define' reference the blob, returns false if the macro is broken
+    bool decode(size_t index, std::string_view &name, Define &define) const;
+
+    const std::vector<EnvironmentFile> &files() const { return files_; }
+
+private:
+    std::string_view string_at(uint32_t offset, uint32_t size, bool &valid) const;
+
+    std::string_view data_;
+    std::shared_ptr<const void> owner_;
+    size_t num_macros_ = 0;
+    size_t table_size_ = 0;
+    size_t table_offset_ = 0;
+    size_t macros_offset_ = 0;
+    size_t num_params_ = 0;
+    size_t params_offset_ = 0;
+    size_t strings_offset_ = 0;
+    std::vector<EnvironmentFile> files_;
+};
+
+PEP_CPREP_NAMESPACE_END
@@ -0,0 +1,694 @@
+#include <cprep/fs_includer.hpp>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+
+#if defined(__linux__)
+#define CPREP_HAS_INOTIFY 1
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#else
+#define CPREP_HAS_INOTIFY 0
+#endif
+
+PEP_CPREP_NAMESPACE_BEGIN
+
+namespace fs = std::filesystem;
+
+namespace {
+
+std::string read_all_from_file(const fs::path &path) {
+    std::ifstream fin(path, std::ios::binary);
+    fin.seekg(0, std::ios::end);
+    auto length = fin.tellg();
+    if (length <= 0) { return {}; }
+    std::string content(length, '\0');
+    fin.seekg(0, std::ios::beg);
+    fin.read(content.data(), length);
+    while (!content.empty() && content.back() == '\0') { content.pop_back(); }
+    return content;
+}
+
+// stat and content of a file, read on the caller thread or a prefetch thread
+// coarsest mtime of common file systems
+constexpr auto kMtimeGranularity = std::chrono::seconds{2};
+
+struct LoadedFile final {
+    bool found = false;
+    std::string content;
+    uint64_t content_hash = 0;
+    fs::file_time_type mtime;
+    uintmax_t size = 0;
+    // file was changed right before it was read
+    bool racy = false;
+};
+
+LoadedFile load_file(const std::string &path) {
+    LoadedFile file{};
+    std::error_code ec;
+    file.mtime = fs::last_write_time(path, ec);
+    file.size = ec ? 0 : fs::file_size(path, ec);
+    if (ec) { return file; }
+    file.found = true;
+    file.content = read_all_from_file(path);
+    file.content_hash = hash_content(file.content);
+    // a change right after reading may not change mtime if it's coarse, nor size, so mtime is not trusted
+    file.racy = file.mtime + kMtimeGranularity >= fs::file_time_type::clock::now();
+    return file;
+}
+
+// loads requested files on background threads in the order of requests
+class FilePrefetcher final {
+public:
+    ~FilePrefetcher() {
+        {
+            std::lock_guard lock{mutex_};
+            stopping_ = true;
+        }
+        work_cv_.notify_all();
+        for (auto &thread : threads_) { thread.join(); }
+    }
+
+    void request(const std::string &path) {
+        std::lock_guard lock{mutex_};
+        if (tasks_.contains(path)) { return; }
+        auto task = std::make_shared<Task>();
+        task->path = path;
+        tasks_.insert({path, task});
+        queue_.push_back(std::move(task));
+        // threads are started at the first request, most includers never prefetch
+        if (threads_.empty()) {
+            for (size_t i = 0; i < kNumThreads; i++) { threads_.emplace_back([this]() { work(); }); }
+        }
+        work_cv_.notify_one();
+    }
+
+    // returns false if the file is not requested, a file not started yet is loaded on the caller thread
+    bool take(const std::string &path, LoadedFile &file) {
+        std::unique_lock lock{mutex_};
+        auto it = tasks_.find(path);
+        if (it == tasks_.end()) { return false; }
+        auto task = std::move(it->second);
+        tasks_.erase(it);
+        if (!task->started) {
+            task->taken = true;
+            lock.unlock();
+            file = load_file(path);
+            return true;
+        }
+        done_cv_.wait(lock, [&task]() { return task->done; });
+        file = std::move(task->file);
+        return true;
+    }
+
+    // files being loaded are finished and dropped
+    void cancel_all() {
+        std::lock_guard lock{mutex_};
+        for (auto &task : queue_) { task->taken = true; }
+        queue_.clear();
+        tasks_.clear();
+    }
+
+private:
+    // loads of a slow file system overlap with each other
+    static constexpr size_t kNumThreads = 4;
+
+    struct Task final {
+        std::string path;
+        LoadedFile file;
+        bool started = false;
+        bool done = false;
+        // taken or cancelled before it's started
+        bool taken = false;
+    };
+
+    void work() {
+        std::unique_lock lock{mutex_};
+        while (true) {
+            work_cv_.wait(lock, [this]() { return stopping_ || !queue_.empty(); });
+            if (stopping_) { return; }
+            auto task = std::move(queue_.front());
+            queue_.pop_front();
+            if (task->taken) { continue; }
+            task->started = true;
+            lock.unlock();
+            auto file = load_file(task->path);
+            lock.lock();
+            task->file = std::move(file);
+            task->done = true;
+            done_cv_.notify_all();
+        }
+    }
+
+    std::mutex mutex_;
+    std::condition_variable work_cv_;
+    std::condition_variable done_cv_;
+    std::deque<std::shared_ptr<Task>> queue_;
+    std::unordered_map<std::string, std::shared_ptr<Task>> tasks_;
+    std::vector<std::thread> threads_;
+    bool stopping_ = false;
+};
+
+// file names of a directory, subdirectories are not listed
+struct DirListing final {
+    std::unordered_set<std::string> entries{};
+    bool case_insensitive = false;
+    // entries with ASCII letters in lower case, only filled if the directory is case-insensitive
+    std::unordered_set<std::string> folded_entries{};
+    fs::file_time_type mtime{};
+    // directory was changed right before it was listed
+    bool racy = false;
+    // last epoch in which mtime of the directory was checked, only used by 'eRevalidate' and 'eDrop'
+    size_t validated_epoch = 0;
+};
+
+std::string fold_case(std::string name) {
+    for (auto &ch : name) {
+        if (ch >= 'A' && ch <= 'Z') { ch = static_cast<char>(ch - 'A' + 'a'); }
+    }
+    return name;
+}
+
+std::string swap_case(std::string name) {
+    for (auto &ch : name) {
+        if (ch >= 'A' && ch <= 'Z') {
+            ch = static_cast<char>(ch - 'A' + 'a');
+        } else if (ch >= 'a' && ch <= 'z') {
+            ch = static_cast<char>(ch - 'a' + 'A');
+        }
+    }
+    return name;
+}
+
+struct CachedHeader final {
+    std::string path;
+    std::string content;
+    uint64_t content_hash = 0;
+    fs::file_time_type mtime;
+    uintmax_t size = 0;
+    // content is compared when it's validated, since mtime was too recent when it was loaded
+    bool racy = false;
+    // last run in which this header was used, headers used by current run can't be evicted
+    size_t used_run = 0;
+    // last epoch in which mtime and size of this header were checked
+    size_t validated_epoch = 0;
+};
+
+}
+
+struct FsShaderIncluder::Impl final {
+    ~Impl() { stop_watching(); }
+
+    bool require_header(std::string_view header_name, std::string_view file_path, HeaderForm form, Result &result) {
+        poll_changes_once();
+        const auto &resolved = resolve(header_name, file_path, form);
+        if (resolved.empty()) {
+            return false;
+        }
+        auto header = load_header(resolved);
+        if (!header) {
+            return false;
+        }
+        result.header_path = header->path;
+        result.header_content = header->content;
+        result.content_hash = header->content_hash;
+        return true;
+    }
+
+    // only headers not cached yet are loaded ahead, cached ones just need a stat or nothing to be used again
+    void prefetch_header(std::string_view header_name, std::string_view file_path, HeaderForm form) {
+        poll_changes_once();
+        const auto &resolved = resolve(header_name, file_path, form);
+        if (resolved.empty() || headers.contains(resolved)) { return; }
+        if (clear_policy == ClearPolicy::eWatch) { watch_header(resolved); }
+        prefetcher.request(resolved);
+    }
+
+    // changes are polled before the first header of each run
+    void poll_changes_once() {
+        if (clear_policy == ClearPolicy::eWatch && polled_run != curr_run) {
+            poll_changes();
+            polled_run = curr_run;
+        }
+    }
+
+    void clear() {
+        // headers prefetched but not used may be changed before next run
+        prefetcher.cancel_all();
+        switch (clear_policy) {
+            case ClearPolicy::eDrop:
+                purge();
+                break;
+            case ClearPolicy::eRevalidate:
+                // listings are kept and validated by mtime of their directories
+                resolved.clear();
+                break;
+            case ClearPolicy::eKeep:
+            case ClearPolicy::eWatch:
+                break;
+        }
+        retired_headers.clear();
+        ++curr_run;
+        ++curr_epoch;
+    }
+
+    // headers changed since they were viewed by current run are retired rather than dropped
+    void revalidate() {
+        if (clear_policy != ClearPolicy::eRevalidate && clear_policy != ClearPolicy::eDrop) { return; }
+        prefetcher.cancel_all();
+        resolved.clear();
+        ++curr_epoch;
+    }
+
+    void purge() {
+        resolved.clear();
+        dir_index.clear();
+        headers.clear();
+        headers_lru.clear();
+        cached_bytes = 0;
+        prefetcher.cancel_all();
+        // watches are added again for what is cached later
+        stop_watching();
+    }
+
+    // resolved path of (including directory, header name, form), empty path means header is not found
+    const std::string &resolve(std::string_view header_name, std::string_view file_path, HeaderForm form) {
+        auto including_dir = fs::path{file_path}.parent_path().string();
+        consulted_listings.clear();
+        resolve_key.clear();
+        resolve_key += form == HeaderForm::eQuoted ? '"' : '<';
+        resolve_key += including_dir;
+        resolve_key += '\0';
+        resolve_key += header_name;
+        if (auto it = resolved.find(resolve_key); it != resolved.end()) {
+            return it->second;
+        }
+
+        std::string resolved_path{};
+        // "..." searches directory of the including file first, <...> only searches include directories
+        if (form == HeaderForm::eQuoted && exists_in_dir(including_dir, header_name)) {
+            resolved_path = (fs::path{including_dir} / header_name).string();
+        } else {
+            for (const auto &dir : include_dirs) {
+                if (exists_in_dir(dir, header_name)) {
+                    resolved_path = (dir / header_name).string();
+                    break;
+                }
+            }
+        }
+        for (const auto &listing : consulted_listings) {
+            listing_dependents[listing].push_back(resolve_key);
+        }
+        return resolved.insert({resolve_key, std::move(resolved_path)}).first->second;
+    }
+
+    // look up in the listing of the directory containing 'dir/header_name' instead of stat-ing the file
+    bool exists_in_dir(const fs::path &dir, std::string_view header_name) {
+        auto path = (dir / header_name).lexically_normal();
+        auto parent = path.parent_path().string();
+        if (clear_policy == ClearPolicy::eWatch) { consulted_listings.push_back(parent); }
+        const fs::path dir_path{parent.empty() ? "." : parent};
+        auto it = dir_index.find(parent);
+        const auto validated = clear_policy == ClearPolicy::eRevalidate || clear_policy == ClearPolicy::eDrop;
+        if (it != dir_index.end() && validated && it->second.validated_epoch != curr_epoch) {
+            // entries added or removed change mtime of the directory
+            std::error_code ec;
+            auto mtime = fs::last_write_time(dir_path, ec);
+            if (ec || mtime != it->second.mtime || it->second.racy) {
+                dir_index.erase(it);
+                it = dir_index.end();
+            } else {
+                it->second.validated_epoch = curr_epoch;
+            }
+        }
+        if (it == dir_index.end()) {
+            if (clear_policy == ClearPolicy::eWatch) {
+                if (auto watched = watch_dir(dir_path.string())) { watched->listings.push_back(parent); }
+            }
+            it = dir_index.insert({std::move(parent), list_dir(dir_path)}).first;
+        }
+        const auto &listing = it->second;
+        const auto name = path.filename().string();
+        if (listing.entries.contains(name)) { return true; }
+        if (!listing.case_insensitive) { return false; }
+        // file systems fold ASCII letters in the same way, other characters are left to the file system
+        const auto ascii = std::all_of(name.begin(), name.end(), [](char ch) {
+            return static_cast<unsigned char>(ch) < 0x80;
+        });
+        if (ascii) { return listing.folded_entries.contains(fold_case(name)); }
+        std::error_code ec;
+        return fs::is_regular_file(path, ec);
+    }
+
+    DirListing list_dir(const fs::path &dir_path) {
+        DirListing listing{.validated_epoch = curr_epoch};
+        std::error_code ec;
+        listing.mtime = fs::last_write_time(dir_path, ec);
+        // an entry added right after listing may not change mtime if it's coarse, so such a listing is not trusted
+        listing.racy = ec || listing.mtime + kMtimeGranularity >= fs::file_time_type::clock::now();
+        for (fs::directory_iterator dir_it{dir_path, ec}, end; !ec && dir_it != end; dir_it.increment(ec)) {
+            if (!dir_it->is_directory(ec)) {
+                listing.entries.insert(dir_it->path().filename().string());
+            }
+        }
+        // a name differing only in case finds the same file on case-insensitive volumes, e.g. on macOS and Windows
+        for (const auto &entry : listing.entries) {
+            auto swapped = swap_case(entry);
+            if (swapped == entry) { continue; }
+            listing.case_insensitive = !listing.entries.contains(swapped) && fs::exists(dir_path / swapped, ec);
+            break;
+        }
+        if (listing.case_insensitive) {
+            for (const auto &entry : listing.entries) { listing.folded_entries.insert(fold_case(entry)); }
+        }
+        return listing;
+    }
+
+    const CachedHeader *load_header(const std::string &path) {
+        // a racy header read again to be validated, its content is used if it's changed
+        LoadedFile reloaded{};
+        auto it = headers.find(path);
+        if (it != headers.end()) {
+            auto &header = *it->second;
+            if (
+                header.validated_epoch == curr_epoch || clear_policy == ClearPolicy::eKeep
+                || clear_policy == ClearPolicy::eWatch
+            ) {
+                header.used_run = curr_run;
+                headers_lru.splice(headers_lru.begin(), headers_lru, it->second);
+                return &header;
+            }
+            std::error_code ec;
+            auto mtime = fs::last_write_time(path, ec);
+            auto size = ec ? 0 : fs::file_size(path, ec);
+            auto unchanged = !ec && mtime == header.mtime && size == header.size;
+            if (unchanged && header.racy) {
+                reloaded = load_file(path);
+                unchanged = reloaded.found && reloaded.content == header.content;
+                if (unchanged) {
+                    header.mtime = reloaded.mtime;
+                    header.racy = reloaded.racy;
+                }
+            }
+            if (unchanged) {
+                header.used_run = curr_run;
+                header.validated_epoch = curr_epoch;
+                headers_lru.splice(headers_lru.begin(), headers_lru, it->second);
+                return &header;
+            }
+            cached_bytes -= header.content.size();
+            // other runs sharing current run may still view the content
+            if (header.used_run == curr_run) {
+                retired_headers.splice(retired_headers.end(), headers_lru, it->second);
+            } else {
+                headers_lru.erase(it->second);
+            }
+            headers.erase(it);
+        }
+
+        // watched before reading, so that a change made meanwhile is not missed
+        if (clear_policy == ClearPolicy::eWatch) { watch_header(path); }
+        auto file = std::move(reloaded);
+        if (!file.found && !prefetcher.take(path, file)) { file = load_file(path); }
+        if (!file.found) {
+            return nullptr;
+        }
+        CachedHeader header{
+            .path = path,
+            .content = std::move(file.content),
+            .content_hash = file.content_hash,
+            .mtime = file.mtime,
+            .size = file.size,
+            .racy = file.racy,
+            .used_run = curr_run,
+            .validated_epoch = curr_epoch,
+        };
+        cached_bytes += header.content.size();
+        headers_lru.push_front(std::move(header));
+        headers.insert({path, headers_lru.begin()});
+        evict();
+        return &headers_lru.front();
+    }
+
+    void watch_header(const std::string &path) {
+        const fs::path fs_path{path};
+        auto parent = fs_path.parent_path().string();
+        if (auto dir = watch_dir(parent.empty() ? "." : parent)) {
+            auto &paths = dir->headers[fs_path.filename().string()];
+            if (std::find(paths.begin(), paths.end(), path) == paths.end()) { paths.push_back(path); }
+        }
+    }
+
+    bool drop_header(const std::string &path) {
+        auto it = headers.find(path);
+        if (it == headers.end()) { return false; }
+        cached_bytes -= it->second->content.size();
+        headers_lru.erase(it->second);
+        headers.erase(it);
+        return true;
+    }
+
+    // resolutions that looked into the listing are dropped with it
+    bool drop_listing(const std::string &listing) {
+        auto dropped = dir_index.erase(listing) != 0;
+        if (auto it = listing_dependents.find(listing); it != listing_dependents.end()) {
+            for (const auto &key : it->second) { dropped |= resolved.erase(key) != 0; }
+            listing_dependents.erase(it);
+        }
+        return dropped;
+    }
+
+    void notify_change(const std::string &path) {
+        for (const auto &listener : listeners) { listener(path); }
+    }
+
+#if CPREP_HAS_INOTIFY
+    // cached headers and listings of a watched directory
+    struct WatchedDir final {
+        std::string path;
+        // paths of cached headers by file name
+        std::unordered_map<std::string, std::vector<std::string>> headers;
+        // keys of 'dir_index'
+        std::vector<std::string> listings;
+        // missing directories watched through this one, keys of 'watch_of_dir'
+        std::vector<std::string> missing_dirs;
+    };
+
+    static constexpr uint32_t kWatchMask = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_MODIFY
+        | IN_CLOSE_WRITE | IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF;
+
+    // a missing directory is watched by its nearest existing ancestor, which sees it being created,
+    // falls back to 'eRevalidate' if it can't be watched, e.g. when the limit of watches is reached
+    WatchedDir *watch_dir(const std::string &path) {
+        if (auto it = watch_of_dir.find(path); it != watch_of_dir.end()) { return &watched_dirs[it->second]; }
+        if (watch_fd < 0) { watch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC); }
+        auto watched_path = fs::path{path};
+        auto wd = -1;
+        while (watch_fd >= 0) {
+            wd = inotify_add_watch(watch_fd, watched_path.c_str(), kWatchMask);
+            if (wd >= 0 || (errno != ENOENT && errno != ENOTDIR)) { break; }
+            auto parent = watched_path.parent_path();
+            if (parent == watched_path || watched_path == ".") { break; }
+            watched_path = parent.empty() ? fs::path{"."} : parent;
+        }
+        if (wd < 0) {
+            stop_watching();
+            clear_policy = ClearPolicy::eRevalidate;
+            return nullptr;
+        }
+        watch_of_dir.insert({path, wd});
+        // different paths of the same directory share the watch
+        auto &dir = watched_dirs[wd];
+        if (dir.path.empty()) { dir.path = watched_path.string(); }
+        if (watched_path != fs::path{path}) { dir.missing_dirs.push_back(path); }
+        return &dir;
+    }
+
+    void stop_watching() {
+        if (watch_fd >= 0) { ::close(watch_fd); }
+        watch_fd = -1;
+        watched_dirs.clear();
+        watch_of_dir.clear();
+        listing_dependents.clear();
+    }
+
+    bool has_pending_changes() {
+        pollfd poll_fd{watch_fd, POLLIN, 0};
+        return watch_fd >= 0 && ::poll(&poll_fd, 1, 0) > 0;
+    }
+
+    void poll_changes() {
+        if (watch_fd < 0) { return; }
+        alignas(inotify_event) char buffer[16 * 1024];
+        std::vector<std::string> changed_paths{};
+        auto overflowed = false;
+        while (true) {
+            const auto size = ::read(watch_fd, buffer, sizeof(buffer));
+            if (size <= 0) { break; }
+            for (auto p = buffer; p < buffer + size;) {
+                const auto event = reinterpret_cast<const inotify_event *>(p);
+                p += sizeof(inotify_event) + event->len;
+                if (event->mask & IN_Q_OVERFLOW) {
+                    overflowed = true;
+                    continue;
+                }
+                auto it = watched_dirs.find(event->wd);
+                if (it == watched_dirs.end()) { continue; }
+                auto &dir = it->second;
+                if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) {
+                    // the directory is gone, so is everything in it
+                    auto dropped = false;
+                    for (const auto &listing : dir.listings) { dropped |= drop_listing(listing); }
+                    for (const auto &[name, paths] : dir.headers) {
+                        for (const auto &path : paths) { dropped |= drop_header(path); }
+                    }
+                    if (dropped) { changed_paths.push_back(dir.path); }
+                    std::erase_if(watch_of_dir, [wd = event->wd](const auto &entry) { return entry.second == wd; });
+                    if (!(event->mask & IN_IGNORED)) { inotify_rm_watch(watch_fd, event->wd); }
+                    watched_dirs.erase(it);
+                    continue;
+                }
+                if (event->len == 0) { continue; }
+                const std::string name{event->name};
+                auto dropped = false;
+                if (event->mask & (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO)) {
+                    for (const auto &listing : dir.listings) { dropped |= drop_listing(listing); }
+                    dir.listings.clear();
+                }
+                // a level of a missing directory may be created, which this watch doesn't see into,
+                // so they are watched again from the nearest existing ancestor at next lookup
+                if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+                    for (const auto &path : dir.missing_dirs) { watch_of_dir.erase(path); }
+                    dir.missing_dirs.clear();
+                }
+                if (auto header_it = dir.headers.find(name); header_it != dir.headers.end()) {
+                    for (const auto &path : header_it->second) { dropped |= drop_header(path); }
+                    dir.headers.erase(header_it);
+                }
+                if (dropped) { changed_paths.push_back((fs::path{dir.path} / name).string()); }
+            }
+        }
+        if (overflowed) {
+            // changes are lost, nothing cached can be trusted
+            purge();
+            notify_change({});
+            return;
+        }
+        for (const auto &path : changed_paths) { notify_change(path); }
+    }
+
+    int watch_fd = -1;
+    std::unordered_map<int, WatchedDir> watched_dirs;
+    std::unordered_map<std::string, int> watch_of_dir;
+#else
+    struct WatchedDir final {
+        std::vector<std::string> listings;
+        std::unordered_map<std::string, std::vector<std::string>> headers;
+    };
+
+    WatchedDir *watch_dir(const std::string &path) { return nullptr; }
+    void stop_watching() {}
+    bool has_pending_changes() { return false; }
+    void poll_changes() {}
+#endif
+
+    // evict least recently used headers, headers used by current run are kept since preprocessor holds views
+    void evict() {
+        auto it = headers_lru.end();
+        while (cached_bytes > max_cached_bytes && it != headers_lru.begin()) {
+            --it;
+            if (it->used_run == curr_run) { continue; }
+            cached_bytes -= it->content.size();
+            headers.erase(it->path);
+            it = headers_lru.erase(it);
+        }
+    }
+
+    std::vector<fs::path> include_dirs;
+    ClearPolicy clear_policy;
+    size_t max_cached_bytes;
+
+    std::unordered_map<std::string, std::string> resolved;
+    std::unordered_map<std::string, DirListing> dir_index;
+    std::string resolve_key;
+    // listings looked into by current resolution, and keys of resolutions that looked into each listing
+    std::vector<std::string> consulted_listings;
+    std::unordered_map<std::string, std::vector<std::string>> listing_dependents;
+    std::vector<ChangeListener> listeners;
+    FilePrefetcher prefetcher;
+    size_t polled_run = static_cast<size_t>(-1);
+
+    std::list<CachedHeader> headers_lru;
+    std::unordered_map<std::string, std::list<CachedHeader>::iterator> headers;
+    // replaced headers still viewed by current run, released by 'clear()'
+    std::list<CachedHeader> retired_headers;
+    size_t cached_bytes = 0;
+    size_t curr_run = 0;
+    // advanced by each run and by 'revalidate()', cached headers and listings are checked once in each epoch
+    size_t curr_epoch = 0;
+};
+
+FsShaderIncluder::FsShaderIncluder(
+    std::vector<fs::path> include_dirs, ClearPolicy clear_policy, size_t max_cached_bytes
+) {
+    impl_ = new Impl{};
+    impl_->include_dirs = std::move(include_dirs);
+    impl_->clear_policy = !CPREP_HAS_INOTIFY && clear_policy == ClearPolicy::eWatch
+        ? ClearPolicy::eRevalidate : clear_policy;
+    impl_->max_cached_bytes = max_cached_bytes;
+}
+
+FsShaderIncluder::~FsShaderIncluder() {
+    if (impl_) { delete impl_; }
+}
+
+bool FsShaderIncluder::require_header(std::string_view header_name, std::string_view file_path, Result &result) {
+    return impl_->require_header(header_name, file_path, HeaderForm::eQuoted, result);
+}
+
+bool FsShaderIncluder::require_header(
+    std::string_view header_name, std::string_view file_path, HeaderForm form, Result &result
+) {
+    return impl_->require_header(header_name, file_path, form, result);
+}
+
+void FsShaderIncluder::prefetch_header(std::string_view header_name, std::string_view file_path, HeaderForm form) {
+    impl_->prefetch_header(header_name, file_path, form);
+}
+
+void FsShaderIncluder::clear() {
+    impl_->clear();
+}
+
+void FsShaderIncluder::purge() {
+    impl_->purge();
+}
+
+void FsShaderIncluder::add_change_listener(ChangeListener listener) {
+    impl_->listeners.push_back(std::move(listener));
+}
+
+void FsShaderIncluder::revalidate() {
+    impl_->revalidate();
+}
+
+void FsShaderIncluder::poll_changes() {
+    if (impl_->clear_policy == ClearPolicy::eWatch) { impl_->poll_changes(); }
+}
+
+bool FsShaderIncluder::has_pending_changes() {
+    return impl_->clear_policy == ClearPolicy::eWatch && impl_->has_pending_changes();
+}
+
+PEP_CPREP_NAMESPACE_END
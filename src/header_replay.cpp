@@ -0,0 +1,52 @@
+#include "header_replay.hpp"
+
+PEP_CPREP_NAMESPACE_BEGIN
+
+namespace {
+
+// a header included under many different macro states is not worth recording more
+constexpr size_t kMaxReplaysPerFile = 8;
+constexpr size_t kMaxReplayCacheBytes = 64 * 1024 * 1024;
+
+size_t snapshot_size(std::string_view name, const MacroSnapshot &snapshot) {
+    auto size = name.size() + snapshot.replace.size();
+    for (const auto &param : snapshot.params) { size += param.size(); }
+    return size;
+}
+
+}
+
+size_t HeaderReplay::memory_size() const {
+    auto size = output.size();
+    for (const auto &macro : macro_reads) { size += snapshot_size(macro.name, macro.before); }
+    for (const auto &[name, snapshot] : macro_writes) { size += snapshot_size(name, snapshot); }
+    for (const auto &include : include_reads) { size += sizeof(IncludeRead) + include.header_name.size(); }
+    size += (file_reads.size() + file_writes.size()) * sizeof(FileFlags);
+    return size;
+}
+
+const HeaderReplayCache::Replays *HeaderReplayCache::find(FileId file) const {
+    auto it = replays_.find(file);
+    return it == replays_.end() ? nullptr : &it->second;
+}
+
+void HeaderReplayCache::insert(FileId file, std::shared_ptr<const HeaderReplay> replay) {
+    auto &replays = replays_[file];
+    if (replays.size() == kMaxReplaysPerFile) {
+        cached_bytes_ -= replays.back()->memory_size();
+        replays.pop_back();
+    }
+    cached_bytes_ += replay->memory_size();
+    replays.insert(replays.begin(), std::move(replay));
+    if (cached_bytes_ > kMaxReplayCacheBytes) {
+        // replays in use are still owned by preprocessor
+        clear();
+    }
+}
+
+void HeaderReplayCache::clear() {
+    replays_.clear();
+    cached_bytes_ = 0;
+}
+
+PEP_CPREP_NAMESPACE_END
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <memory>
+#include <unordered_map>
+
+#include <cprep/cprep.hpp>
+
+#include "macro.hpp"
+#include "path_table.hpp"
+
+PEP_CPREP_NAMESPACE_BEGIN
+
+// output and side effects of preprocessing a header,
+// it is replayed when the header is included again and all recorded inputs are the same
+struct HeaderReplay final {
+    struct FileFlags final {
+        FileId file;
+        bool pragma_once;
+        // empty if file is not guarded
+        std::string guard;
+    };
+    struct MacroRead final {
+        std::string name;
+        MacroSnapshot before;
+        // tested by a directive or expanded as a builtin, see 'Result::macro_dependencies'
+        bool tested;
+    };
+    struct IncludeRead final {
+        ShaderIncluder::HeaderForm form;
+        FileId including_file;
+        std::string header_name;
+        // 'kInvalidFileId' if header is not found
+        FileId header_file;
+        // hash of header content if header is entered, 0 otherwise
+        uint64_t content_hash;
+    };
+
+    uint64_t content_hash = 0;
+    // inputs, state of macros and files before they are changed by the header
+    std::vector<MacroRead> macro_reads;
+    std::vector<FileFlags> file_reads;
+    std::vector<IncludeRead> include_reads;
+    // side effects, final state of macros and files changed by the header
+    std::vector<std::pair<std::string, MacroSnapshot>> macro_writes;
+    std::vector<FileFlags> file_writes;
+    // output between '#line 1 "header"' and the '#line' back to including file
+    std::string output;
+
+    size_t memory_size() const;
+};
+
+// state of a header that is being recorded
+struct HeaderRecording final {
+    struct MacroAccess final {
+        // 'before' is valid only if macro is read before it's written
+        bool read = false;
+        bool written = false;
+        bool tested = false;
+        MacroSnapshot before;
+    };
+    struct FileAccess final {
+        bool read = false;
+        bool written = false;
+        bool pragma_once = false;
+        std::string guard;
+    };
+
+    FileId file;
+    uint64_t content_hash;
+    // size of file stack after the header is pushed
+    size_t files_depth;
+    // size of if stack when the header is entered, conditional directives in the header must not go below it
+    size_t if_depth;
+    size_t output_start;
+    // set to false if recorded result can't be replayed, e.g. there are errors or warnings
+    bool valid = true;
+
+    std::unordered_map<std::string, MacroAccess, StringHash, std::equal_to<>> macros{};
+    std::unordered_map<FileId, FileAccess> files{};
+    std::vector<HeaderReplay::IncludeRead> include_reads{};
+};
+
+// replays of headers, kept across runs of a preprocessor
+class HeaderReplayCache final {
+public:
+    using Replays = std::vector<std::shared_ptr<const HeaderReplay>>;
+
+    // returns nullptr if nothing is recorded for the file, latest replay comes first
+    const Replays *find(FileId file) const;
+    void insert(FileId file, std::shared_ptr<const HeaderReplay> replay);
+    void clear();
+
+private:
+    std::unordered_map<FileId, Replays> replays_;
+    size_t cached_bytes_ = 0;
+};
+
+PEP_CPREP_NAMESPACE_END
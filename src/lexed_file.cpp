@@ -0,0 +1,155 @@
+#include "lexed_file.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+PEP_CPREP_NAMESPACE_BEGIN
+
+namespace {
+
+constexpr char kLexedMagic[8] = {'C', 'P', 'R', 'E', 'P', 'L', 'E', 'X'};
+constexpr uint32_t kLexedVersion = 2;
+constexpr uint32_t kByteOrderMark = 0x01020304;
+
+// followed by arrays of 4-byte elements and then arrays of 1-byte elements, in the order of 'LexedSource'
+struct LexedFileHeader final {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint64_t content_hash;
+    uint64_t content_size;
+    uint32_t num_tokens;
+    uint32_t num_directives;
+    uint64_t total_size;
+};
+
+size_t lexed_file_size(size_t num_tokens, size_t num_directives) {
+    return sizeof(LexedFileHeader)
+        + num_tokens * (3 * sizeof(uint32_t) + 2 * sizeof(uint8_t))
+        + num_directives * (2 * sizeof(uint32_t) + sizeof(LexedSource::DirectiveKind))
+        + (num_directives + 1) * sizeof(uint32_t);
+}
+
+// arrays are not copied, so any broken index is rejected here instead of when it's replayed or skipped
+bool validate_lexed_source(const LexedSource &lexed, size_t content_size) {
+    const auto num_tokens = lexed.num_tokens();
+    if (num_tokens == 0 || static_cast<TokenType>(lexed.types[num_tokens - 1]) != TokenType::eEof) { return false; }
+    size_t gap_start = 0;
+    for (size_t i = 0; i < num_tokens; i++) {
+        const size_t offset = lexed.offsets[i];
+        if (
+            lexed.types[i] >= static_cast<uint8_t>(TokenType::eUnknown) || offset < gap_start
+            || offset > content_size || lexed.lengths[i] > content_size - offset
+        ) {
+            return false;
+        }
+        gap_start = offset + lexed.lengths[i];
+    }
+    const auto num_directives = lexed.directives.size();
+    for (size_t i = 0; i < num_directives; i++) {
+        if (
+            lexed.directives[i] + size_t{1} >= num_tokens
+            || (i > 0 && lexed.directives[i] <= lexed.directives[i - 1])
+            || lexed.directive_lines[i] > lexed.directive_lines[i + 1]
+            || lexed.directive_kinds[i] > LexedSource::DirectiveKind::eInvalid
+            || lexed.directive_ends[i] > num_directives
+        ) {
+            return false;
+        }
+    }
+    // '#if' must end at its matching '#endif' as 'index_directives()' finds it,
+    // otherwise skipping an inactive branch may go backwards or never end
+    using DirectiveKind = LexedSource::DirectiveKind;
+    std::vector<uint32_t> if_stack{};
+    auto unmatched_ifs_valid = [&]() {
+        return std::all_of(if_stack.begin(), if_stack.end(), [&](uint32_t i) {
+            return lexed.directive_ends[i] == num_directives;
+        });
+    };
+    for (uint32_t i = 0; i < num_directives; i++) {
+        const auto kind = lexed.directive_kinds[i];
+        if (kind == DirectiveKind::eIf) {
+            if_stack.push_back(i);
+        } else if (kind == DirectiveKind::eEndif && !if_stack.empty()) {
+            if (lexed.directive_ends[if_stack.back()] != i) { return false; }
+            if_stack.pop_back();
+        } else if (kind == DirectiveKind::eInvalid) {
+            if (!unmatched_ifs_valid()) { return false; }
+            if_stack.clear();
+        }
+    }
+    return unmatched_ifs_valid();
+}
+
+}
+
+std::string write_lexed_file(const LexedSource &lexed, uint64_t content_hash, size_t content_size) {
+    LexedFileHeader header{};
+    std::memcpy(header.magic, kLexedMagic, sizeof(kLexedMagic));
+    header.version = kLexedVersion;
+    header.byte_order = kByteOrderMark;
+    header.content_hash = content_hash;
+    header.content_size = content_size;
+    header.num_tokens = static_cast<uint32_t>(lexed.num_tokens());
+    header.num_directives = static_cast<uint32_t>(lexed.directives.size());
+    header.total_size = lexed_file_size(header.num_tokens, header.num_directives);
+
+    std::string data{};
+    data.reserve(header.total_size);
+    auto append = [&data](const auto &array) {
+        data.append(reinterpret_cast<const char *>(array.data()), array.size_bytes());
+    };
+    data.append(reinterpret_cast<const char *>(&header), sizeof(header));
+    append(lexed.offsets);
+    append(lexed.lengths);
+    append(lexed.line_deltas);
+    append(lexed.directives);
+    append(lexed.directive_ends);
+    append(lexed.directive_lines);
+    append(lexed.types);
+    append(lexed.gap_flags);
+    append(lexed.directive_kinds);
+    return data;
+}
+
+std::shared_ptr<const LexedSource> open_lexed_file(
+    std::string_view data, std::shared_ptr<const void> owner, uint64_t content_hash, size_t content_size
+) {
+    // 4-byte arrays are used in place, mapped file and allocated buffer are always aligned enough
+    if (data.size() < sizeof(LexedFileHeader) || reinterpret_cast<uintptr_t>(data.data()) % alignof(uint64_t) != 0) {
+        return nullptr;
+    }
+    LexedFileHeader header{};
+    std::memcpy(&header, data.data(), sizeof(header));
+    if (
+        std::memcmp(header.magic, kLexedMagic, sizeof(kLexedMagic)) != 0
+        || header.version != kLexedVersion || header.byte_order != kByteOrderMark
+        || header.content_hash != content_hash || header.content_size != content_size
+        || header.total_size != data.size()
+        || header.total_size != lexed_file_size(header.num_tokens, header.num_directives)
+    ) {
+        return nullptr;
+    }
+
+    auto lexed = std::make_shared<LexedSource>();
+    auto p = data.data() + sizeof(header);
+    auto take = [&p]<typename T>(std::span<const T> &array, size_t count) {
+        array = {reinterpret_cast<const T *>(p), count};
+        p += array.size_bytes();
+    };
+    take(lexed->offsets, header.num_tokens);
+    take(lexed->lengths, header.num_tokens);
+    take(lexed->line_deltas, header.num_tokens);
+    take(lexed->directives, header.num_directives);
+    take(lexed->directive_ends, header.num_directives);
+    take(lexed->directive_lines, header.num_directives + size_t{1});
+    take(lexed->types, header.num_tokens);
+    take(lexed->gap_flags, header.num_tokens);
+    take(lexed->directive_kinds, header.num_directives);
+    lexed->storage = std::move(owner);
+    if (!validate_lexed_source(*lexed, content_size)) { return nullptr; }
+    return lexed;
+}
+
+PEP_CPREP_NAMESPACE_END
@@ -0,0 +1,17 @@
+#pragma once
+
+#include "token_cache.hpp"
+
+PEP_CPREP_NAMESPACE_BEGIN
+
+// on-disk form of a lexed source, arrays of it are used in place after the file is mapped,
+// it's in native byte order, a file of another byte order or version is rejected
+std::string write_lexed_file(const LexedSource &lexed, uint64_t content_hash, size_t content_size);
+
+// returns nullptr if 'data' is not a valid lexed form of the content with 'content_hash' and 'content_size',
+// 'owner' keeps 'data' alive
+std::shared_ptr<const LexedSource> open_lexed_file(
+    std::string_view data, std::shared_ptr<const void> owner, uint64_t content_hash, size_t content_size
+);
+
+PEP_CPREP_NAMESPACE_END
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <vector>
+
+#include "utils.hpp"
+
+PEP_CPREP_NAMESPACE_BEGIN
+
+struct Define final {
+    std::string_view replace{};
+    std::vector<std::string_view> params{};
+    bool function_like = false;
+    bool has_va_params = false;
+    std::string_view file{};
+    size_t lineno = 0;
+};
+
+// copy of a macro state that doesn't reference source contents, 'defined' is false for undefined macro
+struct MacroSnapshot final {
+    bool defined = false;
+    std::string replace{};
+    std::vector<std::string> params{};
+    bool function_like = false;
+    bool has_va_params = false;
+    // file paths are interned and never released
+    std::string_view file{};
+    size_t lineno = 0;
+
+    static MacroSnapshot from(const Define *def) {
+        MacroSnapshot snapshot{};
+        if (def) {
+            snapshot.defined = true;
+            snapshot.replace = def->replace;
+            snapshot.params.assign(def->params.begin(), def->params.end());
+            snapshot.function_like = def->function_like;
+            snapshot.has_va_params = def->has_va_params;
+            snapshot.file = def->file;
+            snapshot.lineno = def->lineno;
+        }
+        return snapshot;
+    }
+
+    // location where macro is defined is not compared, it only appears in error messages
+    bool same_as(const Define *def) const {
+        if (!def || !defined) { return !def && !defined; }
+        return replace == def->replace
+            && function_like == def->function_like
+            && has_va_params == def->has_va_params
+            && std::equal(params.begin(), params.end(), def->params.begin(), def->params.end());
+    }
+
+    // returned define references this snapshot
+    Define to_define() const {
+        return Define{
+            .replace = replace,
+            .params = {params.begin(), params.end()},
+            .function_like = function_like,
+            .has_va_params = has_va_params,
+            .file = file,
+            .lineno = lineno,
+        };
+    }
+};
+
+PEP_CPREP_NAMESPACE_END
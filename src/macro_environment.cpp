@@ -0,0 +1,233 @@
+#include "macro_environment.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <unordered_set>
+
+#include "mapped_file.hpp"
+
+PEP_CPREP_NAMESPACE_BEGIN
+
+namespace {
+
+// lookup walks through layers, a deeper environment is flattened when it's derived
+constexpr size_t kMaxLayerDepth = 8;
+
+void merge_files(std::vector<EnvironmentFile> &files, const std::vector<EnvironmentFile> &later_files) {
+    for (const auto &file : later_files) {
+        auto it = std::find_if(files.begin(), files.end(), [&file](const EnvironmentFile &f) { return f.path == file.path; });
+        if (it == files.end()) {
+            files.push_back(file);
+        } else {
+            *it = file;
+        }
+    }
+}
+
+}
+
+MacroOptions parse_macro_options(const std::string_view *options, size_t num_options) {
+    MacroOptions result{};
+
+    auto fetch_and_trim_option = [options](size_t i) {
+        auto opt = options[i];
+        auto opt_b = opt.begin();
+        auto opt_e = opt.end();
+        while (opt_b < opt_e && std::isblank(*opt_b)) { ++opt_b; }
+        while (opt_b < opt_e && std::isblank(*(opt_e - 1))) { --opt_e; }
+        return std::make_pair(opt_b, opt_e);
+    };
+
+    for (size_t i = 0; i < num_options; i++) {
+        auto [opt_b, opt_e] = fetch_and_trim_option(i);
+        if (opt_b + 1 >= opt_e || *opt_b != '-') { continue; }
+        ++opt_b;
+        if (*opt_b == 'D') {
+            ++opt_b;
+            if (opt_b == opt_e) {
+                ++i;
+                if (i == num_options) { continue; }
+                std::tie(opt_b, opt_e) = fetch_and_trim_option(i);
+            }
+            auto eq = std::find(opt_b, opt_e, '=');
+            auto name = make_string_view(opt_b, eq);
+            auto replace = eq == opt_e ? std::string_view{""} : make_string_view(eq + 1, opt_e);
+            result.defines.emplace_back(name, replace);
+        } else if (*opt_b == 'U') {
+            ++opt_b;
+            if (opt_b == opt_e) {
+                ++i;
+                if (i == num_options) { continue; }
+                std::tie(opt_b, opt_e) = fetch_and_trim_option(i);
+            }
+            result.undefines.push_back(make_string_view(opt_b, opt_e));
+        }
+    }
+
+    return result;
+}
+
+const Define *MacroEnvironment::Layer::find(std::string_view name, DefineCache &cache) const {
+    for (auto layer = this; layer; layer = layer->parent.get()) {
+        if (auto it = layer->macros.find(name); it != layer->macros.end()) {
+            return it->second.snapshot.defined ? &it->second.define : nullptr;
+        }
+        if (layer->snapshot) {
+            if (auto it = cache.find(name); it != cache.end()) { return &it->second; }
+            const auto index = layer->snapshot->find(name);
+            std::string_view stored_name{};
+            Define define{};
+            if (index == layer->snapshot->num_macros() || !layer->snapshot->decode(index, stored_name, define)) {
+                return nullptr;
+            }
+            // key references the blob since 'name' may not outlive the cache
+            return &cache.emplace(stored_name, std::move(define)).first->second;
+        }
+    }
+    return nullptr;
+}
+
+bool MacroEnvironment::Layer::names(std::string_view name) const {
+    for (auto layer = this; layer; layer = layer->parent.get()) {
+        if (layer->macros.contains(name)) { return true; }
+        if (layer->snapshot) { return layer->snapshot->find(name) != layer->snapshot->num_macros(); }
+    }
+    return false;
+}
+
+void MacroEnvironment::Layer::set(std::string_view name, const MacroSnapshot &snapshot) {
+    auto it = macros.find(name);
+    if (it == macros.end()) {
+        it = macros.emplace(std::string{name}, EnvironmentMacro{}).first;
+    }
+    // macros are not moved after they are emplaced, so views to their own strings stay valid
+    auto &macro = it->second;
+    macro.file = snapshot.file;
+    macro.snapshot = snapshot;
+    macro.snapshot.file = macro.file;
+    macro.define = macro.snapshot.to_define();
+}
+
+std::shared_ptr<MacroEnvironment::Layer> MacroEnvironment::Layer::flatten(const Layer &top) {
+    std::vector<const Layer *> layers{};
+    // snapshot layer is kept as the parent, its macros stay in the blob
+    std::shared_ptr<const Layer> base{};
+    for (auto layer = &top; layer; layer = layer->parent.get()) {
+        layers.push_back(layer);
+        if (layer->parent && layer->parent->snapshot) {
+            base = layer->parent;
+            break;
+        }
+    }
+    auto flat = std::make_shared<Layer>();
+    for (auto it = layers.rbegin(); it != layers.rend(); ++it) {
+        for (const auto &[name, macro] : (*it)->macros) {
+            if (macro.snapshot.defined || base) {
+                flat->set(name, macro.snapshot);
+            } else {
+                flat->macros.erase(name);
+            }
+        }
+        merge_files(flat->files, (*it)->files);
+    }
+    if (base) {
+        flat->depth = base->depth + 1;
+        flat->parent = std::move(base);
+    }
+    return flat;
+}
+
+std::shared_ptr<MacroEnvironment::Layer> MacroEnvironment::Layer::from_snapshot(
+    std::shared_ptr<const EnvironmentSnapshot> snapshot
+) {
+    auto layer = std::make_shared<Layer>();
+    layer->files = snapshot->files();
+    layer->snapshot = std::move(snapshot);
+    return layer;
+}
+
+std::vector<EnvironmentFile> MacroEnvironment::Layer::collect_files(const Layer &top) {
+    std::vector<const Layer *> layers{};
+    for (auto layer = &top; layer; layer = layer->parent.get()) { layers.push_back(layer); }
+    std::vector<EnvironmentFile> files{};
+    for (auto it = layers.rbegin(); it != layers.rend(); ++it) { merge_files(files, (*it)->files); }
+    return files;
+}
+
+std::shared_ptr<MacroEnvironment::Layer> MacroEnvironment::Layer::derive(std::shared_ptr<const Layer> parent) {
+    if (parent && parent->depth + 1 >= kMaxLayerDepth) {
+        return flatten(*parent);
+    }
+    auto layer = std::make_shared<Layer>();
+    layer->depth = parent ? parent->depth + 1 : 0;
+    layer->parent = std::move(parent);
+    return layer;
+}
+
+MacroEnvironment::MacroEnvironment() = default;
+
+MacroEnvironment::MacroEnvironment(const std::string_view *options, size_t num_options) {
+    *this = MacroEnvironment{}.derive(options, num_options);
+}
+
+MacroEnvironment::MacroEnvironment(std::shared_ptr<const Layer> layer) : layer_(std::move(layer)) {}
+
+MacroEnvironment MacroEnvironment::derive(const std::string_view *options, size_t num_options) const {
+    auto macro_options = parse_macro_options(options, num_options);
+    auto layer = Layer::derive(layer_);
+    std::unordered_set<std::string_view> defined{};
+    for (const auto &[name, replace] : macro_options.defines) {
+        if (!defined.insert(name).second) { continue; }
+        layer->set(name, MacroSnapshot{.defined = true, .replace = std::string{replace}});
+    }
+    for (auto name : macro_options.undefines) {
+        layer->set(name, MacroSnapshot{});
+    }
+    return MacroEnvironment{std::move(layer)};
+}
+
+bool MacroEnvironment::is_defined(std::string_view name) const {
+    Layer::DefineCache cache{};
+    return layer_ && layer_->find(name, cache) != nullptr;
+}
+
+std::string MacroEnvironment::to_snapshot() const {
+    std::vector<std::pair<std::string_view, const Define *>> macros{};
+    std::vector<Define> decoded{};
+    std::unordered_set<std::string_view> visited{};
+    for (auto layer = layer_.get(); layer; layer = layer->parent.get()) {
+        for (const auto &[name, macro] : layer->macros) {
+            if (visited.insert(name).second && macro.snapshot.defined) { macros.emplace_back(name, &macro.define); }
+        }
+        if (layer->snapshot) {
+            decoded.resize(layer->snapshot->num_macros());
+            for (size_t i = 0; i < decoded.size(); i++) {
+                std::string_view name{};
+                if (layer->snapshot->decode(i, name, decoded[i]) && visited.insert(name).second) {
+                    macros.emplace_back(name, &decoded[i]);
+                }
+            }
+        }
+    }
+    // same environment gives the same blob
+    std::sort(macros.begin(), macros.end(), [](const auto &a, const auto &b) { return a.first < b.first; });
+    return EnvironmentSnapshot::write(macros, layer_ ? Layer::collect_files(*layer_) : std::vector<EnvironmentFile>{});
+}
+
+bool MacroEnvironment::from_snapshot(std::string_view data, MacroEnvironment &environment) {
+    auto snapshot = EnvironmentSnapshot::open(data, nullptr);
+    if (!snapshot) { return false; }
+    environment = MacroEnvironment{Layer::from_snapshot(std::move(snapshot))};
+    return true;
+}
+
+bool MacroEnvironment::load_snapshot(const std::string &path, MacroEnvironment &environment) {
+    auto file = MappedFile::open(path);
+    if (!file) { return false; }
+    auto snapshot = EnvironmentSnapshot::open(file->data(), file);
+    if (!snapshot) { return false; }
+    environment = MacroEnvironment{Layer::from_snapshot(std::move(snapshot))};
+    return true;
+}
+
+PEP_CPREP_NAMESPACE_END
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <memory>
+#include <unordered_map>
+
+#include <cprep/cprep.hpp>
+
+#include "environment_snapshot.hpp"
+#include "macro.hpp"
+
+PEP_CPREP_NAMESPACE_BEGIN
+
+// '-DNAME', '-DNAME=VALUE' and '-UNAME' options in order, the first definition of a name wins
+// and names in 'undefines' are removed after all definitions
+struct MacroOptions final {
+    std::vector<std::pair<std::string_view, std::string_view>> defines;
+    std::vector<std::string_view> undefines;
+};
+
+MacroOptions parse_macro_options(const std::string_view *options, size_t num_options);
+
+// macro of an environment owning its strings
+struct EnvironmentMacro final {
+    std::string file;
+    // 'defined' is false if the macro is undefined by this layer, 'file' of it references 'file' above
+    MacroSnapshot snapshot;
+    // references 'snapshot'
+    Define define;
+};
+
+// macros changed by a layer on top of its parent, layers are never changed after they are built
+struct MacroEnvironment::Layer final {
+    // macros decoded from snapshot, a cache is owned by its user since layers are shared between threads
+    using DefineCache = std::unordered_map<std::string_view, Define>;
+
+    std::shared_ptr<const Layer> parent;
+    // number of layers below this one
+    size_t depth = 0;
+    std::unordered_map<std::string, EnvironmentMacro, StringHash, std::equal_to<>> macros;
+    // only set for a layer without parent, macros not in 'macros' are looked up from it
+    std::shared_ptr<const EnvironmentSnapshot> snapshot;
+    // header states set by this layer, applied after those of parent layers
+    std::vector<EnvironmentFile> files;
+
+    // returns nullptr if the macro is not defined in the environment
+    const Define *find(std::string_view name, DefineCache &cache) const;
+    // whether some layer defines or undefines the macro
+    bool names(std::string_view name) const;
+
+    // strings of 'snapshot' are copied
+    void set(std::string_view name, const MacroSnapshot &snapshot);
+
+    // an empty layer on top of 'parent', or a flattened copy of 'parent' if it's too deep
+    static std::shared_ptr<Layer> derive(std::shared_ptr<const Layer> parent);
+    // a layer holding all macros defined in 'top', its parent is the snapshot layer if there is one
+    static std::shared_ptr<Layer> flatten(const Layer &top);
+    static std::shared_ptr<Layer> from_snapshot(std::shared_ptr<const EnvironmentSnapshot> snapshot);
+    // header states of all layers from the bottom one, a later state of a path replaces an earlier one
+    static std::vector<EnvironmentFile> collect_files(const Layer &top);
+};
+
+PEP_CPREP_NAMESPACE_END
@@ -0,0 +1,58 @@
+#include "mapped_file.hpp"
+
+#include <fstream>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define CPREP_HAS_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#define CPREP_HAS_MMAP 0
+#endif
+
+PEP_CPREP_NAMESPACE_BEGIN
+
+std::shared_ptr<const MappedFile> MappedFile::open(const std::string &path) {
+    auto file = std::make_shared<MappedFile>();
+#if CPREP_HAS_MMAP
+    auto fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) { return nullptr; }
+    struct stat st{};
+    if (::fstat(fd, &st) != 0) {
+        ::close(fd);
+        return nullptr;
+    }
+    // empty file can't be mapped
+    if (st.st_size > 0) {
+        auto p = ::mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED) {
+            file->data_ = static_cast<const char *>(p);
+            file->size_ = static_cast<size_t>(st.st_size);
+            file->mapped_ = true;
+        }
+    }
+    ::close(fd);
+    if (file->mapped_ || st.st_size == 0) { return file; }
+#endif
+    std::ifstream fin(path, std::ios::binary);
+    if (!fin) { return nullptr; }
+    fin.seekg(0, std::ios::end);
+    auto length = fin.tellg();
+    if (length < 0) { return nullptr; }
+    file->content_.resize(static_cast<size_t>(length));
+    fin.seekg(0, std::ios::beg);
+    fin.read(file->content_.data(), length);
+    file->data_ = file->content_.data();
+    file->size_ = file->content_.size();
+    return file;
+}
+
+MappedFile::~MappedFile() {
+#if CPREP_HAS_MMAP
+    if (mapped_) { ::munmap(const_cast<char *>(data_), size_); }
+#endif
+}
+
+PEP_CPREP_NAMESPACE_END
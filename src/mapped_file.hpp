@@ -0,0 +1,32 @@
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include "utils.hpp"
+
+PEP_CPREP_NAMESPACE_BEGIN
+
+// read-only view of a whole file, the file is memory mapped where it's supported and read into memory otherwise
+class MappedFile final {
+public:
+    // returns nullptr if the file can't be opened
+    static std::shared_ptr<const MappedFile> open(const std::string &path);
+
+    MappedFile() = default;
+    ~MappedFile();
+
+    MappedFile(const MappedFile &rhs) = delete;
+    MappedFile &operator=(const MappedFile &rhs) = delete;
+
+    std::string_view data() const { return {data_, size_}; }
+
+private:
+    const char *data_ = nullptr;
+    size_t size_ = 0;
+    // used if the file is not mapped
+    std::string content_;
+    bool mapped_ = false;
+};
+
+PEP_CPREP_NAMESPACE_END
@@ -0,0 +1,244 @@
+#include <cprep/pack_includer.hpp>
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <filesystem>
+#include <unordered_set>
+
+#include "mapped_file.hpp"
+
+PEP_CPREP_NAMESPACE_BEGIN
+
+namespace {
+
+constexpr char kPackMagic[8] = {'C', 'P', 'R', 'E', 'P', 'P', 'A', 'K'};
+constexpr uint32_t kPackVersion = 1;
+// pack is in native byte order, a pack from a machine of different byte order is rejected
+constexpr uint32_t kByteOrderMark = 0x01020304;
+
+// layout: header, hash table, entries, strings (paths and contents)
+struct PackHeader final {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t num_headers;
+    // power of 2, each slot is 0 or index of an entry plus 1
+    uint32_t table_size;
+    uint64_t table_offset;
+    uint64_t entries_offset;
+    uint64_t strings_offset;
+    uint64_t total_size;
+};
+
+// offsets are relative to the start of strings
+struct PackEntry final {
+    uint64_t path_hash;
+    uint64_t content_hash;
+    uint64_t path_offset;
+    uint64_t path_size;
+    uint64_t content_offset;
+    uint64_t content_size;
+};
+
+// blob may not be aligned, records are copied out of it
+template <typename T>
+T read_at(std::string_view data, size_t offset) {
+    T value;
+    std::memcpy(&value, data.data() + offset, sizeof(T));
+    return value;
+}
+
+template <typename T>
+void write_at(std::string &data, size_t offset, const T &value) {
+    std::memcpy(data.data() + offset, &value, sizeof(T));
+}
+
+size_t align_up(size_t offset) { return (offset + 7) & ~size_t{7}; }
+
+// paths in a pack are normalized with '/' as separator, most header names already are and they are used as is
+std::string_view normalize_path(std::string_view path, std::string &buffer) {
+    const auto normal = !path.empty() && path.find('\\') == std::string_view::npos
+        && path.find("//") == std::string_view::npos && path.find("./") == std::string_view::npos
+        && path.find("/.") == std::string_view::npos && path.front() != '.' && path.back() != '/';
+    if (normal) { return path; }
+    std::string generic{path};
+    std::replace(generic.begin(), generic.end(), '\\', '/');
+    buffer = std::filesystem::path{generic}.lexically_normal().generic_string();
+    while (!buffer.empty() && buffer.back() == '/') { buffer.pop_back(); }
+    return buffer;
+}
+
+}
+
+struct PackShaderIncluder::Impl final {
+    bool load_from_data(std::string_view pack_data, std::shared_ptr<const MappedFile> pack_file) {
+        *this = {};
+        if (pack_data.size() < sizeof(PackHeader)) { return false; }
+        const auto header = read_at<PackHeader>(pack_data, 0);
+        if (
+            std::memcmp(header.magic, kPackMagic, sizeof(kPackMagic)) != 0
+            || header.version != kPackVersion || header.byte_order != kByteOrderMark
+            || header.total_size != pack_data.size() || !std::has_single_bit(header.table_size)
+        ) {
+            return false;
+        }
+        auto fits = [&pack_data](uint64_t offset, uint64_t count, size_t record_size) {
+            return offset <= pack_data.size() && count <= (pack_data.size() - offset) / record_size;
+        };
+        if (
+            !fits(header.table_offset, header.table_size, sizeof(uint32_t))
+            || !fits(header.entries_offset, header.num_headers, sizeof(PackEntry))
+            || header.strings_offset > pack_data.size()
+        ) {
+            return false;
+        }
+        data = pack_data;
+        file = std::move(pack_file);
+        num_headers = header.num_headers;
+        table_size = header.table_size;
+        table_offset = header.table_offset;
+        entries_offset = header.entries_offset;
+        strings_offset = header.strings_offset;
+        return true;
+    }
+
+    // entries are checked when they are found, so loading a pack doesn't touch all of it
+    bool find(std::string_view path, Result &result) const {
+        if (table_size == 0) { return false; }
+        const auto strings = data.substr(strings_offset);
+        auto string_at = [&strings](uint64_t offset, uint64_t size, std::string_view &s) {
+            if (offset > strings.size() || size > strings.size() - offset) { return false; }
+            s = strings.substr(offset, size);
+            return true;
+        };
+        const auto path_hash = hash_content(path);
+        // a valid table always has an empty slot, probing stops after a whole round anyway
+        auto slot = path_hash & (table_size - 1);
+        for (size_t i = 0; i < table_size; i++, slot = (slot + 1) & (table_size - 1)) {
+            const auto index = read_at<uint32_t>(data, table_offset + slot * sizeof(uint32_t));
+            if (index == 0 || index > num_headers) { return false; }
+            const auto entry = read_at<PackEntry>(data, entries_offset + (index - 1) * sizeof(PackEntry));
+            std::string_view entry_path{};
+            if (entry.path_hash != path_hash || !string_at(entry.path_offset, entry.path_size, entry_path)) {
+                continue;
+            }
+            if (entry_path != path) { continue; }
+            std::string_view content{};
+            if (!string_at(entry.content_offset, entry.content_size, content)) { return false; }
+            result.header_content = content;
+            result.header_path = entry_path;
+            result.content_hash = entry.content_hash;
+            return true;
+        }
+        return false;
+    }
+
+    std::string_view data;
+    // nullptr if data is given by user
+    std::shared_ptr<const MappedFile> file;
+    size_t num_headers = 0;
+    size_t table_size = 0;
+    size_t table_offset = 0;
+    size_t entries_offset = 0;
+    size_t strings_offset = 0;
+};
+
+PackShaderIncluder::PackShaderIncluder() {
+    impl_ = new Impl{};
+}
+
+PackShaderIncluder::~PackShaderIncluder() {
+    if (impl_) { delete impl_; }
+}
+
+bool PackShaderIncluder::load(const std::string &path) {
+    auto file = MappedFile::open(path);
+    if (!file) {
+        *impl_ = {};
+        return false;
+    }
+    auto data = file->data();
+    return impl_->load_from_data(data, std::move(file));
+}
+
+bool PackShaderIncluder::load_from_data(std::string_view data) {
+    return impl_->load_from_data(data, nullptr);
+}
+
+std::string PackShaderIncluder::write(const std::vector<std::pair<std::string, std::string>> &headers) {
+    std::string strings{};
+    std::vector<PackEntry> entries{};
+    std::unordered_set<std::string> added_paths{};
+    std::string buffer{};
+    for (const auto &[header_path, content] : headers) {
+        auto path = std::string{normalize_path(header_path, buffer)};
+        if (!added_paths.insert(path).second) { continue; }
+        PackEntry entry{};
+        entry.path_hash = hash_content(path);
+        entry.content_hash = hash_content(content);
+        entry.path_offset = strings.size();
+        entry.path_size = path.size();
+        strings += path;
+        entry.content_offset = strings.size();
+        entry.content_size = content.size();
+        strings += content;
+        entries.push_back(entry);
+    }
+
+    const auto table_size = std::bit_ceil(std::max<size_t>(entries.size() * 2, 1));
+    std::vector<uint32_t> table(table_size, 0);
+    for (size_t i = 0; i < entries.size(); i++) {
+        auto slot = entries[i].path_hash & (table_size - 1);
+        while (table[slot] != 0) { slot = (slot + 1) & (table_size - 1); }
+        table[slot] = static_cast<uint32_t>(i + 1);
+    }
+
+    PackHeader header{};
+    std::memcpy(header.magic, kPackMagic, sizeof(kPackMagic));
+    header.version = kPackVersion;
+    header.byte_order = kByteOrderMark;
+    header.num_headers = static_cast<uint32_t>(entries.size());
+    header.table_size = static_cast<uint32_t>(table_size);
+    header.table_offset = align_up(sizeof(PackHeader));
+    header.entries_offset = align_up(header.table_offset + table_size * sizeof(uint32_t));
+    header.strings_offset = header.entries_offset + entries.size() * sizeof(PackEntry);
+    header.total_size = header.strings_offset + strings.size();
+
+    std::string data(header.total_size, '\0');
+    write_at(data, 0, header);
+    for (size_t i = 0; i < table.size(); i++) {
+        write_at(data, header.table_offset + i * sizeof(uint32_t), table[i]);
+    }
+    for (size_t i = 0; i < entries.size(); i++) {
+        write_at(data, header.entries_offset + i * sizeof(PackEntry), entries[i]);
+    }
+    std::memcpy(data.data() + header.strings_offset, strings.data(), strings.size());
+    return data;
+}
+
+size_t PackShaderIncluder::num_headers() const {
+    return impl_->num_headers;
+}
+
+bool PackShaderIncluder::require_header(std::string_view header_name, std::string_view file_path, Result &result) {
+    return require_header(header_name, file_path, HeaderForm::eQuoted, result);
+}
+
+bool PackShaderIncluder::require_header(
+    std::string_view header_name, std::string_view file_path, HeaderForm form, Result &result
+) {
+    std::string buffer{};
+    if (form == HeaderForm::eQuoted) {
+        // beside the including file, which is found in the pack only if it's a header of the pack
+        auto dir_end = file_path.find_last_of("/\\");
+        if (dir_end != std::string_view::npos) {
+            std::string sibling_path{file_path.substr(0, dir_end + 1)};
+            sibling_path += header_name;
+            if (impl_->find(normalize_path(sibling_path, buffer), result)) { return true; }
+        }
+    }
+    return impl_->find(normalize_path(header_name, buffer), result);
+}
+
+PEP_CPREP_NAMESPACE_END
@@ -0,0 +1,56 @@
+#include "path_table.hpp"
+
+PEP_CPREP_NAMESPACE_BEGIN
+
+FileId PathTable::intern_normalized(std::string_view path) {
+    const auto is_absolute = !path.empty() && path[0] == '/';
+    // buffer_[0] is reserved for the leading '/', parts are joined after it
+    buffer_.assign(1, '/');
+    part_starts_.clear();
+    size_t num_leading_parents = 0;
+    size_t last_p = 0;
+    while (last_p <= path.size()) {
+        auto p = path.find_first_of("/\\", last_p);
+        if (p == std::string_view::npos) { p = path.size(); }
+        auto part = path.substr(last_p, p - last_p);
+        last_p = p + 1;
+
+        if (part.empty() || part == ".") {
+            continue;
+        }
+        if (part == ".." && part_starts_.size() > num_leading_parents) {
+            buffer_.resize(part_starts_.back() == 1 ? 1 : part_starts_.back() - 1);
+            part_starts_.pop_back();
+            continue;
+        }
+        if (part == "..") {
+            ++num_leading_parents;
+        }
+        if (!part_starts_.empty()) { buffer_ += '/'; }
+        part_starts_.push_back(buffer_.size());
+        buffer_ += part;
+    }
+
+    std::string_view normalized = buffer_;
+    if (!is_absolute || num_leading_parents > 0) {
+        normalized.remove_prefix(1);
+    }
+    return intern(normalized);
+}
+
+FileId PathTable::intern(std::string_view path) {
+    if (auto it = ids_.find(path); it != ids_.end()) {
+        return it->second;
+    }
+    const auto id = static_cast<FileId>(paths_.size());
+    paths_.emplace_back(path);
+    ids_.insert({paths_.back(), id});
+    return id;
+}
+
+void PathTable::clear() {
+    ids_.clear();
+    paths_.clear();
+}
+
+PEP_CPREP_NAMESPACE_END
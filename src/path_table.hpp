@@ -0,0 +1,35 @@
+#pragma once
+
+#include <deque>
+#include <unordered_map>
+#include <vector>
+
+#include "utils.hpp"
+
+PEP_CPREP_NAMESPACE_BEGIN
+
+using FileId = uint32_t;
+inline constexpr FileId kInvalidFileId = ~FileId{0};
+
+// interns file paths and maps each distinct path to a small integer id, ids and paths are kept until 'clear()'
+class PathTable final {
+public:
+    // normalize path ('.', '..' and repeated separators are removed) and intern it
+    FileId intern_normalized(std::string_view path);
+    // intern path as it is, e.g. file name from '#line' directive
+    FileId intern(std::string_view path);
+
+    std::string_view path_of(FileId id) const { return paths_[id]; }
+    size_t size() const { return paths_.size(); }
+    // ids given before are invalid after this
+    void clear();
+
+private:
+    std::deque<std::string> paths_;
+    std::unordered_map<std::string_view, FileId> ids_;
+    // reused to avoid allocations when normalizing
+    std::string buffer_;
+    std::vector<size_t> part_starts_;
+};
+
+PEP_CPREP_NAMESPACE_END
@@ -0,0 +1,221 @@
+#include <cprep/pool.hpp>
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+PEP_CPREP_NAMESPACE_BEGIN
+
+namespace {
+
+// forwards to an includer that is not thread-safe,
+// 'clear()' is left to the pool since other workers may still hold views of header contents
+class SerializedIncluder final : public ShaderIncluder {
+public:
+    explicit SerializedIncluder(ShaderIncluder &includer) : includer_(includer) {}
+
+    bool require_header(std::string_view header_name, std::string_view file_path, Result &result) override {
+        std::lock_guard lock{mutex_};
+        return includer_.require_header(header_name, file_path, result);
+    }
+
+    bool require_header(
+        std::string_view header_name, std::string_view file_path, HeaderForm form, Result &result
+    ) override {
+        std::lock_guard lock{mutex_};
+        return includer_.require_header(header_name, file_path, form, result);
+    }
+
+    void prefetch_header(std::string_view header_name, std::string_view file_path, HeaderForm form) override {
+        std::lock_guard lock{mutex_};
+        includer_.prefetch_header(header_name, file_path, form);
+    }
+
+private:
+    ShaderIncluder &includer_;
+    std::mutex mutex_;
+};
+
+struct Worker final {
+    Preprocessor preprocessor;
+    // indices of jobs, owner takes from front and thieves take from back
+    std::deque<size_t> jobs;
+    std::mutex jobs_mutex;
+    std::thread thread;
+};
+
+}
+
+struct PreprocessorPool::Impl final {
+    explicit Impl(size_t num_threads) {
+        if (num_threads == 0) {
+            num_threads = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+        }
+        workers.reserve(num_threads);
+        for (size_t i = 0; i < num_threads; i++) {
+            workers.push_back(std::make_unique<Worker>());
+        }
+        for (size_t i = 0; i < num_threads; i++) {
+            workers[i]->thread = std::thread{[this, i]() { worker_loop(i); }};
+        }
+    }
+
+    ~Impl() {
+        {
+            std::lock_guard lock{mutex};
+            stopping = true;
+        }
+        start_cv.notify_all();
+        for (auto &worker : workers) {
+            worker->thread.join();
+        }
+    }
+
+    std::vector<Preprocessor::Result> do_preprocess(std::span<const Job> jobs, ShaderIncluder &includer) {
+        std::vector<Preprocessor::Result> results(jobs.size());
+        if (jobs.empty()) {
+            return results;
+        }
+
+        SerializedIncluder serialized_includer{includer};
+        ShaderIncluder *shared_includer = &serialized_includer;
+        if (dynamic_cast<ConcurrentShaderIncluder *>(&includer)) {
+            shared_includer = &includer;
+        }
+        // neighbouring jobs usually share sources, keep them on the same worker
+        const auto num_workers = workers.size();
+        for (size_t i = 0; i < num_workers; i++) {
+            std::lock_guard lock{workers[i]->jobs_mutex};
+            for (size_t job = jobs.size() * i / num_workers; job < jobs.size() * (i + 1) / num_workers; job++) {
+                workers[i]->jobs.push_back(job);
+            }
+        }
+
+        {
+            std::unique_lock lock{mutex};
+            curr_jobs = jobs;
+            curr_includer = shared_includer;
+            curr_results = &results;
+            curr_error = nullptr;
+            num_running = num_workers;
+            ++generation;
+            start_cv.notify_all();
+            done_cv.wait(lock, [this]() { return num_running == 0; });
+        }
+
+        includer.clear();
+        if (curr_error) {
+            std::rethrow_exception(std::exchange(curr_error, nullptr));
+        }
+        return results;
+    }
+
+    void worker_loop(size_t index) {
+        size_t seen_generation = 0;
+        while (true) {
+            {
+                std::unique_lock lock{mutex};
+                start_cv.wait(lock, [this, seen_generation]() { return stopping || generation != seen_generation; });
+                if (stopping) { return; }
+                seen_generation = generation;
+            }
+
+            auto &preprocessor = workers[index]->preprocessor;
+            size_t job_index;
+            while (take_job(index, job_index)) {
+                const auto &job = curr_jobs[job_index];
+                try {
+                    (*curr_results)[job_index] = job.environment
+                        ? preprocessor.do_preprocess(
+                            job.input_path, job.input_content, *curr_includer, *job.environment,
+                            job.options, job.num_options
+                        )
+                        : preprocessor.do_preprocess(
+                            job.input_path, job.input_content, *curr_includer, job.options, job.num_options
+                        );
+                } catch (...) {
+                    std::lock_guard lock{mutex};
+                    if (!curr_error) { curr_error = std::current_exception(); }
+                }
+            }
+
+            std::lock_guard lock{mutex};
+            if (--num_running == 0) {
+                done_cv.notify_all();
+            }
+        }
+    }
+
+    // jobs are only added before workers start, so all queues are empty once this fails
+    bool take_job(size_t index, size_t &job) {
+        {
+            auto &own = *workers[index];
+            std::lock_guard lock{own.jobs_mutex};
+            if (!own.jobs.empty()) {
+                job = own.jobs.front();
+                own.jobs.pop_front();
+                return true;
+            }
+        }
+        for (size_t i = 1; i < workers.size(); i++) {
+            auto &victim = *workers[(index + i) % workers.size()];
+            std::lock_guard lock{victim.jobs_mutex};
+            if (!victim.jobs.empty()) {
+                job = victim.jobs.back();
+                victim.jobs.pop_back();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    std::vector<std::unique_ptr<Worker>> workers;
+
+    std::mutex mutex;
+    std::condition_variable start_cv;
+    std::condition_variable done_cv;
+    size_t generation = 0;
+    size_t num_running = 0;
+    bool stopping = false;
+
+    // states of current 'do_preprocess()', workers only read them
+    std::span<const Job> curr_jobs;
+    ShaderIncluder *curr_includer = nullptr;
+    std::vector<Preprocessor::Result> *curr_results = nullptr;
+    std::exception_ptr curr_error;
+};
+
+PreprocessorPool::PreprocessorPool(size_t num_threads) {
+    impl_ = new Impl{num_threads};
+}
+
+PreprocessorPool::~PreprocessorPool() {
+    if (impl_) { delete impl_; }
+}
+
+PreprocessorPool::PreprocessorPool(PreprocessorPool &&rhs) {
+    impl_ = rhs.impl_;
+    rhs.impl_ = nullptr;
+}
+
+PreprocessorPool &PreprocessorPool::operator=(PreprocessorPool &&rhs) {
+    if (impl_) { delete impl_; }
+    impl_ = rhs.impl_;
+    rhs.impl_ = nullptr;
+    return *this;
+}
+
+std::vector<Preprocessor::Result> PreprocessorPool::do_preprocess(std::span<const Job> jobs, ShaderIncluder &includer) {
+    return impl_->do_preprocess(jobs, includer);
+}
+
+size_t PreprocessorPool::num_threads() const {
+    return impl_->workers.size();
+}
+
+PEP_CPREP_NAMESPACE_END
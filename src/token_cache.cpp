@@ -0,0 +1,491 @@
+#include "token_cache.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <list>
+#include <mutex>
+#include <random>
+#include <unordered_map>
+
+#include <cprep/cprep.hpp>
+
+#include "lexed_file.hpp"
+#include "mapped_file.hpp"
+
+PEP_CPREP_NAMESPACE_BEGIN
+
+namespace {
+
+constexpr size_t kMaxLexedCacheBytes = 256 * 1024 * 1024;
+// every content seen gets an entry, most of them are one-off sources that are never lexed
+constexpr size_t kMaxLexedCacheEntries = 64 * 1024;
+
+std::shared_ptr<const LexedSource> minimize_lexed_source(const LexedSource &lexed);
+
+class LexedSourceCache final {
+public:
+    void set_directory(std::string_view directory) {
+        std::filesystem::path path{directory};
+        if (!path.empty()) {
+            std::error_code ec;
+            std::filesystem::create_directories(path, ec);
+        }
+        std::lock_guard lock{mutex_};
+        directory_ = std::move(path);
+    }
+
+    // lexed sources in use are shared, so they live on until their users drop them
+    void clear() {
+        std::lock_guard lock{mutex_};
+        entries_.clear();
+        lru_.clear();
+        cached_bytes_ = 0;
+    }
+
+    std::shared_ptr<const LexedSource> get(
+        std::string_view content, uint64_t content_hash, bool lex_now, bool persistent
+    ) {
+        std::string file_path{};
+        {
+            std::lock_guard lock{mutex_};
+            if (persistent && !directory_.empty()) {
+                file_path = (directory_ / lexed_file_name(content_hash, content.size())).string();
+                lex_now = true;
+            }
+            auto &entry = find_entry(content_hash, content.size());
+            if (entry.lexed || entry.tried) { return entry.lexed; }
+            // first sight, only remember it
+            if (!entry.seen && !lex_now) {
+                entry.seen = true;
+                return nullptr;
+            }
+            entry.seen = true;
+        }
+
+        auto lexed = load_or_lex(content, content_hash, file_path);
+
+        std::lock_guard lock{mutex_};
+        auto it = entries_.find(content_hash);
+        if (it == entries_.end() || it->second.content_size != content.size()) {
+            return lexed;
+        }
+        if (!it->second.tried) {
+            it->second.lexed = lexed;
+            it->second.tried = true;
+            if (lexed) { cached_bytes_ += lexed->memory_size(); }
+            evict();
+        }
+        return it->second.lexed;
+    }
+
+    // a cached lexed form is minimized without lexing again,
+    // otherwise the lexed form is dropped after it's minimized unless it's written to the directory
+    std::shared_ptr<const LexedSource> get_minimized(std::string_view content, uint64_t content_hash, bool persistent) {
+        std::string file_path{};
+        std::shared_ptr<const LexedSource> lexed{};
+        {
+            std::lock_guard lock{mutex_};
+            if (persistent && !directory_.empty()) {
+                file_path = (directory_ / lexed_file_name(content_hash, content.size())).string();
+            }
+            auto &entry = find_entry(content_hash, content.size());
+            entry.seen = true;
+            if (entry.minimized || entry.minimize_tried) { return entry.minimized; }
+            if (entry.tried && !entry.lexed) { return nullptr; }
+            lexed = entry.lexed;
+        }
+
+        if (!lexed) { lexed = load_or_lex(content, content_hash, file_path); }
+        auto minimized = lexed ? minimize_lexed_source(*lexed) : nullptr;
+
+        std::lock_guard lock{mutex_};
+        auto it = entries_.find(content_hash);
+        if (it == entries_.end() || it->second.content_size != content.size()) {
+            return minimized;
+        }
+        if (!it->second.minimize_tried) {
+            it->second.minimized = minimized;
+            it->second.minimize_tried = true;
+            if (minimized) { cached_bytes_ += minimized->memory_size(); }
+            evict();
+        }
+        return it->second.minimized;
+    }
+
+private:
+    struct Entry final {
+        size_t content_size;
+        std::list<uint64_t>::iterator lru_it;
+        std::shared_ptr<const LexedSource> lexed{};
+        std::shared_ptr<const LexedSource> minimized{};
+        bool seen = false;
+        // lexing has been tried, 'lexed' is nullptr if the content can't be replayed
+        bool tried = false;
+        bool minimize_tried = false;
+    };
+
+    // mutex must be held, the entry is moved to the front of lru list
+    Entry &find_entry(uint64_t content_hash, size_t content_size) {
+        auto it = entries_.find(content_hash);
+        if (it != entries_.end() && it->second.content_size == content_size) {
+            lru_.splice(lru_.begin(), lru_, it->second.lru_it);
+            return it->second;
+        }
+        if (it != entries_.end()) { erase(it); }
+        // the new entry goes to the front, so it's not evicted
+        lru_.push_front(content_hash);
+        auto &entry = entries_.insert({content_hash, Entry{content_size, lru_.begin()}}).first->second;
+        evict();
+        return entry;
+    }
+
+    void erase(std::unordered_map<uint64_t, Entry>::iterator it) {
+        if (it->second.lexed) { cached_bytes_ -= it->second.lexed->memory_size(); }
+        if (it->second.minimized) { cached_bytes_ -= it->second.minimized->memory_size(); }
+        lru_.erase(it->second.lru_it);
+        entries_.erase(it);
+    }
+
+    // 'file_path' is empty if the lexed form is not kept in the directory
+    static std::shared_ptr<const LexedSource> load_or_lex(
+        std::string_view content, uint64_t content_hash, const std::string &file_path
+    ) {
+        std::shared_ptr<const LexedSource> lexed{};
+        if (!file_path.empty()) {
+            if (auto file = MappedFile::open(file_path)) {
+                lexed = open_lexed_file(file->data(), file, content_hash, content.size());
+            }
+        }
+        if (!lexed) {
+            lexed = lex_source(content);
+            if (lexed && !file_path.empty()) { write_lexed_file_atomically(file_path, *lexed, content_hash, content.size()); }
+        }
+        return lexed;
+    }
+
+    void evict() {
+        while ((cached_bytes_ > kMaxLexedCacheBytes || entries_.size() > kMaxLexedCacheEntries) && !lru_.empty()) {
+            erase(entries_.find(lru_.back()));
+        }
+    }
+
+    static std::string lexed_file_name(uint64_t content_hash, size_t content_size) {
+        char name[48];
+        std::snprintf(
+            name, sizeof(name), "%016llx-%llx.lex",
+            static_cast<unsigned long long>(content_hash), static_cast<unsigned long long>(content_size)
+        );
+        return name;
+    }
+
+    // other processes may read the file at the same time, so it's written to a temporary file and renamed,
+    // failing to write it is not an error
+    static void write_lexed_file_atomically(
+        const std::string &path, const LexedSource &lexed, uint64_t content_hash, size_t content_size
+    ) {
+        // distinguishes writers from different processes
+        static const auto process_tag = std::random_device{}();
+        static std::atomic<uint64_t> counter{0};
+        auto temp_path = concat(path, ".tmp", process_tag, "-", ++counter);
+        {
+            std::ofstream fout(temp_path, std::ios::binary);
+            if (!fout) { return; }
+            const auto data = write_lexed_file(lexed, content_hash, content_size);
+            fout.write(data.data(), data.size());
+            if (!fout) {
+                fout.close();
+                std::error_code ec;
+                std::filesystem::remove(temp_path, ec);
+                return;
+            }
+        }
+        std::error_code ec;
+        std::filesystem::rename(temp_path, path, ec);
+        if (ec) { std::filesystem::remove(temp_path, ec); }
+    }
+
+    std::mutex mutex_;
+    std::filesystem::path directory_;
+    std::unordered_map<uint64_t, Entry> entries_;
+    std::list<uint64_t> lru_;
+    size_t cached_bytes_ = 0;
+};
+
+LexedSourceCache &lexed_source_cache() {
+    static LexedSourceCache cache{};
+    return cache;
+}
+
+}
+
+size_t LexedSource::lines_before(size_t index) const {
+    auto directive = std::upper_bound(directives.begin(), directives.end(), index) - directives.begin();
+    size_t lines = 0;
+    size_t start = 0;
+    if (index + 1 == num_tokens()) {
+        return directive_lines.back();
+    } else if (directive > 0) {
+        lines = directive_lines[directive - 1];
+        start = directives[directive - 1];
+    }
+    for (size_t i = start; i < index; i++) { lines += line_deltas[i]; }
+    return lines;
+}
+
+size_t LexedSource::memory_size() const {
+    return types.size() * (2 * sizeof(uint8_t) + 3 * sizeof(uint32_t))
+        + directives.size() * (3 * sizeof(uint32_t) + sizeof(DirectiveKind));
+}
+
+namespace {
+
+// arrays of a source lexed in memory, storage of its 'LexedSource'
+struct LexedArrays final {
+    std::vector<uint8_t> types;
+    std::vector<uint8_t> gap_flags;
+    std::vector<uint32_t> offsets;
+    std::vector<uint32_t> lengths;
+    std::vector<uint32_t> line_deltas;
+    std::vector<uint32_t> directives;
+    std::vector<LexedSource::DirectiveKind> directive_kinds;
+    std::vector<uint32_t> directive_ends;
+    std::vector<uint32_t> directive_lines;
+};
+
+std::shared_ptr<const LexedSource> make_lexed_source(std::shared_ptr<LexedArrays> arrays) {
+    auto lexed = std::make_shared<LexedSource>();
+    lexed->types = arrays->types;
+    lexed->gap_flags = arrays->gap_flags;
+    lexed->offsets = arrays->offsets;
+    lexed->lengths = arrays->lengths;
+    lexed->line_deltas = arrays->line_deltas;
+    lexed->directives = arrays->directives;
+    lexed->directive_kinds = arrays->directive_kinds;
+    lexed->directive_ends = arrays->directive_ends;
+    lexed->directive_lines = arrays->directive_lines;
+    lexed->storage = std::move(arrays);
+    return lexed;
+}
+
+std::shared_ptr<const LexedSource> minimize_lexed_source(const LexedSource &lexed) {
+    auto arrays = std::make_shared<LexedArrays>();
+    auto keep = [&](size_t index, uint8_t flags, uint32_t line_delta) {
+        arrays->types.push_back(lexed.types[index]);
+        arrays->gap_flags.push_back(flags);
+        arrays->offsets.push_back(lexed.offsets[index]);
+        arrays->lengths.push_back(lexed.lengths[index]);
+        arrays->line_deltas.push_back(line_delta);
+    };
+    const auto num_tokens = lexed.num_tokens();
+    size_t index = 0;
+    for (size_t directive = 0; directive <= lexed.directives.size(); directive++) {
+        const size_t next = directive < lexed.directives.size() ? lexed.directives[directive] : num_tokens - 1;
+        // tokens of other lines, the first one is kept so that they are still seen,
+        // e.g. they make a header not guarded by its include guard
+        if (index < next) {
+            keep(index, lexed.gap_flags[index], lexed.line_deltas[index]);
+            ++index;
+        }
+        uint8_t flags = lexed.gap_flags[next];
+        uint32_t line_delta = lexed.line_deltas[next];
+        if (index < next) {
+            flags &= ~LexedSource::eGapPlain;
+            for (; index < next; index++) {
+                flags |= lexed.gap_flags[index] & LexedSource::eGapNewLine;
+                line_delta += lexed.line_deltas[index];
+            }
+        }
+        if (directive < lexed.directives.size()) { arrays->directives.push_back(arrays->types.size()); }
+        keep(next, flags, line_delta);
+        ++index;
+        // rest of the directive line
+        while (index + 1 < num_tokens && !(lexed.gap_flags[index] & LexedSource::eGapLineStart)) {
+            keep(index, lexed.gap_flags[index], lexed.line_deltas[index]);
+            ++index;
+        }
+    }
+    // directives are not changed, so are their kinds,
+    // but lines of removed tokens are moved to whitespaces of the next kept token
+    arrays->directive_kinds.assign(lexed.directive_kinds.begin(), lexed.directive_kinds.end());
+    arrays->directive_ends.assign(lexed.directive_ends.begin(), lexed.directive_ends.end());
+    uint32_t num_lines = 0;
+    size_t directive = 0;
+    for (size_t i = 0; i < arrays->types.size(); i++) {
+        if (directive < arrays->directives.size() && arrays->directives[directive] == i) {
+            arrays->directive_lines.push_back(num_lines);
+            ++directive;
+        }
+        num_lines += arrays->line_deltas[i];
+    }
+    arrays->directive_lines.push_back(num_lines - arrays->line_deltas.back());
+    return make_lexed_source(std::move(arrays));
+}
+
+// find kinds of directives and match '#if' with '#endif', so that inactive branches can be skipped as a whole
+void index_directives(LexedArrays &lexed, std::string_view content) {
+    using DirectiveKind = LexedSource::DirectiveKind;
+    const auto num_directives = static_cast<uint32_t>(lexed.directives.size());
+    lexed.directive_kinds.resize(num_directives, DirectiveKind::eOther);
+    lexed.directive_ends.resize(num_directives, num_directives);
+    std::vector<uint32_t> if_stack{};
+    for (uint32_t i = 0; i < num_directives; i++) {
+        const auto name_index = lexed.directives[i] + 1;
+        const auto name_type = static_cast<TokenType>(lexed.types[name_index]);
+        auto &kind = lexed.directive_kinds[i];
+        if (name_type == TokenType::eEof || (lexed.gap_flags[name_index] & LexedSource::eGapLineStart)) {
+            kind = DirectiveKind::eOther;
+        } else if (name_type != TokenType::eIdentifier || lexed.line_deltas[name_index] != 0) {
+            kind = DirectiveKind::eInvalid;
+        } else {
+            const auto name = content.substr(lexed.offsets[name_index], lexed.lengths[name_index]);
+            if (name == "if" || name == "ifdef" || name == "ifndef") {
+                kind = DirectiveKind::eIf;
+            } else if (name == "else" || name.starts_with("elif")) {
+                kind = DirectiveKind::eElse;
+            } else if (name == "endif") {
+                kind = DirectiveKind::eEndif;
+            }
+        }
+
+        if (kind == DirectiveKind::eIf) {
+            if_stack.push_back(i);
+        } else if (kind == DirectiveKind::eEndif) {
+            if (!if_stack.empty()) {
+                lexed.directive_ends[if_stack.back()] = i;
+                if_stack.pop_back();
+            }
+        } else if (kind == DirectiveKind::eInvalid) {
+            // blocks containing it can't be skipped
+            if_stack.clear();
+        }
+    }
+}
+
+}
+
+std::shared_ptr<const LexedSource> lex_source(std::string_view content) {
+    if (content.size() >= std::numeric_limits<uint32_t>::max()) {
+        return nullptr;
+    }
+
+    auto arrays = std::make_shared<LexedArrays>();
+    InputState input{content};
+    std::string spaces{};
+    size_t gap_start = 0;
+    size_t num_lines = 0;
+    while (true) {
+        const auto lineno = input.get_lineno();
+        auto token = get_next_token(input, spaces, true, SpaceKeepType::eNothing);
+        if (token.type == TokenType::eUnknown) {
+            return nullptr;
+        }
+        const auto p_token = token.type == TokenType::eEof ? input.get_p_curr() : token.value.begin();
+        const auto offset = static_cast<size_t>(p_token - input.get_p_begin());
+        if (token.type != TokenType::eEof && input.get_p_curr() != token.value.end()) {
+            return nullptr;
+        }
+
+        uint8_t flags = LexedSource::eGapPlain;
+        for (auto ch : content.substr(gap_start, offset - gap_start)) {
+            if (ch == '\n') {
+                flags |= LexedSource::eGapNewLine;
+            } else if (ch != ' ') {
+                flags &= ~LexedSource::eGapPlain;
+            }
+        }
+        if (input.at_line_start()) {
+            flags |= LexedSource::eGapLineStart;
+            if (token.type == TokenType::eSharp) {
+                arrays->directives.push_back(static_cast<uint32_t>(arrays->types.size()));
+                arrays->directive_lines.push_back(static_cast<uint32_t>(num_lines));
+            }
+        }
+        if (token.type == TokenType::eEof) { arrays->directive_lines.push_back(static_cast<uint32_t>(num_lines)); }
+
+        arrays->types.push_back(static_cast<uint8_t>(token.type));
+        arrays->gap_flags.push_back(flags);
+        arrays->offsets.push_back(static_cast<uint32_t>(offset));
+        arrays->lengths.push_back(static_cast<uint32_t>(token.value.size()));
+        arrays->line_deltas.push_back(static_cast<uint32_t>(input.get_lineno() - lineno));
+        num_lines += arrays->line_deltas.back();
+
+        if (token.type == TokenType::eEof) { break; }
+        gap_start = offset + token.value.size();
+        // same as what preprocessor does after getting a token
+        input.set_line_start(false);
+    }
+    index_directives(*arrays, content);
+    return make_lexed_source(std::move(arrays));
+}
+
+std::shared_ptr<const LexedSource> get_lexed_source(
+    std::string_view content, uint64_t content_hash, bool lex_now, bool persistent
+) {
+    if (content_hash == 0) {
+        content_hash = hash_content(content);
+    }
+    return lexed_source_cache().get(content, content_hash, lex_now, persistent);
+}
+
+std::shared_ptr<const LexedSource> get_minimized_source(
+    std::string_view content, uint64_t content_hash, bool persistent
+) {
+    if (content_hash == 0) {
+        content_hash = hash_content(content);
+    }
+    return lexed_source_cache().get_minimized(content, content_hash, persistent);
+}
+
+void set_lexed_cache_directory(std::string_view directory) {
+    lexed_source_cache().set_directory(directory);
+}
+
+void clear_lexed_cache() {
+    lexed_source_cache().clear();
+}
+
+bool get_next_lexed_token(
+    InputState &input, std::string &output, bool space_cross_line, SpaceKeepType keep, Token &token
+) {
+    const auto &lexed = *input.get_lexed();
+    const auto offset = static_cast<size_t>(input.get_p_curr() - input.get_p_begin());
+    auto index = input.get_lexed_index();
+    if (index >= lexed.num_tokens() || lexed.gap_start(index) != offset) {
+        // input was moved by reading characters, find the token whose whitespaces start at current position
+        index = std::lower_bound(lexed.offsets.begin(), lexed.offsets.end(), offset) - lexed.offsets.begin();
+        if (index >= lexed.num_tokens() || lexed.gap_start(index) != offset) {
+            return false;
+        }
+    }
+
+    const auto flags = lexed.gap_flags[index];
+    const auto line_delta = lexed.line_deltas[index];
+    if (!space_cross_line && (flags & LexedSource::eGapNewLine)) {
+        return false;
+    }
+    const auto p_gap = input.get_p_begin() + offset;
+    const auto p_token = input.get_p_begin() + lexed.offsets[index];
+    if ((keep & SpaceKeepType::eSpace) != SpaceKeepType::eNothing) {
+        if (!(flags & LexedSource::eGapPlain)) { return false; }
+        if ((keep & SpaceKeepType::eNewLine) == SpaceKeepType::eNothing && line_delta != 0) { return false; }
+        output.append(p_gap, p_token);
+    } else if ((keep & SpaceKeepType::eBackSlash) != SpaceKeepType::eNothing) {
+        return false;
+    } else if ((keep & SpaceKeepType::eNewLine) != SpaceKeepType::eNothing) {
+        output.append(line_delta, '\n');
+    }
+
+    input.set_lineno(input.get_lineno() + line_delta);
+    if (flags & LexedSource::eGapLineStart) {
+        input.set_line_start(true);
+    }
+    const auto p_end = p_token + lexed.lengths[index];
+    input.set_p_curr(p_end, index + 1);
+    const auto type = static_cast<TokenType>(lexed.types[index]);
+    token = {type, type == TokenType::eEof ? std::string_view{} : make_string_view(p_token, p_end)};
+    return true;
+}
+
+PEP_CPREP_NAMESPACE_END
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <memory>
+#include <span>
+#include <vector>
+
+#include "tokenize.hpp"
+
+PEP_CPREP_NAMESPACE_BEGIN
+
+// lexed form of a whole source, stored as structure of arrays
+// the source content itself is not stored, offsets point into any content with the same bytes,
+// arrays are views into 'storage', which is either built by lexing or a mapped lexed file
+struct LexedSource final {
+    enum GapFlag : uint8_t {
+        // whitespaces before the token only consist of ' ' and '\n'
+        eGapPlain = 1,
+        // whitespaces before the token contain '\n'
+        eGapNewLine = 2,
+        // whitespaces before the token make the token start a line
+        eGapLineStart = 4,
+    };
+
+    std::span<const uint8_t> types;
+    std::span<const uint8_t> gap_flags;
+    std::span<const uint32_t> offsets;
+    std::span<const uint32_t> lengths;
+    // number of lines increased by whitespaces before the token
+    std::span<const uint32_t> line_deltas;
+    enum class DirectiveKind : uint8_t {
+        // '#' with nothing or an unconditional directive
+        eOther,
+        // 'if', 'ifdef', 'ifndef'
+        eIf,
+        // 'else', 'elif', 'elifdef', 'elifndef'
+        eElse,
+        eEndif,
+        // name of directive is not an identifier on the same line, it's an error even in inactive branch
+        eInvalid,
+    };
+
+    // indices of '#' tokens that start directive lines
+    std::span<const uint32_t> directives;
+    std::span<const DirectiveKind> directive_kinds;
+    // for '#if' directives, index (into 'directives') of the matching '#endif',
+    // 'directives.size()' if there is no matching one or there are invalid directives in between
+    std::span<const uint32_t> directive_ends;
+    // number of lines before whitespaces of each '#' token, followed by that of the eof token
+    std::span<const uint32_t> directive_lines;
+
+    std::shared_ptr<const void> storage;
+
+    size_t num_tokens() const { return types.size(); }
+    size_t gap_start(size_t index) const { return index == 0 ? 0 : offsets[index - 1] + lengths[index - 1]; }
+    // number of lines before whitespaces of the token, counted from the nearest directive before it
+    size_t lines_before(size_t index) const;
+    size_t memory_size() const;
+};
+
+// returns nullptr if the content can't be replayed from lexed form (e.g. there are invalid tokens)
+std::shared_ptr<const LexedSource> lex_source(std::string_view content);
+
+// lexed sources are shared by all preprocessors in the process and keyed by content hash,
+// a content is lexed when it is seen for the second time, so that one-off sources don't pay for lexing,
+// 'lex_now' lexes it at first sight, e.g. when the content is known to be used many times,
+// a 'persistent' one is also read from and written to the directory set by 'set_lexed_cache_directory()',
+// it's lexed at first sight since later processes will use it
+std::shared_ptr<const LexedSource> get_lexed_source(
+    std::string_view content, uint64_t content_hash = 0, bool lex_now = false, bool persistent = false
+);
+
+// minimized form only keeps tokens of directive lines and the first token of each run of other lines,
+// line numbers of removed lines are folded into the next kept token,
+// so that code is skipped at once when only directives are needed, e.g. during a scan,
+// it's built at first sight and kept in the same cache as lexed sources
+std::shared_ptr<const LexedSource> get_minimized_source(
+    std::string_view content, uint64_t content_hash = 0, bool persistent = false
+);
+
+// replay the next token of 'input' from its lexed form,
+// returns false if the token must be scanned from input (e.g. input was moved by reading characters)
+bool get_next_lexed_token(
+    InputState &input, std::string &output, bool space_cross_line, SpaceKeepType keep, Token &token
+);
+
+PEP_CPREP_NAMESPACE_END
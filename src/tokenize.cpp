@@ -3,6 +3,7 @@
 #include <cstring>
 #include <string>
 
+#include "token_cache.hpp"
 #include "unicode_ident.hpp"
 
 PEP_CPREP_NAMESPACE_BEGIN
@@ -26,6 +27,11 @@ bool is_digit(int ch) {
 }
 
 Token get_next_token(InputState &input, std::string &output, bool space_cross_line, SpaceKeepType keep) {
+    if (input.get_lexed()) {
+        Token token{};
+        if (get_next_lexed_token(input, output, space_cross_line, keep, token)) { return token; }
+    }
+
     // skip whitespaces and comments
     auto first_ch = input.get_next_ch();
     bool in_ml_comment = false;
@@ -656,6 +656,8 @@ constexpr uint8_t LEAF[] = {
 }
 
 bool is_xid_start(int ch) {
+    // eof and invalid character
+    if (ch < 0) { return false; }
     if (ch < 128) { return ASCII_START[ch]; }
     auto chunk_index = ch / 8 / CHUNK;
     auto chunk = chunk_index < (sizeof(TRIE_START) / sizeof(TRIE_START[0])) ? TRIE_START[chunk_index] : 0;
@@ -664,6 +666,8 @@ bool is_xid_start(int ch) {
 }
 
 bool is_xid_continue(int ch) {
+    // eof and invalid character
+    if (ch < 0) { return false; }
     if (ch < 128) { return ASCII_CONTINUE[ch]; }
     auto chunk_index = ch / 8 / CHUNK;
     auto chunk = chunk_index < (sizeof(TRIE_CONTINUE) / sizeof(TRIE_CONTINUE[0])) ? TRIE_CONTINUE[chunk_index] : 0;
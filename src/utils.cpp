@@ -1,5 +1,9 @@
 #include "utils.hpp"
 
+#include <cstring>
+
+#include <cprep/cprep.hpp>
+
 PEP_CPREP_NAMESPACE_BEGIN
 
 namespace {
@@ -38,6 +42,28 @@ int get_char_from_it(const std::string_view::const_iterator it) {
     return kCharInvaliad;
 }
 
+uint64_t mix_hash(uint64_t h) {
+    h ^= h >> 32;
+    h *= 0xd6e8feb86659fd93ull;
+    h ^= h >> 32;
+    return h;
+}
+
+}
+
+uint64_t hash_content(std::string_view content) {
+    constexpr uint64_t kMul = 0x9e3779b97f4a7c15ull;
+    uint64_t h = 0xcbf29ce484222325ull ^ (content.size() * kMul);
+    size_t i = 0;
+    for (; i + 8 <= content.size(); i += 8) {
+        uint64_t v;
+        std::memcpy(&v, content.data() + i, 8);
+        h = mix_hash(h ^ (v * kMul));
+    }
+    uint64_t tail = 0;
+    if (i < content.size()) { std::memcpy(&tail, content.data() + i, content.size() - i); }
+    h = mix_hash(h ^ (tail * kMul) ^ (content.size() - i));
+    return h == 0 ? 1 : h;
 }
 
 int InputState::look_next_ch() const {
@@ -35,7 +35,7 @@ constexpr std::string_view make_string_view(It first, End last) {
 
 
 template <size_t Size>
-size_t string_length_of(const char (&s)[Size]) { return Size; }
+size_t string_length_of(const char (&)[Size]) { return Size; }
 inline size_t string_length_of(std::string_view s) { return s.size(); }
 inline size_t string_length_of(const std::string &s) { return s.size(); }
 inline size_t string_length_of(std::string &&s) { return s.size(); }
@@ -60,21 +60,41 @@ std::string concat(Args &&... args) {
 }
 
 
+// for heterogeneous lookup of string keyed unordered containers
+struct StringHash final {
+    using is_transparent = void;
+    size_t operator()(std::string_view s) const { return std::hash<std::string_view>{}(s); }
+};
+
+
+struct LexedSource;
+
 class InputState final {
 public:
-    InputState(std::string_view str) : p_curr_(str.begin()), p_end_(str.end()) {}
+    InputState(std::string_view str, const LexedSource *lexed = nullptr)
+        : p_begin_(str.begin()), p_curr_(str.begin()), p_end_(str.end()), lexed_(lexed) {}
 
+    auto get_p_begin() const { return p_begin_; }
     auto get_p_curr() const { return p_curr_; }
     auto get_p_end() const { return p_end_; }
     auto get_lineno() const { return lineno_; }
     auto get_column() const { return col_; }
     auto at_line_start() const { return line_start_; }
 
+    // lexed form of the whole input, tokens can be replayed from it instead of being scanned again
+    auto get_lexed() const { return lexed_; }
+    auto get_lexed_index() const { return lexed_index_; }
+
     bool is_end() const { return p_curr_ == p_end_; }
 
     void increase_lineno() { ++lineno_; col_ = 0; }
     void set_lineno(size_t lineno) { lineno_ = lineno; }
     void set_line_start(bool line_start) { line_start_ = line_start; }
+    // used when replaying lexed tokens, 'p_curr' must point into the same input
+    void set_p_curr(std::string_view::const_iterator p_curr, size_t lexed_index) {
+        p_curr_ = p_curr;
+        lexed_index_ = lexed_index;
+    }
 
     int look_next_ch() const;
     int look_next_ch(size_t offset) const;
@@ -91,11 +111,14 @@ public:
     std::string_view get_substr_to_curr(std::string_view::const_iterator p_start) const;
 
 private:
+    std::string_view::const_iterator p_begin_{};
     std::string_view::const_iterator p_curr_{};
     std::string_view::const_iterator p_end_{};
     size_t lineno_ = 1;
     size_t col_ = 0;
     bool line_start_ = true;
+    const LexedSource *lexed_ = nullptr;
+    size_t lexed_index_ = 0;
 };
 
 PEP_CPREP_NAMESPACE_END
@@ -1,6 +1,8 @@
 #pragma once
 
+#include <filesystem>
 #include <iostream>
+#include <random>
 
 #include <cprep/cprep.hpp>
 
@@ -26,6 +28,13 @@ inline bool expect_ok(
 ) {
     auto result = preprocessor.do_preprocess("/test.cpp", in_src, includer, options, num_options);
     auto pass = result.parsed_result == expected && result.error.empty() && result.warning.empty();
+    // sources seen before are replayed from cached tokens, result should not change
+    for (int i = 0; i < 2 && pass; i++) {
+        auto result_again = preprocessor.do_preprocess("/test.cpp", in_src, includer, options, num_options);
+        pass = result_again.parsed_result == result.parsed_result
+            && result_again.error == result.error && result_again.warning == result.warning;
+        if (!pass) { result = std::move(result_again); }
+    }
     if (!pass) {
         std::cout << "expected ('@' marks the end of line):\n" << show_space(expected)
             << "\nget ('@' marks the end of line):\n" << show_space(result.parsed_result)
@@ -35,3 +44,13 @@ inline bool expect_ok(
     }
     return pass;
 }
+
+// a new directory under the temporary directory, so that tests running at the same time don't share files
+inline std::filesystem::path make_temp_directory(std::string_view prefix) {
+    std::random_device device{};
+    while (true) {
+        auto tag = (static_cast<uint64_t>(device()) << 32) | device();
+        auto path = std::filesystem::temp_directory_path() / (std::string{prefix} + "-" + std::to_string(tag));
+        if (std::filesystem::create_directory(path)) { return path; }
+    }
+}
@@ -0,0 +1,3 @@
+#include "a.hpp"
+#include "../c.hpp"
+const char *b = "\t\"b\"";
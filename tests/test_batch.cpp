@@ -0,0 +1,342 @@
+#include <tuple>
+#include <unordered_set>
+
+#include "common.hpp"
+
+class TestIncluder final : public pep::cprep::ShaderIncluder {
+public:
+    bool require_header(std::string_view header_name, std::string_view /*file_path*/, Result &result) override {
+        if (header_name == "fog.hpp") {
+            result.header_path = "/fog.hpp";
+            result.header_content = "#ifndef FOG_HPP_\n#define FOG_HPP_\n#define FOG_DENSITY QUALITY\n#endif\n";
+            return true;
+        }
+        if (header_name == "light.hpp") {
+            ++num_required;
+            result.header_path = "/light.hpp";
+            result.header_content =
+R"(#pragma once
+#if NUM_LIGHTS > 1
+#define LIGHT_LOOP 1
+#else
+# if 0
+#  error never
+# endif
+#endif
+)";
+            return true;
+        }
+        return false;
+    }
+
+    size_t num_required = 0;
+};
+
+bool test1(pep::cprep::Preprocessor &preprocessor, TestIncluder &includer) {
+    auto in_src =
+R"(#include "light.hpp"
+#ifdef LIGHT_LOOP
+for (int i = 0; i < NUM_LIGHTS; i++) {}
+#elif defined(SHADOW)
+# ifdef SOFT_SHADOW
+soft_shadow();
+# else
+shadow();
+# endif
+#else
+#  12 not a directive
+#endif
+)";
+
+    std::string_view options1[] = {"-DNUM_LIGHTS=4"};
+    std::string_view options2[] = {"-DNUM_LIGHTS=1", "-DSHADOW", "-DSOFT_SHADOW"};
+    std::string_view options3[] = {"-DNUM_LIGHTS=1", "-D", "SHADOW"};
+    std::string_view options4[] = {"-DNUM_LIGHTS=1"};
+    pep::cprep::Preprocessor::OptionSet option_sets[] = {
+        {options1, std::size(options1)},
+        {options2, std::size(options2)},
+        {options3, std::size(options3)},
+        {options4, std::size(options4)},
+    };
+
+    includer.num_required = 0;
+    auto results = preprocessor.do_preprocess_batch("/test.cpp", in_src, includer, option_sets);
+    auto pass = results.size() == std::size(option_sets);
+    // each result is the same as preprocessing it alone
+    for (size_t i = 0; i < results.size() && pass; i++) {
+        pep::cprep::Preprocessor single{};
+        TestIncluder single_includer{};
+        auto expected = single.do_preprocess(
+            "/test.cpp", in_src, single_includer, option_sets[i].options, option_sets[i].num_options
+        );
+        if (results[i].parsed_result != expected.parsed_result || results[i].error != expected.error) {
+            std::cout << "result " << i << " of batch differs, expected:\n" << show_space(expected.parsed_result)
+                << expected.error << "\nget:\n" << show_space(results[i].parsed_result) << results[i].error
+                << std::endl;
+            pass = false;
+        }
+    }
+    // header is loaded once for the whole batch
+    if (includer.num_required != 1) {
+        std::cout << "includer is called " << includer.num_required << " times for 'light.hpp'" << std::endl;
+        pass = false;
+    }
+    return pass;
+}
+
+bool test2(pep::cprep::Preprocessor &preprocessor, TestIncluder &includer) {
+    auto in_src =
+R"(#ifdef USE_FOG
+fog();
+#endif
+#if QUALITY > 1
+hq();
+#endif
+)";
+
+    std::string_view options1[] = {"-DQUALITY=2", "-DUNUSED=1"};
+    std::string_view options2[] = {"-DQUALITY=2", "-DUNUSED=2"};
+    std::string_view options3[] = {"-DQUALITY=1", "-DUSE_FOG"};
+    pep::cprep::Preprocessor::OptionSet option_sets[] = {
+        {options1, std::size(options1)},
+        {options2, std::size(options2)},
+        {options3, std::size(options3)},
+    };
+    auto results = preprocessor.do_preprocess_batch("/test.cpp", in_src, includer, option_sets);
+
+    auto pass = true;
+    // 'UNUSED' is never tested, 'fog' is in inactive branch and no option sets 'hq'
+    const std::vector<std::tuple<std::string_view, bool, std::string_view>> expected_dependencies{
+        {"QUALITY", true, "2"},
+        {"USE_FOG", false, ""},
+    };
+    const auto &dependencies = results[0].macro_dependencies;
+    pass &= dependencies.size() == expected_dependencies.size();
+    for (size_t i = 0; i < dependencies.size() && pass; i++) {
+        const auto &[name, defined, value] = expected_dependencies[i];
+        pass &= dependencies[i].name == name && dependencies[i].defined == defined && dependencies[i].value == value;
+    }
+    if (!pass) {
+        std::cout << "macro dependencies:" << std::endl;
+        for (const auto &dependency : dependencies) {
+            std::cout << "  " << dependency.name << (dependency.defined ? " = " + dependency.value : "") << std::endl;
+        }
+    }
+    if (results[1].parsed_result != results[0].parsed_result || results[2].parsed_result != "\nfog();\n\n\n\n\n") {
+        std::cout << "unexpected results:\n" << show_space(results[1].parsed_result)
+            << "\n" << show_space(results[2].parsed_result) << std::endl;
+        pass = false;
+    }
+    return pass;
+}
+
+// each result of a batch must be the same as preprocessing the option set alone
+bool expect_same_as_single(
+    pep::cprep::Preprocessor &preprocessor, pep::cprep::ShaderIncluder &includer, std::string_view in_src,
+    const std::vector<std::vector<std::string>> &option_strings
+) {
+    std::vector<std::vector<std::string_view>> options{};
+    std::vector<pep::cprep::Preprocessor::OptionSet> option_sets{};
+    for (const auto &strings : option_strings) {
+        options.emplace_back(strings.begin(), strings.end());
+    }
+    for (const auto &option : options) {
+        option_sets.push_back({option.data(), option.size()});
+    }
+
+    // a batch result also depends on macros set by other option sets
+    std::unordered_set<std::string> option_names{};
+    for (const auto &strings : option_strings) {
+        for (size_t i = 0; i < strings.size(); i++) {
+            if (!strings[i].starts_with("-D") && !strings[i].starts_with("-U")) { continue; }
+            auto name = strings[i].size() > 2 || i + 1 == strings.size() ? strings[i].substr(2) : strings[i + 1];
+            option_names.insert(name.substr(0, name.find_first_of("=(")));
+        }
+    }
+
+    auto results = preprocessor.do_preprocess_batch("/test.cpp", in_src, includer, option_sets);
+    auto pass = results.size() == option_sets.size();
+    for (size_t i = 0; i < results.size() && pass; i++) {
+        pep::cprep::Preprocessor single{};
+        TestIncluder single_includer{};
+        auto expected = single.do_preprocess(
+            "/test.cpp", in_src, single_includer, option_sets[i].options, option_sets[i].num_options
+        );
+        auto same_dependencies = true;
+        size_t j = 0;
+        for (const auto &a : results[i].macro_dependencies) {
+            if (j < expected.macro_dependencies.size() && a.name == expected.macro_dependencies[j].name) {
+                const auto &b = expected.macro_dependencies[j++];
+                same_dependencies &= a.defined == b.defined && a.value == b.value;
+            } else {
+                same_dependencies &= option_names.contains(a.name);
+            }
+        }
+        same_dependencies &= j == expected.macro_dependencies.size();
+        auto same_includes = results[i].includes.size() == expected.includes.size();
+        for (size_t j = 0; j < expected.includes.size() && same_includes; j++) {
+            const auto &a = results[i].includes[j];
+            const auto &b = expected.includes[j];
+            same_includes = a.header_name == b.header_name && a.including_path == b.including_path
+                && a.header_path == b.header_path;
+        }
+        if (
+            results[i].parsed_result != expected.parsed_result || results[i].error != expected.error
+            || results[i].warning != expected.warning || !same_dependencies || !same_includes
+        ) {
+            std::cout << "result " << i << " of batch differs, expected:\n" << show_space(expected.parsed_result)
+                << expected.error << expected.warning << "\nget:\n" << show_space(results[i].parsed_result)
+                << results[i].error << results[i].warning << std::endl;
+            pass = false;
+        }
+    }
+    return pass;
+}
+
+bool test3(pep::cprep::Preprocessor &preprocessor, TestIncluder &includer) {
+    auto in_src =
+R"(#ifdef USE_FOG
+#include "fog.hpp"
+#endif
+#if QUALITY > 1 && defined(USE_SHADOW)
+#define SHADOW_TAPS (QUALITY * 4)
+#elif QUALITY > 0
+#define SHADOW_TAPS QUALITY
+#endif
+#include "fog.hpp"
+#ifdef SHADOW_TAPS
+for (int i = 0; i < SHADOW_TAPS; i++) { sample(i, __LINE__); }
+#else
+no_shadow();
+#endif
+float fog = FOG_DENSITY;
+float scale = SCALE(QUALITY,
+    2);
+)";
+
+    // every combination of 3 qualities, 2 flags and 2 definitions of 'SCALE'
+    std::vector<std::vector<std::string>> option_strings{};
+    for (int i = 0; i < 24; i++) {
+        auto &strings = option_strings.emplace_back();
+        strings.push_back("-DQUALITY=" + std::to_string(i % 3));
+        if (i / 3 % 2) { strings.push_back("-DUSE_FOG"); }
+        if (i / 6 % 2) { strings.push_back("-DUSE_SHADOW"); }
+        strings.push_back(i / 12 ? "-DSCALE(a, b)=a * b" : "-DSCALE(a, b)=a + b");
+    }
+    // variants are preprocessed together, each result is still the same as preprocessing it alone
+    return expect_same_as_single(preprocessor, includer, in_src, option_strings);
+}
+
+bool test4(pep::cprep::Preprocessor &preprocessor, TestIncluder &includer) {
+    auto in_src =
+R"(#pragma unroll
+#if QUALITY > 2
+#error unsupported quality
+#elif QUALITY == 2
+#warning slow path
+#endif
+#ifdef USE_FOG
+#line 100 "fog.cpp"
+#endif
+int line = __LINE__;
+#ifdef USE_SHADOW
+#include "missing.hpp"
+#endif
+)";
+
+    std::vector<std::vector<std::string>> option_strings{};
+    for (int i = 0; i < 16; i++) {
+        auto &strings = option_strings.emplace_back();
+        strings.push_back("-DQUALITY=" + std::to_string(i % 4));
+        if (i / 4 % 2) { strings.push_back("-DUSE_FOG"); }
+        if (i / 8) { strings.push_back("-DUSE_SHADOW"); }
+    }
+    // errors and warnings belong to some of variants, '#line' in some of them splits the batch
+    return expect_same_as_single(preprocessor, includer, in_src, option_strings);
+}
+
+bool test5(pep::cprep::Preprocessor &preprocessor, TestIncluder &includer) {
+    // a function-like macro name in a condition looks ahead for '(' past the end of line,
+    // where lanes may see different directives
+    auto in_src1 = "#define E(x) x\n#if D\n#elif E\n#define INC 1\n#endif\nint a;\n";
+    std::vector<std::vector<std::string>> option_strings1{{"-DD=0"}, {"-DD=0", "-DA=1"}};
+    auto in_src2 = "#define D(x) x\n#if defined(A) && D\n#endif\nint b;\n";
+    std::vector<std::vector<std::string>> option_strings2{{"-DA"}, {"-DA", "-DD=2"}, {}};
+    auto in_src4 = "#define D(x) x\n#if defined(A) && D\n#endif";
+    auto in_src3 = "#define F(x) x\n#if F\n(1)\n#endif\nint c;\n";
+    std::vector<std::vector<std::string>> option_strings3{{}, {"-DF=1"}};
+
+    auto pass = true;
+    pass &= expect_same_as_single(preprocessor, includer, in_src1, option_strings1);
+    pass &= expect_same_as_single(preprocessor, includer, in_src2, option_strings2);
+    pass &= expect_same_as_single(preprocessor, includer, in_src3, option_strings3);
+    pass &= expect_same_as_single(preprocessor, includer, in_src4, option_strings2);
+    return pass;
+}
+
+bool test6(pep::cprep::Preprocessor &preprocessor, TestIncluder &includer) {
+    auto in_src =
+R"(#ifdef A
+#endif
+#if defined(B) && C > 1
+#elif D
+#endif
+#define F(x) x
+float int main return x __LINE__ F(y) H;
+)";
+    std::string_view options[] = {"-DH=1"};
+    auto result = preprocessor.do_preprocess("/test.cpp", in_src, includer, options, std::size(options));
+
+    // names tested by directives, set by options or expanded as builtins, not every identifier read
+    std::vector<std::string> expected{"A", "B", "C", "D", "H", "__LINE__"};
+    std::vector<std::string> names{};
+    for (const auto &dependency : result.macro_dependencies) { names.push_back(dependency.name); }
+    if (names != expected) {
+        std::cout << "macro dependencies:" << std::endl;
+        for (const auto &name : names) { std::cout << "  " << name << std::endl; }
+        return false;
+    }
+    return true;
+}
+
+bool test7(pep::cprep::Preprocessor &preprocessor, TestIncluder &includer) {
+    // an unterminated literal in a branch skipped by some lanes runs to the end of file,
+    // swallowing '#endif', so it's an unterminated conditional directive as in single runs
+    std::vector<std::string_view> in_srcs{
+        "#ifdef A\nchar c = 'x;\n#else\nint b;\n#endif\nint a;\n",
+        "#ifndef A\nconst char *s = \"abc;\n#endif\nint a;\n",
+        "#if A\n#elif \"B\n#endif\nint a;\n",
+        "#ifdef A\nR\"x(abc\n#endif\nint a;\n",
+        "#ifdef A\nint x = 1;\n#else\nchar *s = \"abc\\\n#endif\nint a;\n",
+    };
+    std::vector<std::vector<std::string>> option_strings{{}, {"-DA=1"}, {"-DA=0"}};
+
+    auto pass = true;
+    for (auto in_src : in_srcs) {
+        pass &= expect_same_as_single(preprocessor, includer, in_src, option_strings);
+    }
+    std::vector<std::string_view> options[] = {{}, {"-DA=1"}};
+    pep::cprep::Preprocessor::OptionSet option_sets[] = {{options[0].data(), 0}, {options[1].data(), 1}};
+    auto results = preprocessor.do_preprocess_batch("/test.cpp", in_srcs[1], includer, option_sets);
+    for (const auto &result : results) {
+        pass &= result.error.find("unterminated conditional directive") != std::string::npos;
+    }
+    return pass;
+}
+
+int main() {
+    pep::cprep::Preprocessor preprocessor{};
+    TestIncluder includer{};
+
+    auto pass = true;
+
+    pass &= test1(preprocessor, includer);
+    pass &= test2(preprocessor, includer);
+    pass &= test3(preprocessor, includer);
+    pass &= test4(preprocessor, includer);
+    pass &= test5(preprocessor, includer);
+    pass &= test6(preprocessor, includer);
+    pass &= test7(preprocessor, includer);
+
+    return pass ? 0 : 1;
+}
@@ -0,0 +1,76 @@
+#include <cprep/embedded_includer.hpp>
+
+#include "common.hpp"
+
+// generated from 'tests/embedded' by 'cprep_embed_headers()'
+namespace cprep_test {
+extern const pep::cprep::EmbeddedHeaderSet embedded_headers;
+}
+
+bool test1(pep::cprep::Preprocessor &preprocessor, pep::cprep::ShaderIncluder &includer) {
+    auto in_src =
+R"(#include <sub/b.hpp>
+#include "./sub/../a.hpp"
+#if __has_include(<readme.txt>) || __has_include(</a.hpp>) || !__has_include(<sub/a.hpp>)
+int d;
+#endif
+)";
+    auto expected =
+R"(#line 1 "sub/b.hpp"
+#line 1 "sub/a.hpp"
+
+int sub_a;
+
+#line 2 "sub/b.hpp"
+#line 1 "c.hpp"
+int c;
+
+#line 3 "sub/b.hpp"
+const char *b = "\t\"b\"";
+
+#line 2 "/test.cpp"
+#line 1 "a.hpp"
+
+int a;
+
+#line 3 "/test.cpp"
+
+
+
+)";
+    return expect_ok(preprocessor, includer, in_src, expected, nullptr, 0);
+}
+
+bool test2() {
+    auto pass = true;
+    pass &= cprep_test::embedded_headers.num_headers == 4;
+    // headers of generated source are the same as those given
+    auto source = pep::cprep::EmbeddedShaderIncluder::generate_source(
+        {{"a.hpp", "int a;\n"}, {"b\\c.hpp", "\x01\x7f\"\\\n"}, {"a.hpp", "int another_a;\n"}}, "x::y::headers"
+    );
+    pass &= source.find("std::string_view{\"a.hpp\", 5}") != std::string::npos
+        && source.find("std::string_view{\"b/c.hpp\", 7}") != std::string::npos
+        && source.find("std::string_view{\"\\001\\177\\\"\\\\\\n\", 5}") != std::string::npos
+        && source.find("another_a") == std::string::npos
+        && source.find("namespace x::y {") != std::string::npos;
+    if (!pass) {
+        std::cout << "unexpected generated source:\n" << source << std::endl;
+    }
+
+    pep::cprep::EmbeddedShaderIncluder empty_includer{{}};
+    pep::cprep::ShaderIncluder::Result result{};
+    pass &= !empty_includer.require_header("a.hpp", "/test.cpp", result);
+    return pass;
+}
+
+int main() {
+    pep::cprep::Preprocessor preprocessor{};
+    pep::cprep::EmbeddedShaderIncluder includer{cprep_test::embedded_headers};
+
+    auto pass = true;
+
+    pass &= test1(preprocessor, includer);
+    pass &= test2();
+
+    return pass ? 0 : 1;
+}
@@ -0,0 +1,203 @@
+#include "common.hpp"
+
+class TestIncluder final : public pep::cprep::ShaderIncluder {
+public:
+    bool require_header(std::string_view header_name, std::string_view /*file_path*/, Result &result) override {
+        if (header_name == "math.hpp") {
+            result.header_path = "/math.hpp";
+            result.header_content = "#pragma once\n#define LERP(a, b, t) ((a) + ((b) - (a)) * (t))\n";
+            return true;
+        }
+        if (header_name == "guarded.hpp") {
+            result.header_path = "/guarded.hpp";
+            result.header_content = "#ifndef GUARDED_HPP\n#define GUARDED_HPP\nint guarded;\n#endif\n";
+            return true;
+        }
+        if (header_name == "once.hpp") {
+            result.header_path = "/once.hpp";
+            result.header_content = "#pragma once\nint once;\n";
+            return true;
+        }
+        return false;
+    }
+};
+
+bool expect_same(
+    const pep::cprep::Preprocessor::Result &result, const pep::cprep::Preprocessor::Result &expected
+) {
+    auto same_dependencies = result.macro_dependencies.size() == expected.macro_dependencies.size();
+    for (size_t i = 0; i < expected.macro_dependencies.size() && same_dependencies; i++) {
+        const auto &a = result.macro_dependencies[i];
+        const auto &b = expected.macro_dependencies[i];
+        same_dependencies = a.name == b.name && a.defined == b.defined && a.value == b.value;
+    }
+    if (result.parsed_result != expected.parsed_result || result.error != expected.error || !same_dependencies) {
+        std::cout << "expected ('@' marks the end of line):\n" << show_space(expected.parsed_result) << expected.error
+            << "\nget ('@' marks the end of line):\n" << show_space(result.parsed_result) << result.error << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool test1(pep::cprep::Preprocessor &preprocessor, pep::cprep::ShaderIncluder &includer) {
+    auto in_src =
+R"(#if QUALITY > 1
+int taps = TAPS;
+#endif
+#ifdef USE_FOG
+fog();
+#endif
+#undef TAPS
+#define TAPS 1
+int taps_after = TAPS;
+)";
+
+    std::string_view base_options[]{"-DQUALITY=2", "-DTAPS=8", "-DUSE_FOG", "-DUNUSED=0"};
+    pep::cprep::MacroEnvironment base{base_options, 4};
+    std::string_view variant_options[]{"-DQUALITY=1", "-UUSE_FOG"};
+    auto variant = base.derive(variant_options, 2);
+
+    auto pass = base.is_defined("USE_FOG") && !variant.is_defined("USE_FOG") && variant.is_defined("TAPS");
+    if (!pass) { std::cout << "unexpected macros in environments" << std::endl; }
+
+    // environment gives the same result as the options it's built from
+    pass &= expect_same(
+        preprocessor.do_preprocess("/test.cpp", in_src, includer, base),
+        preprocessor.do_preprocess("/test.cpp", in_src, includer, base_options, 4)
+    );
+    std::string_view all_options[]{"-DQUALITY=1", "-DTAPS=8", "-DUNUSED=0"};
+    pass &= expect_same(
+        preprocessor.do_preprocess("/test.cpp", in_src, includer, variant),
+        preprocessor.do_preprocess("/test.cpp", in_src, includer, all_options, 3)
+    );
+    // options on top of an environment
+    std::string_view extra_options[]{"-UQUALITY", "-DUSE_FOG=1"};
+    std::string_view extra_all_options[]{"-DTAPS=8", "-DUSE_FOG=1", "-DUNUSED=0"};
+    pass &= expect_same(
+        preprocessor.do_preprocess("/test.cpp", in_src, includer, variant, extra_options, 2),
+        preprocessor.do_preprocess("/test.cpp", in_src, includer, extra_all_options, 3)
+    );
+
+    // environment is not changed by the source
+    pass &= expect_same(
+        preprocessor.do_preprocess("/test.cpp", in_src, includer, base),
+        preprocessor.do_preprocess("/test.cpp", in_src, includer, base_options, 4)
+    );
+    return pass;
+}
+
+bool test2(pep::cprep::Preprocessor &preprocessor, pep::cprep::ShaderIncluder &includer) {
+    auto prelude =
+R"(#include "math.hpp"
+#define MIX(t) LERP(LOW, HIGH, t)
+#undef REMOVED
+)";
+    auto in_src =
+R"(#ifdef REMOVED
+removed();
+#endif
+float v = MIX(0.5);
+)";
+    auto expected =
+R"(
+
+
+float v = ((0) + ((QUALITY) - (0)) * (0.5));
+)";
+
+    std::string_view options[]{"-DLOW=0", "-DHIGH=QUALITY", "-DREMOVED"};
+    pep::cprep::MacroEnvironment base{options, 3};
+    pep::cprep::Preprocessor::Result prelude_result{};
+    auto environment = preprocessor.do_preprocess_prelude("/prelude.hpp", prelude, includer, base, &prelude_result);
+    auto pass = prelude_result.error.empty() && prelude_result.warning.empty()
+        && environment.is_defined("LERP") && !environment.is_defined("REMOVED") && base.is_defined("REMOVED");
+
+    // derived many times, macros are kept when layers are flattened
+    for (int i = 0; i < 20; i++) {
+        auto option = "-DLEVEL_" + std::to_string(i);
+        std::string_view derive_options[]{option};
+        environment = environment.derive(derive_options, 1);
+    }
+    pass &= environment.is_defined("LERP") && environment.is_defined("LEVEL_0") && environment.is_defined("LEVEL_19");
+    if (!pass) { std::cout << "unexpected macros in environment from prelude" << std::endl; }
+
+    auto result = preprocessor.do_preprocess("/test.cpp", in_src, includer, environment);
+    if (result.parsed_result != expected || !result.error.empty()) {
+        std::cout << "expected ('@' marks the end of line):\n" << show_space(expected)
+            << "\nget ('@' marks the end of line):\n" << show_space(result.parsed_result) << result.error << std::endl;
+        pass = false;
+    }
+    return pass;
+}
+
+bool test3(pep::cprep::Preprocessor &preprocessor, pep::cprep::ShaderIncluder &includer) {
+    auto prelude =
+R"(#include "once.hpp"
+#include "guarded.hpp"
+#define MIX(t) LERP(LOW, HIGH, t)
+#define VARIADIC(x, ...) x(__VA_ARGS__)
+)";
+    auto in_src =
+R"(#include "once.hpp"
+#include "guarded.hpp"
+#include "math.hpp"
+#ifdef LOW
+float v = MIX(0.5);
+#endif
+int w = VARIADIC(LERP, 1, 2, 0.5);
+)";
+
+    std::string_view options[]{"-DLOW=0", "-DHIGH=1"};
+    pep::cprep::MacroEnvironment base{options, 2};
+    auto environment = preprocessor.do_preprocess_prelude("/prelude.hpp", prelude, includer, base);
+    auto blob = environment.to_snapshot();
+    pep::cprep::MacroEnvironment loaded{};
+    auto pass = pep::cprep::MacroEnvironment::from_snapshot(blob, loaded)
+        && loaded.is_defined("MIX") && loaded.is_defined("GUARDED_HPP") && !loaded.is_defined("UNKNOWN");
+    // broken blobs are rejected
+    pep::cprep::MacroEnvironment broken{};
+    pass &= !pep::cprep::MacroEnvironment::from_snapshot(std::string_view{blob}.substr(0, blob.size() - 1), broken)
+        && !pep::cprep::MacroEnvironment::from_snapshot("not a snapshot", broken);
+    // snapshot of an environment loaded from snapshot is the same
+    pass &= loaded.to_snapshot() == blob;
+    if (!pass) { std::cout << "unexpected environment from snapshot" << std::endl; }
+
+    // headers included by prelude are not entered again
+    auto expected = preprocessor.do_preprocess("/test.cpp", in_src, includer, environment);
+    if (expected.parsed_result.find("int once;") != std::string::npos) {
+        std::cout << "header with '#pragma once' is entered again" << std::endl;
+        pass = false;
+    }
+    pass &= expect_same(preprocessor.do_preprocess("/test.cpp", in_src, includer, loaded), expected);
+
+    // layers on top of snapshot are flattened into one above it
+    std::string_view undefine_options[]{"-ULOW"};
+    auto derived = loaded.derive(undefine_options, 1);
+    for (int i = 0; i < 20; i++) {
+        auto option = "-DLEVEL_" + std::to_string(i);
+        std::string_view derive_options[]{option};
+        derived = derived.derive(derive_options, 1);
+    }
+    if (derived.is_defined("LOW") || !derived.is_defined("HIGH") || !derived.is_defined("LEVEL_19")) {
+        std::cout << "unexpected macros in environment derived from snapshot" << std::endl;
+        pass = false;
+    }
+    pass &= expect_same(
+        preprocessor.do_preprocess("/test.cpp", in_src, includer, derived),
+        preprocessor.do_preprocess("/test.cpp", in_src, includer, environment, undefine_options, 1)
+    );
+    return pass;
+}
+
+int main() {
+    pep::cprep::Preprocessor preprocessor{};
+    TestIncluder includer{};
+
+    auto pass = true;
+
+    pass &= test1(preprocessor, includer);
+    pass &= test2(preprocessor, includer);
+    pass &= test3(preprocessor, includer);
+
+    return pass ? 0 : 1;
+}
@@ -0,0 +1,355 @@
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+
+#include <cprep/fs_includer.hpp>
+
+#include "common.hpp"
+
+namespace fs = std::filesystem;
+
+void write_file(const fs::path &path, std::string_view content) {
+    fs::create_directories(path.parent_path());
+    std::ofstream fout(path, std::ios::binary);
+    fout.write(content.data(), content.size());
+}
+
+// path of the lexed form of 'content' in a lexed cache directory
+fs::path lexed_file_path(const fs::path &cache_dir, std::string_view content) {
+    char name[48];
+    std::snprintf(
+        name, sizeof(name), "%016llx-%llx.lex",
+        static_cast<unsigned long long>(pep::cprep::hash_content(content)),
+        static_cast<unsigned long long>(content.size())
+    );
+    return cache_dir / name;
+}
+
+bool test1(pep::cprep::Preprocessor &preprocessor, const fs::path &root) {
+    write_file(root / "inc/a.hpp", "int a;\n");
+    write_file(root / "inc/sub/b.hpp", "#include \"a.hpp\"\n");
+    write_file(root / "inc/sub/a.hpp", "int sub_a;\n");
+    pep::cprep::FsShaderIncluder includer{{root / "inc"}};
+
+    auto in_src =
+R"(#include <sub/b.hpp>
+#include <a.hpp>
+#if __has_include(<c.hpp>) || __has_include("a.hpp")
+int c;
+#endif
+)";
+    auto line = [&root](int lineno, std::string_view path) {
+        return "#line " + std::to_string(lineno) + " \"" + (root / path).string() + "\"\n";
+    };
+    auto expected = line(1, "inc/sub/b.hpp")
+        + line(1, "inc/sub/a.hpp")
+        + "int sub_a;\n\n"
+        + line(2, "inc/sub/b.hpp")
+        + "\n"
+        + line(2, "main.cpp")
+        + line(1, "inc/a.hpp")
+        + "int a;\n\n"
+        + line(3, "main.cpp")
+        + "\nint c;\n\n";
+    auto result = preprocessor.do_preprocess((root / "main.cpp").string(), in_src, includer);
+    if (result.parsed_result != expected || !result.error.empty()) {
+        std::cout << "expected:\n" << show_space(expected) << "\nget:\n" << show_space(result.parsed_result) << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool expect_header(
+    pep::cprep::Preprocessor &preprocessor,
+    pep::cprep::FsShaderIncluder &includer,
+    const fs::path &root,
+    std::string_view expected_line
+) {
+    auto result = preprocessor.do_preprocess((root / "main.cpp").string(), "#include <h.hpp>\n", includer);
+    auto pass = result.parsed_result.find(expected_line) != std::string::npos;
+    if (!pass) {
+        std::cout << "expected to find:\n" << expected_line << "\nget:\n" << result.parsed_result << std::endl;
+    }
+    return pass;
+}
+
+bool test2(pep::cprep::Preprocessor &preprocessor, const fs::path &root) {
+    write_file(root / "inc/h.hpp", "int old_value;\n");
+    pep::cprep::FsShaderIncluder revalidate_includer{{root / "inc"}};
+    pep::cprep::FsShaderIncluder keep_includer{{root / "inc"}, pep::cprep::FsShaderIncluder::ClearPolicy::eKeep};
+
+    auto pass = true;
+    pass &= expect_header(preprocessor, revalidate_includer, root, "int old_value;");
+    pass &= expect_header(preprocessor, keep_includer, root, "int old_value;");
+
+    write_file(root / "inc/h.hpp", "int new_value_with_another_size;\n");
+    pass &= expect_header(preprocessor, revalidate_includer, root, "int new_value_with_another_size;");
+    pass &= expect_header(preprocessor, keep_includer, root, "int old_value;");
+
+    keep_includer.purge();
+    pass &= expect_header(preprocessor, keep_includer, root, "int new_value_with_another_size;");
+
+    // kept directory listings see a header added to an earlier include directory
+    fs::create_directories(root / "first");
+    pep::cprep::FsShaderIncluder two_dirs_includer{{root / "first", root / "inc"}};
+    pass &= expect_header(preprocessor, two_dirs_includer, root, "int new_value_with_another_size;");
+    write_file(root / "first/h.hpp", "int first_value;\n");
+    pass &= expect_header(preprocessor, two_dirs_includer, root, "int first_value;");
+    return pass;
+}
+
+bool test3(pep::cprep::Preprocessor &preprocessor, const fs::path &root) {
+    auto header =
+R"(#ifdef USE_A
+int a;
+#else
+int b;
+#endif
+)";
+    auto broken_header = "#ifndef BROKEN\nint broken;\n#endif\n";
+    write_file(root / "inc/lexed.hpp", header);
+    write_file(root / "inc/broken.hpp", broken_header);
+    pep::cprep::FsShaderIncluder includer{{root / "inc"}};
+    auto in_src = "#include <lexed.hpp>\n#include <broken.hpp>\n";
+    auto expected = preprocessor.do_preprocess((root / "main.cpp").string(), in_src, includer);
+
+    auto cache_dir = root / "lex_cache";
+    auto lexed_file = [&cache_dir](std::string_view content) { return lexed_file_path(cache_dir, content); };
+    // broken file in cache is not used and is replaced
+    write_file(lexed_file(broken_header), "CPREPLEX broken");
+
+    pep::cprep::set_lexed_cache_directory(cache_dir.string());
+    pep::cprep::Preprocessor cached_preprocessor{};
+    auto result = cached_preprocessor.do_preprocess((root / "main.cpp").string(), in_src, includer);
+    pep::cprep::set_lexed_cache_directory("");
+
+    auto pass = result.parsed_result == expected.parsed_result && result.error == expected.error;
+    if (!pass) {
+        std::cout << "expected:\n" << show_space(expected.parsed_result)
+            << "\nget:\n" << show_space(result.parsed_result) << std::endl;
+    }
+    if (!fs::exists(lexed_file(header)) || fs::file_size(lexed_file(broken_header)) <= 15) {
+        std::cout << "lexed headers are not written to cache directory" << std::endl;
+        pass = false;
+    }
+    return pass;
+}
+
+#ifdef __linux__
+bool test4(pep::cprep::Preprocessor &preprocessor, const fs::path &root) {
+    auto watch_root = root / "watch";
+    write_file(watch_root / "second/h.hpp", "int old_value;\n");
+    fs::create_directories(watch_root / "first");
+    pep::cprep::FsShaderIncluder includer{
+        {watch_root / "first", watch_root / "second"}, pep::cprep::FsShaderIncluder::ClearPolicy::eWatch
+    };
+    std::vector<std::string> changed_paths{};
+    includer.add_change_listener([&changed_paths](const std::string &path) { changed_paths.push_back(path); });
+
+    auto pass = true;
+    pass &= expect_header(preprocessor, includer, watch_root, "int old_value;");
+
+    // same size, so it's the watcher rather than mtime and size that finds it
+    write_file(watch_root / "second/h.hpp", "int new_value;\n");
+    pass &= expect_header(preprocessor, includer, watch_root, "int new_value;");
+
+    write_file(watch_root / "first/h.hpp", "int first_value;\n");
+    pass &= expect_header(preprocessor, includer, watch_root, "int first_value;");
+
+    auto has_changed = [&changed_paths](const fs::path &path) {
+        return std::find(changed_paths.begin(), changed_paths.end(), path.string()) != changed_paths.end();
+    };
+    if (!has_changed(watch_root / "second/h.hpp") || !has_changed(watch_root / "first/h.hpp")) {
+        std::cout << "changes are not reported to listeners" << std::endl;
+        pass = false;
+    }
+    return pass;
+}
+#endif
+
+// a lexed file whose '#if' doesn't end at its '#endif' is rejected, instead of skipping backwards forever
+bool test5(const fs::path &root) {
+    // the same tokens, so a lexed file of one is a valid file of the other after its content hash is changed
+    std::string_view header = "#define X\n#if 0\n#if 1\nint a;\n#endif\n#endif\nint c;\n";
+    std::string_view corrupted_header = "#define X\n#if 0\n#if 1\nint b;\n#endif\n#endif\nint c;\n";
+    write_file(root / "corrupted/a.hpp", header);
+    write_file(root / "corrupted/b.hpp", corrupted_header);
+    pep::cprep::FsShaderIncluder includer{{root / "corrupted"}};
+    auto cache_dir = root / "corrupted_lex_cache";
+    auto lexed_file = [&cache_dir](std::string_view content) { return lexed_file_path(cache_dir, content); };
+
+    pep::cprep::set_lexed_cache_directory(cache_dir.string());
+    pep::cprep::Preprocessor preprocessor{};
+    preprocessor.do_preprocess((root / "main.cpp").string(), "#include <a.hpp>\n", includer);
+    std::string data{};
+    {
+        std::ifstream fin(lexed_file(header), std::ios::binary);
+        std::ostringstream ss;
+        ss << fin.rdbuf();
+        data = std::move(ss).str();
+    }
+    // header is (magic, version, byte order, content hash, content size, tokens, directives, total size),
+    // followed by offsets, lengths and line deltas of tokens, then directives and their ends
+    uint32_t num_tokens = 0;
+    uint32_t num_directives = 0;
+    if (data.size() < 48) {
+        pep::cprep::set_lexed_cache_directory("");
+        std::cout << "lexed header is not written to cache directory" << std::endl;
+        return false;
+    }
+    std::memcpy(&num_tokens, data.data() + 32, sizeof(num_tokens));
+    std::memcpy(&num_directives, data.data() + 36, sizeof(num_directives));
+    const auto content_hash = pep::cprep::hash_content(corrupted_header);
+    std::memcpy(data.data() + 16, &content_hash, sizeof(content_hash));
+    // '#if 1' ends at '#if 0', which is right before it
+    const uint32_t end = 1;
+    std::memcpy(data.data() + 48 + 12 * num_tokens + 4 * num_directives + 4 * 2, &end, sizeof(end));
+    write_file(lexed_file(corrupted_header), data);
+
+    auto result = preprocessor.do_preprocess((root / "main.cpp").string(), "#include <b.hpp>\n", includer);
+    pep::cprep::set_lexed_cache_directory("");
+    auto pass = result.parsed_result.find("int c;") != std::string::npos && result.error.empty();
+    if (!pass) {
+        std::cout << "corrupted lexed file is used:\n" << show_space(result.parsed_result) << std::endl;
+    }
+    return pass;
+}
+
+bool test6(const fs::path &root) {
+    std::string_view header = "int cleared;\n";
+    write_file(root / "cleared/a.hpp", header);
+    pep::cprep::FsShaderIncluder includer{{root / "cleared"}};
+    auto cache_dir = root / "cleared_lex_cache";
+    const auto lexed_file = lexed_file_path(cache_dir, header);
+    pep::cprep::set_lexed_cache_directory(cache_dir.string());
+    // new preprocessors, so that the header is not replayed
+    auto preprocess = [&root, &includer]() {
+        pep::cprep::Preprocessor preprocessor{};
+        preprocessor.do_preprocess((root / "main.cpp").string(), "#include <a.hpp>\n", includer);
+    };
+
+    // the lexed form kept in memory is used without going to the directory until it's cleared
+    preprocess();
+    auto pass = fs::remove(lexed_file);
+    preprocess();
+    pass &= !fs::exists(lexed_file);
+    pep::cprep::clear_lexed_cache();
+    preprocess();
+    pass &= fs::exists(lexed_file);
+    pep::cprep::set_lexed_cache_directory("");
+    if (!pass) {
+        std::cout << "lexed cache in memory is not cleared" << std::endl;
+    }
+    return pass;
+}
+
+#ifdef __linux__
+// an include directory created a level at a time is seen, though its missing parents are watched at first
+bool test7(pep::cprep::Preprocessor &preprocessor, const fs::path &root) {
+    auto nested_root = root / "nested";
+    fs::create_directories(nested_root / "a");
+    pep::cprep::FsShaderIncluder includer{
+        {nested_root / "a/b/c"}, pep::cprep::FsShaderIncluder::ClearPolicy::eWatch
+    };
+    auto has_header = [&]() {
+        auto result = preprocessor.do_preprocess(
+            (nested_root / "main.cpp").string(), "#if __has_include(<h.hpp>)\nfound\n#endif\n", includer
+        );
+        return result.parsed_result.find("found") != std::string::npos;
+    };
+
+    auto pass = !has_header();
+    fs::create_directory(nested_root / "a/b");
+    pass &= !has_header();
+    write_file(nested_root / "a/b/c/h.hpp", "int nested;\n");
+    pass &= has_header();
+    if (!pass) {
+        std::cout << "header in a nested include directory created later is not found" << std::endl;
+    }
+    return pass;
+}
+#endif
+
+// 'revalidate()' during a run sees changed headers and keeps the contents already viewed
+bool test8(const fs::path &root) {
+    write_file(root / "reval/h.hpp", "int old_value;\n");
+    pep::cprep::FsShaderIncluder includer{{root / "reval"}};
+    const auto source_path = (root / "main.cpp").string();
+    pep::cprep::ShaderIncluder::Result old_result{};
+    auto pass = includer.require_header("h.hpp", source_path, old_result);
+    pass &= !includer.has_pending_changes();
+
+    write_file(root / "reval/h.hpp", "int new_value_with_another_size;\n");
+    write_file(root / "reval/added.hpp", "int added;\n");
+    pep::cprep::ShaderIncluder::Result result{};
+    pass &= includer.require_header("h.hpp", source_path, result) && result.header_content == "int old_value;\n";
+    pass &= !includer.require_header("added.hpp", source_path, result);
+
+    includer.revalidate();
+    pass &= includer.require_header("h.hpp", source_path, result)
+        && result.header_content == "int new_value_with_another_size;\n";
+    pass &= includer.require_header("added.hpp", source_path, result) && result.header_content == "int added;\n";
+    pass &= old_result.header_content == "int old_value;\n";
+    includer.clear();
+    if (!pass) { std::cout << "revalidated includer gives stale headers" << std::endl; }
+    return pass;
+}
+
+// a header changed right after it's loaded is noticed even if mtime and size stay the same
+bool test9(pep::cprep::Preprocessor &preprocessor, const fs::path &root) {
+    write_file(root / "racy/h.hpp", "int value_a;\n");
+    pep::cprep::FsShaderIncluder includer{{root / "racy"}};
+    auto pass = expect_header(preprocessor, includer, root, "int value_a;");
+
+    const auto mtime = fs::last_write_time(root / "racy/h.hpp");
+    write_file(root / "racy/h.hpp", "int value_b;\n");
+    fs::last_write_time(root / "racy/h.hpp", mtime);
+    pass &= expect_header(preprocessor, includer, root, "int value_b;");
+    return pass;
+}
+
+// '#include <...>' doesn't search the directory of the including file, '#include "..."' does
+bool test10(pep::cprep::Preprocessor &preprocessor, const fs::path &root) {
+    write_file(root / "forms/src/local.hpp", "int local_value;\n");
+    pep::cprep::FsShaderIncluder includer{{root / "forms/inc"}};
+    const auto source_path = (root / "forms/src/main.cpp").string();
+    auto quoted = preprocessor.do_preprocess(source_path, "#include \"local.hpp\"\n", includer);
+    auto angled = preprocessor.do_preprocess(source_path, "#include <local.hpp>\n", includer);
+    auto pass = quoted.error.empty() && quoted.parsed_result.find("int local_value;") != std::string::npos;
+    // a header not found is left to the compiler
+    pass &= angled.parsed_result.find("#include <local.hpp>") != std::string::npos
+        && angled.parsed_result.find("int local_value;") == std::string::npos;
+    if (!pass) {
+        std::cout << "quoted include:\n" << quoted.parsed_result << quoted.error
+            << "\nangled include:\n" << angled.parsed_result << angled.error << std::endl;
+    }
+    return pass;
+}
+
+int main() {
+    pep::cprep::Preprocessor preprocessor{};
+    auto root = make_temp_directory("cprep_test_fs_include");
+
+    auto pass = true;
+
+    pass &= test1(preprocessor, root);
+    pass &= test2(preprocessor, root);
+    pass &= test3(preprocessor, root);
+#ifdef __linux__
+    pass &= test4(preprocessor, root);
+#endif
+    pass &= test5(root);
+    pass &= test6(root);
+#ifdef __linux__
+    pass &= test7(preprocessor, root);
+#endif
+    pass &= test8(root);
+    pass &= test9(preprocessor, root);
+    pass &= test10(preprocessor, root);
+
+    fs::remove_all(root);
+
+    return pass ? 0 : 1;
+}
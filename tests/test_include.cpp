@@ -2,19 +2,46 @@
 
 class TestIncluder final : public pep::cprep::ShaderIncluder {
 public:
-    bool require_header(std::string_view header_name, std::string_view file_path, Result &result) override {
+    bool require_header(std::string_view header_name, std::string_view /*file_path*/, Result &result) override {
         if (header_name == "a.hpp") {
             result.header_path = "/a.hpp";
             result.header_content = "#pragma once\nint func_a();\n";
             return true;
         }
         if (header_name == "b.hpp") {
+            ++num_b_required;
             result.header_path = "/b.hpp";
             result.header_content = "#ifndef B_HPP_\n#define B_HPP_\nint func_b();\n#endif\n";
             return true;
         }
+        if (header_name == "e.hpp") {
+            result.header_path = "/e.hpp";
+            result.header_content =
+                "#ifdef USE_E\n#define E_VALUE 1\n#else\n#define E_VALUE 2\n#endif\n#include \"a.hpp\"\nint e = E_VALUE;\n";
+            return true;
+        }
+        if (header_name == "d.hpp") {
+            result.header_path = "/d.hpp";
+            result.header_content = "// not guarded\n#ifndef C_HPP_\n#define C_HPP_\n#endif\nint c;\n";
+            return true;
+        }
+        if (header_name == "h.hpp") {
+            result.header_path = "/h.hpp";
+            result.header_content = "#include \"n.hpp\"\n";
+            return true;
+        }
+        if (header_name == "n.hpp") {
+            ++num_n_required;
+            result.header_path = "/n.hpp";
+            result.header_content = n_version == 1 ? "#ifdef N1\n#endif\n" : "#ifdef N2\n#endif\n";
+            return true;
+        }
         return false;
     }
+
+    size_t num_b_required = 0;
+    size_t num_n_required = 0;
+    int n_version = 1;
 };
 
 bool test1(pep::cprep::Preprocessor &preprocessor, pep::cprep::ShaderIncluder &includer) {
@@ -49,13 +76,7 @@ int func_b();
 
 
 #line 8 "/test.cpp"
-#line 1 "/b.hpp"
-
-
-
-
 
-#line 9 "/test.cpp"
 int main() {
     return 0;
 }
@@ -98,6 +119,323 @@ int main() {
     return expect_ok(preprocessor, includer, in_src, expected, nullptr, 0);
 }
 
+bool test3(pep::cprep::Preprocessor &preprocessor, TestIncluder &includer) {
+    auto in_src =
+R"(#include "b.hpp"
+#include "b.hpp"
+#undef B_HPP_
+#include "b.hpp"
+#include "d.hpp"
+#include "d.hpp"
+)";
+    auto expected =
+R"(#line 1 "/b.hpp"
+
+
+int func_b();
+
+
+#line 2 "/test.cpp"
+
+
+#line 1 "/b.hpp"
+
+
+int func_b();
+
+
+#line 5 "/test.cpp"
+#line 1 "/d.hpp"
+            
+
+
+
+int c;
+
+#line 6 "/test.cpp"
+#line 1 "/d.hpp"
+            
+
+
+
+int c;
+
+#line 7 "/test.cpp"
+)";
+    includer.num_b_required = 0;
+    auto pass = expect_ok(preprocessor, includer, in_src, expected, nullptr, 0);
+    // 'expect_ok()' runs 3 times, in each run the header is loaded once and later includes don't call includer
+    if (includer.num_b_required != 3) {
+        std::cout << "includer is called " << includer.num_b_required << " times for 'b.hpp'" << std::endl;
+        pass = false;
+    }
+    return pass;
+}
+
+bool test4(pep::cprep::Preprocessor &preprocessor, pep::cprep::ShaderIncluder &includer) {
+    auto in_src =
+R"(#include "e.hpp"
+int v = E_VALUE;
+)";
+    auto expected_with_e =
+R"(#line 1 "/e.hpp"
+
+
+
+
+
+#line 1 "/a.hpp"
+
+int func_a();
+
+#line 7 "/e.hpp"
+int e = 1;
+
+#line 2 "/test.cpp"
+int v = 1;
+)";
+    auto expected_without_e =
+R"(#line 1 "/e.hpp"
+
+
+
+
+
+#line 1 "/a.hpp"
+
+int func_a();
+
+#line 7 "/e.hpp"
+int e = 2;
+
+#line 2 "/test.cpp"
+int v = 2;
+)";
+    auto in_src_a_first =
+R"(#include "a.hpp"
+#include "e.hpp"
+int v = E_VALUE;
+)";
+    auto expected_a_first =
+R"(#line 1 "/a.hpp"
+
+int func_a();
+
+#line 2 "/test.cpp"
+#line 1 "/e.hpp"
+
+
+
+
+
+
+int e = 2;
+
+#line 3 "/test.cpp"
+int v = 2;
+)";
+    std::string_view options[] = {"-DUSE_E"};
+    auto pass = true;
+    // header is recorded and replayed under different macro states, output and effects must follow the state
+    for (int i = 0; i < 2; i++) {
+        pass &= expect_ok(preprocessor, includer, in_src, expected_with_e, options, 1);
+        pass &= expect_ok(preprocessor, includer, in_src, expected_without_e, nullptr, 0);
+        pass &= expect_ok(preprocessor, includer, in_src_a_first, expected_a_first, nullptr, 0);
+    }
+    return pass;
+}
+
+bool test5(pep::cprep::Preprocessor &preprocessor, pep::cprep::ShaderIncluder &includer) {
+    auto in_src =
+R"(#include "e.hpp"
+#include "a.hpp"
+#if __has_include(<missing.hpp>) || __has_include("a.hpp")
+#include "a.hpp"
+#endif
+)";
+    using Form = pep::cprep::ShaderIncluder::HeaderForm;
+    std::vector<pep::cprep::Preprocessor::IncludeDependency> expected{
+        {"a.hpp", Form::eQuoted, "/e.hpp", "/a.hpp"},
+        {"a.hpp", Form::eQuoted, "/test.cpp", "/a.hpp"},
+        {"e.hpp", Form::eQuoted, "/test.cpp", "/e.hpp"},
+        {"missing.hpp", Form::eAngled, "/test.cpp", ""},
+    };
+    auto pass = true;
+    // includes of 'e.hpp' are also reported when it's replayed
+    for (int i = 0; i < 2; i++) {
+        auto result = preprocessor.do_preprocess("/test.cpp", in_src, includer);
+        auto same = result.includes.size() == expected.size();
+        for (size_t j = 0; j < expected.size() && same; j++) {
+            const auto &a = result.includes[j];
+            const auto &b = expected[j];
+            same = a.header_name == b.header_name && a.form == b.form
+                && a.including_path == b.including_path && a.header_path == b.header_path;
+        }
+        if (!same) {
+            std::cout << "unexpected includes:" << std::endl;
+            for (const auto &include : result.includes) {
+                std::cout << include.including_path << " -> " << include.header_name
+                    << " = '" << include.header_path << "'" << std::endl;
+            }
+            pass = false;
+        }
+    }
+    return pass;
+}
+
+bool test6(pep::cprep::Preprocessor &preprocessor, pep::cprep::ShaderIncluder &includer) {
+    auto in_src =
+R"(#include "e.hpp"
+#if SCAN_LEVEL > 1
+#include "b.hpp"
+#endif
+int value = E_VALUE + TEXT_MACRO;
+)";
+    std::string_view options[] = {"-DUSE_E", "-DSCAN_LEVEL=2", "-DTEXT_MACRO=3"};
+    std::vector<std::string> expected_includes{"/e.hpp -> a.hpp", "/test.cpp -> b.hpp", "/test.cpp -> e.hpp"};
+    // macros only used by active code are not reported
+    std::vector<std::string> expected_macros{"B_HPP_", "SCAN_LEVEL", "USE_E"};
+    auto pass = true;
+    // the second scan replays headers recorded by the first one
+    for (int i = 0; i < 2; i++) {
+        auto result = preprocessor.do_scan("/test.cpp", in_src, includer, options, 3);
+        std::vector<std::string> includes{};
+        for (const auto &include : result.includes) {
+            includes.push_back(include.including_path + " -> " + include.header_name);
+        }
+        std::vector<std::string> macros{};
+        for (const auto &dependency : result.macro_dependencies) { macros.push_back(dependency.name); }
+        if (!result.parsed_result.empty() || !result.error.empty()) {
+            std::cout << "unexpected scan result:" << std::endl << result.parsed_result << result.error << std::endl;
+            pass = false;
+        }
+        if (includes != expected_includes || macros != expected_macros) {
+            std::cout << "unexpected scan dependencies:" << std::endl;
+            for (const auto &include : includes) { std::cout << include << std::endl; }
+            for (const auto &macro : macros) { std::cout << macro << std::endl; }
+            pass = false;
+        }
+    }
+
+    // headers recorded by scans are not replayed by preprocessing
+    pep::cprep::Preprocessor fresh_preprocessor{};
+    auto expected = fresh_preprocessor.do_preprocess("/test.cpp", in_src, includer, options, 3);
+    pass &= expect_ok(preprocessor, includer, in_src, expected.parsed_result, options, 3);
+    return pass;
+}
+
+bool test7(pep::cprep::Preprocessor &preprocessor, pep::cprep::ShaderIncluder &includer) {
+    auto in_src =
+R"(int a = 1;
+/* comment
+   lines */ int b = 2;
+#include "a.hpp"
+int c = 3;
+#warning stop here
+)";
+    // skipped code still counts lines
+    pep::cprep::Preprocessor fresh_preprocessor{};
+    auto expected = fresh_preprocessor.do_preprocess("/test.cpp", in_src, includer);
+    auto pass = true;
+    for (int i = 0; i < 2; i++) {
+        auto result = preprocessor.do_scan("/test.cpp", in_src, includer);
+        if (
+            result.warning.empty() || result.warning != expected.warning
+            || result.includes.size() != expected.includes.size()
+        ) {
+            std::cout << "unexpected scan result:" << std::endl << result.warning << "expected:" << std::endl
+                << expected.warning << std::endl;
+            pass = false;
+        }
+    }
+    return pass;
+}
+
+// records headers prefetched before they are required
+class PrefetchIncluder final : public pep::cprep::ShaderIncluder {
+public:
+    explicit PrefetchIncluder(ShaderIncluder &includer) : includer_(includer) {}
+
+    bool require_header(std::string_view header_name, std::string_view file_path, Result &result) override {
+        return require_header(header_name, file_path, HeaderForm::eQuoted, result);
+    }
+
+    bool require_header(
+        std::string_view header_name, std::string_view file_path, HeaderForm form, Result &result
+    ) override {
+        auto key = std::string{form == HeaderForm::eQuoted ? "\"" : "<"} + std::string{header_name};
+        required += (prefetched.find(key + ",") != std::string::npos ? "+" : "-") + key + ",";
+        return includer_.require_header(header_name, file_path, form, result);
+    }
+
+    void prefetch_header(std::string_view header_name, std::string_view /*file_path*/, HeaderForm form) override {
+        prefetched += std::string{form == HeaderForm::eQuoted ? "\"" : "<"} + std::string{header_name} + ",";
+    }
+
+    void clear() override { includer_.clear(); }
+
+    std::string prefetched;
+    std::string required;
+
+private:
+    ShaderIncluder &includer_;
+};
+
+bool test8(pep::cprep::ShaderIncluder &includer) {
+    auto in_src =
+R"(#define B "b.hpp"
+#include B
+  #  include "e.hpp"
+#if 0
+#include <d.hpp>
+#endif
+// #include "c.hpp
+)";
+    // headers seen in other tests are replayed rather than entered
+    pep::cprep::Preprocessor fresh_preprocessor{};
+    PrefetchIncluder prefetch_includer{includer};
+    auto pass = true;
+    // sources are lexed when they are seen again, names are found without and with lexed forms
+    for (int i = 0; i < 2; i++) {
+        prefetch_includer.prefetched.clear();
+        prefetch_includer.required.clear();
+        fresh_preprocessor.do_preprocess("/test.cpp", in_src, prefetch_includer);
+        const auto &prefetched = prefetch_includer.prefetched;
+        const auto &required = prefetch_includer.required;
+        if (prefetched != "\"e.hpp,<d.hpp,\"a.hpp," || required != "-\"b.hpp,+\"e.hpp,+\"a.hpp,") {
+            std::cout << "unexpected prefetches: " << prefetched << " required: " << required << std::endl;
+            pass = false;
+        }
+    }
+    return pass;
+}
+
+bool test9(TestIncluder &includer) {
+    auto in_src = "#include \"h.hpp\"\n";
+    pep::cprep::Preprocessor fresh_preprocessor{};
+    auto pass = true;
+    // 'h.hpp' is entered, then recorded with 'n.hpp' reading 'N1'
+    for (int i = 0; i < 2; i++) {
+        fresh_preprocessor.do_preprocess("/test.cpp", in_src, includer);
+    }
+
+    // the recorded replay matches on 'N1' but not on content of 'n.hpp',
+    // so the run only reads what the new content tests, and 'n.hpp' is loaded once
+    includer.n_version = 2;
+    includer.num_n_required = 0;
+    auto result = fresh_preprocessor.do_preprocess("/test.cpp", in_src, includer);
+    std::vector<std::string> macros{};
+    for (const auto &dependency : result.macro_dependencies) { macros.push_back(dependency.name); }
+    if (macros != std::vector<std::string>{"N2"} || includer.num_n_required != 1) {
+        std::cout << "unexpected inputs after a replay is not matched, 'n.hpp' loaded "
+            << includer.num_n_required << " times:" << std::endl;
+        for (const auto &macro : macros) { std::cout << macro << std::endl; }
+        pass = false;
+    }
+    includer.n_version = 1;
+    return pass;
+}
+
 int main() {
     pep::cprep::Preprocessor preprocessor{};
     TestIncluder includer{};
@@ -106,6 +444,13 @@ int main() {
 
     pass &= test1(preprocessor, includer);
     pass &= test2(preprocessor, includer);
+    pass &= test3(preprocessor, includer);
+    pass &= test4(preprocessor, includer);
+    pass &= test5(preprocessor, includer);
+    pass &= test6(preprocessor, includer);
+    pass &= test7(preprocessor, includer);
+    pass &= test8(includer);
+    pass &= test9(includer);
 
     return pass ? 0 : 1;
 }
@@ -0,0 +1,83 @@
+#include <cprep/pack_includer.hpp>
+
+#include "common.hpp"
+
+bool test1(pep::cprep::Preprocessor &preprocessor) {
+    auto pack = pep::cprep::PackShaderIncluder::write({
+        {"a.hpp", "#pragma once\nint a;\n"},
+        {"sub/b.hpp", "#include \"a.hpp\"\n#include \"../c.hpp\"\nint b;\n"},
+        {"sub/a.hpp", "#pragma once\nint sub_a;\n"},
+        {"./c.hpp", "int c;\n"},
+        // first one wins
+        {"a.hpp", "int another_a;\n"},
+    });
+    pep::cprep::PackShaderIncluder includer{};
+    if (!includer.load_from_data(pack) || includer.num_headers() != 4) {
+        std::cout << "failed to load pack" << std::endl;
+        return false;
+    }
+
+    auto in_src =
+R"(#include <sub/b.hpp>
+#include "a.hpp"
+#if __has_include(<d.hpp>) || !__has_include(<sub/a.hpp>)
+int d;
+#endif
+)";
+    auto expected =
+R"(#line 1 "sub/b.hpp"
+#line 1 "sub/a.hpp"
+
+int sub_a;
+
+#line 2 "sub/b.hpp"
+#line 1 "c.hpp"
+int c;
+
+#line 3 "sub/b.hpp"
+int b;
+
+#line 2 "/test.cpp"
+#line 1 "a.hpp"
+
+int a;
+
+#line 3 "/test.cpp"
+
+
+
+)";
+    return expect_ok(preprocessor, includer, in_src, expected, nullptr, 0);
+}
+
+bool test2() {
+    auto pack = pep::cprep::PackShaderIncluder::write({{"a.hpp", "int a;\n"}});
+    pep::cprep::PackShaderIncluder includer{};
+    auto pass = true;
+    // truncated or broken packs are rejected
+    pass &= !includer.load_from_data(std::string_view{pack}.substr(0, pack.size() - 1));
+    auto broken_pack = pack;
+    broken_pack[0] = 'X';
+    pass &= !includer.load_from_data(broken_pack);
+    pass &= !includer.load("/nonexistent/cprep_test.pack");
+    pass &= includer.num_headers() == 0;
+
+    auto empty_pack = pep::cprep::PackShaderIncluder::write({});
+    pep::cprep::ShaderIncluder::Result result{};
+    pass &= includer.load_from_data(empty_pack) && !includer.require_header("a.hpp", "/test.cpp", result);
+    if (!pass) {
+        std::cout << "broken packs are not rejected" << std::endl;
+    }
+    return pass;
+}
+
+int main() {
+    pep::cprep::Preprocessor preprocessor{};
+
+    auto pass = true;
+
+    pass &= test1(preprocessor);
+    pass &= test2();
+
+    return pass ? 0 : 1;
+}
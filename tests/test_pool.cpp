@@ -0,0 +1,236 @@
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include <cprep/pool.hpp>
+
+#include "common.hpp"
+
+class TestIncluder final : public pep::cprep::ShaderIncluder {
+public:
+    bool require_header(std::string_view header_name, std::string_view /*file_path*/, Result &result) override {
+        // not thread-safe, the pool must serialize calls
+        ++num_required;
+        if (header_name == "common.hpp") {
+            result.header_path = "/common.hpp";
+            result.header_content = "#ifndef COMMON_HPP_\n#define COMMON_HPP_\n#define SCALE(x) ((x) * FACTOR)\n#endif\n";
+            return true;
+        }
+        return false;
+    }
+
+    size_t num_required = 0;
+};
+
+bool test1() {
+    auto in_src_a =
+R"(#include "common.hpp"
+#if VARIANT % 2
+float a = SCALE(VARIANT);
+#else
+float a = -SCALE(VARIANT);
+#endif
+)";
+    auto in_src_b =
+R"(#include "common.hpp"
+#ifdef FACTOR
+int b = SCALE(VARIANT);
+#endif
+)";
+
+    constexpr size_t kNumVariants = 64;
+    std::vector<std::string> variants;
+    std::vector<std::string_view> options;
+    variants.reserve(kNumVariants);
+    options.reserve(kNumVariants * 2);
+    std::vector<pep::cprep::PreprocessorPool::Job> jobs;
+    for (size_t i = 0; i < kNumVariants; i++) {
+        variants.push_back("-DVARIANT=" + std::to_string(i));
+        options.push_back(variants.back());
+        options.push_back(i % 3 == 0 ? "-DFACTOR=2" : "-UFACTOR");
+        jobs.push_back({
+            i % 2 == 0 ? "/a.cpp" : "/b.cpp", i % 2 == 0 ? in_src_a : in_src_b, &options[i * 2], 2,
+        });
+    }
+
+    pep::cprep::PreprocessorPool pool{4};
+    TestIncluder includer{};
+    auto pass = true;
+    // run twice, workers are reused by the second run
+    for (int run = 0; run < 2 && pass; run++) {
+        auto results = pool.do_preprocess(jobs, includer);
+        pass = results.size() == jobs.size();
+        for (size_t i = 0; i < results.size() && pass; i++) {
+            pep::cprep::Preprocessor preprocessor{};
+            TestIncluder single_includer{};
+            auto expected = preprocessor.do_preprocess(
+                jobs[i].input_path, jobs[i].input_content, single_includer, jobs[i].options, jobs[i].num_options
+            );
+            if (results[i].parsed_result != expected.parsed_result || results[i].error != expected.error) {
+                std::cout << "result of job " << i << " differs, expected:\n" << show_space(expected.parsed_result)
+                    << "\nget:\n" << show_space(results[i].parsed_result) << std::endl;
+                pass = false;
+            }
+        }
+    }
+    return pass;
+}
+
+class TestConcurrentIncluder final : public pep::cprep::ConcurrentShaderIncluder {
+public:
+    bool resolve_header(
+        std::string_view header_name, std::string_view /*file_path*/, HeaderForm /*form*/, std::string &header_path
+    ) override {
+        ++num_resolved;
+        if (header_name != "shared.hpp") {
+            return false;
+        }
+        header_path = "/shared.hpp";
+        return true;
+    }
+
+    bool load_header(std::string_view /*header_path*/, std::string &header_content) override {
+        ++num_loaded;
+        header_content = "#define SHARED 1\nint shared;\n";
+        return true;
+    }
+
+    std::atomic<size_t> num_resolved = 0;
+    std::atomic<size_t> num_loaded = 0;
+};
+
+bool test2() {
+    auto in_src =
+R"(#include "shared.hpp"
+#if __has_include(<missing.hpp>)
+#include <missing.hpp>
+#endif
+int x = SHARED + VALUE;
+)";
+    auto expected =
+R"(#line 1 "/shared.hpp"
+
+int shared;
+
+#line 2 "/test.cpp"
+
+
+
+int x = 1 + 3;
+)";
+
+    std::string_view options[] = {"-DVALUE=3"};
+    std::vector<pep::cprep::PreprocessorPool::Job> jobs(256, {"/test.cpp", in_src, options, 1});
+    pep::cprep::PreprocessorPool pool{8};
+    TestConcurrentIncluder includer{};
+    auto results = pool.do_preprocess(jobs, includer);
+    auto pass = true;
+    for (const auto &result : results) {
+        if (result.parsed_result != expected || !result.error.empty()) {
+            std::cout << "expected:\n" << show_space(expected) << "\nget:\n" << show_space(result.parsed_result)
+                << "\nerror:\n" << result.error << std::endl;
+            pass = false;
+            break;
+        }
+    }
+    // each (header name, directory, form) is resolved once, and each found header is loaded once
+    if (includer.num_resolved != 2 || includer.num_loaded != 1) {
+        std::cout << "headers are resolved " << includer.num_resolved << " times and loaded "
+            << includer.num_loaded << " times" << std::endl;
+        pass = false;
+    }
+
+    includer.purge();
+    results = pool.do_preprocess(std::span{jobs}.first(1), includer);
+    if (includer.num_resolved != 4 || includer.num_loaded != 2 || results[0].parsed_result != expected) {
+        std::cout << "headers are not loaded again after purged" << std::endl;
+        pass = false;
+    }
+    return pass;
+}
+
+// header of each name has its name as content, 'missing_*' are not found,
+// 'common_*' headers are the same file wherever they are included
+class NamedConcurrentIncluder final : public pep::cprep::ConcurrentShaderIncluder {
+public:
+    bool resolve_header(
+        std::string_view header_name, std::string_view file_path, HeaderForm /*form*/, std::string &header_path
+    ) override {
+        ++num_resolved;
+        if (header_name.starts_with("missing_")) {
+            return false;
+        }
+        header_path = header_name.starts_with("common_")
+            ? header_name : std::string{file_path.substr(0, file_path.rfind('/') + 1)} + std::string{header_name};
+        return true;
+    }
+
+    bool load_header(std::string_view header_path, std::string &header_content) override {
+        ++num_loaded;
+        header_content = header_path.substr(header_path.rfind('/') + 1);
+        return true;
+    }
+
+    std::atomic<size_t> num_resolved = 0;
+    std::atomic<size_t> num_loaded = 0;
+};
+
+bool test3() {
+    // enough headers for tables of shards to grow many times while other threads look them up
+    constexpr size_t kNumHeaders = 4096;
+    constexpr size_t kNumThreads = 8;
+    NamedConcurrentIncluder includer{};
+    std::atomic<bool> pass = true;
+    std::vector<std::thread> threads{};
+    for (size_t t = 0; t < kNumThreads; t++) {
+        threads.emplace_back([&includer, &pass, t]() {
+            for (size_t i = 0; i < kNumHeaders; i++) {
+                // threads go through headers from different starts
+                const auto name = (i % 2 == 0 ? "header_" : "missing_") + std::to_string((i + t * 512) % kNumHeaders);
+                pep::cprep::ShaderIncluder::Result result{};
+                const auto found = includer.require_header(name, "/test.cpp", result);
+                if (found != name.starts_with("header_") || (found && result.header_content != name)) {
+                    pass = false;
+                }
+            }
+        });
+    }
+    for (auto &thread : threads) { thread.join(); }
+    if (!pass || includer.num_resolved != kNumHeaders) {
+        std::cout << "headers are resolved " << includer.num_resolved << " times, expected " << kNumHeaders << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool test4() {
+    NamedConcurrentIncluder includer{};
+    auto pass = true;
+    // a common header is resolved once for each directory and loaded once,
+    // a local header is resolved once for the files of a directory
+    const std::pair<std::string_view, std::string_view> lookups[] = {
+        {"common_a.hpp", "/x/a.cpp"}, {"common_a.hpp", "/x/b.cpp"}, {"common_a.hpp", "/y/c.cpp"},
+        {"local.hpp", "/x/a.cpp"}, {"local.hpp", "/x/b.cpp"}, {"local.hpp", "/y/c.cpp"},
+    };
+    for (const auto &[name, file_path] : lookups) {
+        pep::cprep::ShaderIncluder::Result result{};
+        pass &= includer.require_header(name, file_path, result) && result.header_content == name;
+    }
+    if (!pass || includer.num_resolved != 4 || includer.num_loaded != 3) {
+        std::cout << "headers are resolved " << includer.num_resolved << " times and loaded "
+            << includer.num_loaded << " times" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+int main() {
+    auto pass = true;
+
+    pass &= test1();
+    pass &= test2();
+    pass &= test3();
+    pass &= test4();
+
+    return pass ? 0 : 1;
+}
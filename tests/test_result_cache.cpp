@@ -0,0 +1,106 @@
+#include <fstream>
+#include <sstream>
+
+#include "cli.hpp"
+#include "result_cache.hpp"
+
+#include "common.hpp"
+
+namespace fs = std::filesystem;
+
+void write_file(const fs::path &path, std::string_view content) {
+    fs::create_directories(path.parent_path());
+    std::ofstream fout(path, std::ios::binary);
+    fout.write(content.data(), content.size());
+}
+
+std::string read_file(const fs::path &path) {
+    std::ifstream fin(path, std::ios::binary);
+    std::ostringstream ss;
+    ss << fin.rdbuf();
+    return std::move(ss).str();
+}
+
+// a cached result is reused only if every lookup of the run, including those not found, resolves the same
+bool test1(const fs::path &root) {
+    write_file(root / "inc2/a.h", "A_FROM_INC2\n");
+    write_file(
+        root / "main.cpp",
+        "#if __has_include(\"ovr.h\")\nOVR\n#else\nBASE\n#endif\n#include \"a.h\"\n"
+    );
+    auto run = [&root](bool use_cache) {
+        std::vector<std::string> args{
+            "-I", (root / "inc1").string(), "-I", (root / "inc2").string(),
+            "-o", (root / "main.out").string(), (root / "main.cpp").string(),
+        };
+        if (use_cache) {
+            args.push_back("--cache");
+            args.push_back((root / "cache").string());
+        }
+        // a new session for each run, as separate processes do
+        CliSession session{};
+        std::ostringstream out{};
+        std::ostringstream err{};
+        if (run_cli(args, session, out, err) != 0) { return "failed: " + err.str(); }
+        return read_file(root / "main.out");
+    };
+
+    auto pass = true;
+    auto first = run(true);
+    pass &= first.find("BASE") != std::string::npos && first.find("A_FROM_INC2") != std::string::npos;
+    pass &= run(true) == first;
+
+    // a header shadowing the found one and a header that was not found before
+    write_file(root / "inc1/ovr.h", "");
+    write_file(root / "inc1/a.h", "A_FROM_INC1\n");
+    auto cached = run(true);
+    auto uncached = run(false);
+    pass &= cached == uncached
+        && uncached.find("OVR") != std::string::npos && uncached.find("A_FROM_INC1") != std::string::npos;
+    if (!pass) {
+        std::cout << "stale cached result:\n" << cached << "\nexpected:\n" << uncached << std::endl;
+    }
+    return pass;
+}
+
+// the directory is scanned only when the stored sizes may exceed the limit
+bool test2(const fs::path &root) {
+    const auto cache_dir = root / "evict_cache";
+    constexpr uintmax_t kMaxSize = 64 * 1024;
+    ResultCache cache{cache_dir, kMaxSize};
+    auto store = [&cache](size_t index) {
+        ResultCache::Entry entry{.output = std::string(1024, 'x'), .warning = {}, .includes = {}};
+        cache.store("inputs " + std::to_string(index), entry);
+    };
+    store(0);
+
+    // a file that is not written by stores is noticed by the next scan only
+    const auto stray_path = cache_dir / "zz/stray";
+    write_file(stray_path, std::string(kMaxSize, 's'));
+    fs::last_write_time(stray_path, fs::file_time_type::clock::now() - std::chrono::hours{1});
+    store(1);
+    auto pass = fs::exists(stray_path);
+    for (size_t i = 2; i < 64; i++) { store(i); }
+    pass &= !fs::exists(stray_path);
+
+    uintmax_t total_size = 0;
+    for (const auto &it : fs::recursive_directory_iterator{cache_dir}) {
+        if (it.is_regular_file()) { total_size += it.file_size(); }
+    }
+    pass &= total_size <= kMaxSize;
+    if (!pass) { std::cout << "cache directory is not bounded, size: " << total_size << std::endl; }
+    return pass;
+}
+
+int main() {
+    auto root = make_temp_directory("cprep_test_result_cache");
+
+    auto pass = true;
+
+    pass &= test1(root);
+    pass &= test2(root);
+
+    fs::remove_all(root);
+
+    return pass ? 0 : 1;
+}